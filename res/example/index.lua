@@ -22,26 +22,27 @@ repeat
         user = "unknown";
     end
 
-    local sb = util.StringBuilder:new()
-
-    sb:appendn('<!DOCTYPE html>')
-    sb:appendn('<html>')
-    sb:appendn('<head>')
-    sb:appendn('<meta charset="UTF-8"/>')
-    sb:appendn('<title>Luno</title>')
-    sb:appendn('<link rel="stylesheet" href="css/style.css">')
-    sb:appendn('<link rel="icon" href="favicon.ico">')
-    sb:appendn('</head>')
-    sb:appendn('<body>')
-    sb:appendn('<h1>Hello from luno.</h1>')
-    sb:appendn('<a href="redirect">Test redirection</a>')
-    sb:appendn('<p>User is: ' .. user .. '</p>')
-    sb:appendn('<script src="js/script.js"></script>')
-    sb:appendn('</body>')
-    sb:appendn('</html>')
-
     table.insert(response.headers["set-cookie"], "My cookie = 12345;")
 
-    return response:send(HTTP_200_OK, sb:get())
+    --
+    -- Content is streamed, page is not collected in memory.
+    --
+    response:begin(HTTP_200_OK)
+    response:write('<!DOCTYPE html>\n')
+    response:write('<html>\n')
+    response:write('<head>\n')
+    response:write('<meta charset="UTF-8"/>\n')
+    response:write('<title>Luno</title>\n')
+    response:write('<link rel="stylesheet" href="css/style.css">\n')
+    response:write('<link rel="icon" href="favicon.ico">\n')
+    response:write('</head>\n')
+    response:write('<body>\n')
+    response:write('<h1>Hello from luno.</h1>\n')
+    response:write('<a href="redirect">Test redirection</a>\n')
+    response:write('<p>User is: ' .. user .. '</p>\n')
+    response:write('<script src="js/script.js"></script>\n')
+    response:write('</body>\n')
+    response:write('</html>\n')
+    return response:finish()
 until true
 
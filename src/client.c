@@ -26,86 +26,247 @@
  *
  */
 
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 /* */
 #include "client.h"
 /* */
 #include "debug.h"
+#include "header.h"
 #include "lclient.h"
+#include "reactor.h"
+#include "response.h"
+#include "scan.h"
 #include "server.h"
 #include "http.h"
-#include "thread.h"
-#include "token.h"
 
-static THREAD_RUN(_run, arg);
-static THREAD_STOP(_stop, arg);
+#define CLIENT_FLUSH_IOV        64       /* Max segments written by one writev(). */
+#define CLIENT_SENDFILE_CHUNK   262144   /* Max bytes sent by one sendfile(). */
+#define CLIENT_PIPELINE_MAX     16       /* Max requests served in one go. */
+#define CLIENT_SKIP_MAX         65536    /* Max unread body skipped to keep connection. */
+#define CLIENT_SEND_CLOSE_MAX   16384    /* Max output sent linked with close, fits socket buffer. */
+
 static void client_Cleanup(struct client_t *client);
 static int client_Service(struct client_t *client);
-static int client_GetChars(char *buf, int len, void *arg);
+static int client_SkipBody(struct client_t *client);
+static int client_Recv(struct client_t *client, char *buf, int len, int timeout);
+static int client_RecvChunk(struct client_t *client, int timeout);
+static char *client_InputAt(struct client_t *client, int offset);
+static int client_InputSpan(struct client_t *client, int offset);
+static void client_InputCopy(struct client_t *client, char *buf, int offset, int len);
+static int client_InputReserve(struct client_t *client);
+static void client_InputRelease(struct client_t *client);
+static void client_InputFree(struct client_t *client);
+static int client_Wait(struct client_t *client, short events, int timeout);
+static int client_Queue(struct client_t *client, const char *buf, size_t len);
+static int client_FlushFile(struct client_t *client, struct clientOutput_t *out);
+static int client_SendClose(struct client_t *client);
+static void client_Consume(struct client_t *client, size_t len);
+static struct clientOutput_t *client_Append(struct client_t *client, size_t size);
+static void client_FreeOutput(struct client_t *client);
 
 /*
+ * Prepare accepted connection and pass it to reactor. Socket must be in
+ * non-blocking mode.
  *
+ * RETURN
+ *     0 on success, -1 on error.
  */
 int clientStart(struct client_t *client)
 {
-    client->getChars = client_GetChars;
-    if (tokenInit(&client->token, client_GetChars, client) != 0)
-    {
-        DEBUG_CLIENT(DLEVEL_ERROR, "%s", "Token init failed");
-        return -1;
-    }
-    if (lclientInit0(client) < 0)
-    {
-        client_Cleanup(client);
-        return -1;
-    }
-    threadInit(&client->thread);
-    if (threadInitSock(&client->thread, client->sock) < 0)
-    {
-        client_Cleanup(client);
-        return -1;
-    }
-    if (threadCreate(&client->thread, _run, _stop, client) < 0)
-    {
-        client_Cleanup(client);
-        return -1;
-    }
+    client->luaState    = NULL;
+    client->ring        = NULL;
+    client->input.nchunks = 0;
+    client->input.len   = 0;
+    client->input.pos   = 0;
+    client->input.scan  = 0;
+    client->input.head  = 0;
+    client->output.head = NULL;
+    client->output.tail = NULL;
+    client->output.size = 0;
+    client->closing     = 0;
+    client->next        = NULL;
+    client->nrequests   = 0;
+    client->output.corked = 0;
+    client->request.headers = NULL;
+    client->response.buf    = NULL;
+    DEBUG_CLIENT(DLEVEL_INFO, "%s", "Client started");
+    /* NOTE Client is owned by reactor after this call. */
+    reactorAddClient(client);
 
     return 0;
 }
 /*
- * Called by server.
+ * Close connection and release client. Client must not be owned by reactor
+ * loop or worker at time of call.
  */
 void clientStop(struct client_t *client)
 {
     DEBUG_CLIENT(DLEVEL_NOISE, "%s", "Stopping client");
-    threadCancel(&client->thread);
+    client_Cleanup(client);
+    serverDropClient(client);
+    DEBUG_CLIENT(DLEVEL_INFO, "%s", "Client stopped");
 }
 /*
+ * Read available data from socket. Called by reactor when socket is
+ * readable.
  *
+ * RETURN
+ *     CLIENT_READ_READY if request head is complete (or last chunk is full),
+ *     CLIENT_READ_AGAIN if more data expected, CLIENT_READ_CLOSED if
+ *     connection must be dropped.
  */
-static THREAD_RUN(_run, arg)
+int clientRead(struct client_t *client)
 {
-    struct client_t *client;
-    client = arg;
+    int eof;
+    int r;
 
-    DEBUG_CLIENT(DLEVEL_INFO, "%s", "Client started");
-    while (client_Service(client))
-        ;
-    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "Client done");
+    client_InputRelease(client);
+    if (client->input.nchunks == 0 && client_InputReserve(client) < 0)
+        return CLIENT_READ_CLOSED;
+
+    eof = 0;
+    /* NOTE Only last chunk is filled, chain is extended by worker. */
+    while (client->input.len < client->input.nchunks * CLIENT_INPUT_SIZE)
+    {
+        r = recv(client->sock, client_InputAt(client, client->input.len),
+                client->input.nchunks * CLIENT_INPUT_SIZE - client->input.len, 0);
+        if (r > 0)
+        {
+            client->input.len += r;
+            continue;
+        }
+        if (r == 0)
+        {
+            eof = 1;
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        DEBUG_CLIENT(DLEVEL_NOISE, "Recv failed, %s", strerror(errno));
+        return CLIENT_READ_CLOSED;
+    }
+
+    if (clientHeadReady(client))
+        return CLIENT_READ_READY;
+    /*
+     * NOTE Request head that does not fit in last chunk is passed to
+     * worker, parser will read remaining part from socket.
+     */
+    if (client->input.len >= client->input.nchunks * CLIENT_INPUT_SIZE)
+        return CLIENT_READ_READY;
+    if (eof)
+        return CLIENT_READ_CLOSED;
+    return CLIENT_READ_AGAIN;
 }
 /*
+ * Search for end of request head ("\r\n\r\n") in unprocessed input. Only
+ * newly received bytes are scanned, position of found end is remembered.
+ * Chunks are scanned one by one, terminator which crosses end of chunk is
+ * looked for in copy of bytes around it.
  *
+ * RETURN
+ *     1 if request head is complete, 0 otherwise.
  */
-static THREAD_STOP(_stop, arg)
+int clientHeadReady(struct client_t *client)
 {
-    struct client_t *client;
-    client = arg;
+    char edge[6];
+    int from, base, end;
+    int head;
+    int i, n;
 
-    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "Cleanup client");
-    client_Cleanup(client);
-    serverDropClient(client);
-    DEBUG_CLIENT(DLEVEL_INFO, "%s", "Client stopped");
+    head = -1;
+    if (client->input.nchunks == 0)
+        return 0;
+    if (client->input.head > client->input.pos)
+        return 1;
+    if (client->input.scan < client->input.pos)
+        client->input.scan = client->input.pos;
+
+    from = client->input.scan;
+    while (from < client->input.len)
+    {
+        base = from - from % CLIENT_INPUT_SIZE;
+        end  = base + CLIENT_INPUT_SIZE;
+        if (end > client->input.len)
+            end = client->input.len;
+        head = scanHeadEnd(client->input.chunk[base / CLIENT_INPUT_SIZE],
+                from - base, end - base);
+        if (head > 0)
+        {
+            head += base;
+            break;
+        }
+        if (end == client->input.len)
+            break;
+        i = end - 3 > from ? end - 3 : from;
+        n = end + 3 < client->input.len ? end + 3 - i : client->input.len - i;
+        client_InputCopy(client, edge, i, n);
+        head = scanHeadEnd(edge, 0, n);
+        if (head > 0)
+        {
+            head += i;
+            break;
+        }
+        from = end;
+    }
+    if (head > 0)
+    {
+        client->input.head = head;
+        client->input.scan = head;
+        return 1;
+    }
+    /* Keep last three characters, they can be start of terminator. */
+    client->input.scan = client->input.len - 3;
+    if (client->input.scan < client->input.pos)
+        client->input.scan = client->input.pos;
+
+    return 0;
+}
+/*
+ * Process request. Called by worker thread, worker's lua state must be
+ * assigned to client->luaState.
+ *
+ * Pipelined requests which heads are already received are processed
+ * too, up to CLIENT_PIPELINE_MAX. Responses are written in order of
+ * requests, output is corked so they go to socket together. If
+ * connection is closed after them and io_uring is used, output is sent
+ * linked with close of socket.
+ *
+ * RETURN
+ *     1 if connection must be kept alive, 0 if it must be closed.
+ */
+int clientProcess(struct client_t *client)
+{
+    int keepAlive;
+    int n;
+
+    clientCork(client);
+    n = 0;
+    do {
+        keepAlive = client_Service(client);
+        n++;
+    } while (keepAlive && n < CLIENT_PIPELINE_MAX && clientHeadReady(client));
+    if (!keepAlive && client->ring && client->output.corked == 1 &&
+            clientOutputPending(client) && client_SendClose(client) == 0)
+        client->output.corked = 0;
+    else if (clientUncork(client) < 0)
+        keepAlive = 0;
+    /*
+     * Drop input when all received data is processed, so it is not held by
+     * idle connection.
+     */
+    if (client->input.pos >= client->input.len)
+        client_InputFree(client);
+    return keepAlive;
 }
 /*
  *
@@ -114,50 +275,885 @@ static int client_Service(struct client_t *client)
 {
     int error;
 
-    tokenReset(&client->token);
     /* */
     if (lclientInit1(client) < 0)
         return 0;
     /* */
-    client->request.keepAlive = 0;
+    client->request.keepAlive     = 0;
+    client->request.contentLength = -1;
+    client->request.contentRemain = 0;
+    client->request.contentRead   = 0;
+    client->request.chunked       = 0;
+    client->request.expect        = 0;
+    client->response.state        = CLIENT_RESPONSE_NONE;
+    headerReset(client->request.headers);
+    client->nrequests++;
     /* */
     error = httpProcessRequest(client);
     if (error < 0)
         return 0;
+    if (error != HTTP_200_OK)
+    {
+        /* NOTE Start of next request is unknown after bad request. */
+        client->request.keepAlive = 0;
+        client->request.chunked   = 0;
+        client->request.expect    = 0;
+    } else if (client->request.contentLength > 0) {
+        client->request.contentRemain = client->request.contentLength;
+    }
     /* */
     if (lclientProcessRequest(client, error))
     {
-        if (client->request.keepAlive)
+        if (client->request.keepAlive && client_SkipBody(client) == 0)
             return 1;
         else
             return 0;
     }
     return 0;
 }
+/*
+ * Skip part of request body not read by request handler, so next request
+ * on connection can be parsed. Long body is not read, connection is closed
+ * instead.
+ *
+ * RETURN
+ *     0 on success, -1 if connection must be closed.
+ */
+static int client_SkipBody(struct client_t *client)
+{
+    int64_t skipped;
+    int n;
+
+    if (client->request.contentRemain == 0 && !client->request.chunked)
+        return 0;
+    /* NOTE Client can wait for interim response before sending body. */
+    if (client->request.expect)
+        return -1;
+    if (!client->request.chunked &&
+            client->request.contentRemain - (client->input.len - client->input.pos) > CLIENT_SKIP_MAX)
+    {
+        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "Unread request body too long");
+        return -1;
+    }
+    skipped = 0;
+    while (client->request.contentRemain > 0 || client->request.chunked)
+    {
+        n = clientReadBody(client, NULL, CLIENT_SKIP_MAX);
+        if (n <= 0)
+            return -1;
+        skipped += n;
+        if (skipped > CLIENT_SKIP_MAX)
+        {
+            DEBUG_CLIENT(DLEVEL_NOISE, "%s", "Unread request body too long");
+            return -1;
+        }
+    }
+    return 0;
+}
 /*
  *
  */
 static void client_Cleanup(struct client_t *client)
 {
-    lclientDestroy(client);
-    tokenDestroy(&client->token);
-    close(client->sock);
+    /* NOTE Socket is already closed if last write was linked with close. */
+    if (client->sock >= 0)
+        close(client->sock);
+    client_InputFree(client);
+    if (client->response.buf)
+    {
+        free(client->response.buf);
+        client->response.buf = NULL;
+    }
+    client_FreeOutput(client);
 }
 /*
- * Read data from socket.
+ * Read part of request body. Data received together with request head is
+ * returned first, then socket is read. Data past end of body (next
+ * pipelined request) is left in input buffer. Chunked body is decoded.
+ * "100 Continue" is sent before first read if client expects it.
+ *
+ * ARGS
+ *     client    Client.
+ *     buf       Buffer for data, NULL if data must be discarded.
+ *     len       Size of buffer.
+ *
+ * RETURN
+ *     Number of bytes read, zero if whole body is read or on EOF, -1 on
+ *     error.
  */
-static int client_GetChars(char *buf, int len, void *arg)
+int clientReadBody(struct client_t *client, char *buf, int len)
 {
-    struct client_t *client;
+    const char *cont;
+    size_t contlen;
+    int64_t n;
+    int total;
+    int r;
 
-    client = (struct client_t *)arg;
-    return threadRecv(&client->thread, client->sock, buf, len, 0);
+    if (client->request.expect)
+    {
+        client->request.expect = 0;
+        cont = responseContinue(&contlen);
+        /* NOTE Queued response is flushed before socket is waited for. */
+        if (clientSendStatic(client, cont, contlen) < 0)
+            return -1;
+    }
+    total = 0;
+    while (total < len)
+    {
+        if (client->request.contentRemain == 0)
+        {
+            if (!client->request.chunked)
+                break;
+            /* NOTE Do not wait for next chunk if some data read already. */
+            if (total > 0 && client->input.pos == client->input.len)
+                break;
+            r = httpReadChunk(client);
+            if (r < 0)
+            {
+                client->request.keepAlive = 0;
+                return -1;
+            }
+            if (r == 0)
+                break;
+            continue;
+        }
+        n = len - total;
+        if (n > client->request.contentRemain)
+            n = client->request.contentRemain;
+        if (client->input.pos < client->input.len)
+        {
+            if (n > client_InputSpan(client, client->input.pos))
+                n = client_InputSpan(client, client->input.pos);
+            if (buf)
+                memcpy(buf + total, client_InputAt(client, client->input.pos), n);
+            client->input.pos += n;
+        } else {
+            if (total > 0)
+                break;
+            if (buf)
+            {
+                r = client_Recv(client, buf, n, server.bodyTimeout);
+            } else {
+                r = clientFill(client, server.bodyTimeout);
+                if (r > 0)
+                    continue;
+            }
+            if (r <= 0)
+            {
+                client->request.keepAlive = 0;
+                return r;
+            }
+            n = r;
+        }
+        total += n;
+        client->request.contentRemain -= n;
+        client->request.contentRead   += n;
+    }
+    return total;
 }
 /*
+ * Read more data of request to input, wait for it if needed. Chunks
+ * already processed by parser are released, new chunk is added to chain
+ * when last one is full. With io_uring new chunk is buffer picked by kernel
+ * when data arrives, so memory is not committed to connection while it
+ * waits.
+ *
+ * ARGS
+ *     timeout    Seconds to wait, server.headerTimeout for request head,
+ *                server.bodyTimeout for body.
  *
+ * RETURN
+ *     Number of bytes read, zero on EOF, -1 on error.
+ */
+int clientFill(struct client_t *client, int timeout)
+{
+    int n;
+
+    client_InputRelease(client);
+    if (client->ring && client->input.len == client->input.nchunks * CLIENT_INPUT_SIZE)
+        return client_RecvChunk(client, timeout);
+    n = client_InputReserve(client);
+    if (n < 0)
+        return -1;
+    n = client_Recv(client, client_InputAt(client, client->input.len), n, timeout);
+    if (n > 0)
+        client->input.len += n;
+    return n;
+}
+/*
+ * Feed unprocessed input to parser, read more data while parser needs it.
+ * Parser gets slices which lie in one chunk. Token which crosses end of
+ * chunk is copied together with start of next chunk to temporary buffer,
+ * so parser sees it contiguous. Copy is doubled until token fits.
+ *
+ * ARGS
+ *     parse      httpParse() or httpParseChunk().
+ *     timeout    Seconds to wait for data.
+ *
+ * RETURN
+ *     Result of parser. HTTP_PARSE_NEED_MORE if parsed part
+ *     (client->parser.length) and unprocessed input reach CLIENT_INPUT_MAX.
+ *     -1 on EOF or error.
+ */
+int clientParse(struct client_t *client,
+        int (*parse)(struct client_t *, char *, int, int *), int timeout)
+{
+    char *slice;
+    char *copy;
+    int avail;
+    int want;
+    int used;
+    int n, r;
+
+    want = 0;
+    while (1)
+    {
+        avail = client->input.len - client->input.pos;
+        if (avail > 0)
+        {
+            copy  = NULL;
+            slice = client_InputAt(client, client->input.pos);
+            n     = client_InputSpan(client, client->input.pos);
+            if (n < want && n < avail)
+            {
+                n = want < avail ? want : avail;
+                copy = malloc(n);
+                if (!copy)
+                {
+                    DEBUG_CLIENT(DLEVEL_ERROR, "%s", "Failed to allocate token copy");
+                    return -1;
+                }
+                client_InputCopy(client, copy, client->input.pos, n);
+                slice = copy;
+            }
+            r = (*parse)(client, slice, n, &used);
+            free(copy);
+            client->input.pos += used;
+            if (r != HTTP_PARSE_NEED_MORE)
+                return r;
+            /* NOTE Rest of slice is start of token, parser needs more than that. */
+            want = 2 * (n - used) + 1;
+            if (n < avail)
+                continue;
+        }
+        if (client->parser.length + client->input.len - client->input.pos >= CLIENT_INPUT_MAX)
+            return HTTP_PARSE_NEED_MORE;
+        r = clientFill(client, timeout);
+        if (r == 0)
+            DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(W) EOF");
+        if (r <= 0)
+            return -1;
+    }
+}
+/*
+ * Receive data from socket, wait for it if socket is not ready.
+ *
+ * RETURN
+ *     Number of bytes received, zero on EOF, -1 on error.
+ */
+static int client_Recv(struct client_t *client, char *buf, int len, int timeout)
+{
+    int n;
+
+    /* NOTE Queued responses of pipelined requests are not held while waiting. */
+    if (clientOutputPending(client) && clientFlush(client) < 0)
+        return -1;
+    if (client->ring)
+    {
+        n = uringRecv(client->ring, client->sock, buf, len, timeout);
+        if (n < 0 && errno == ETIMEDOUT)
+            DEBUG_CLIENT(DLEVEL_INFO, "%s", "Timeout, closing connection");
+        return n;
+    }
+    while (1)
+    {
+        n = recv(client->sock, buf, len, 0);
+        if (n >= 0)
+            return n;
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        if (client_Wait(client, POLLIN, timeout) < 0)
+            return -1;
+    }
+}
+/*
+ * Receive data to new chunk of input, buffer of chunk is taken from
+ * buffers provided to io_uring of worker.
+ *
+ * RETURN
+ *     Number of bytes received, zero on EOF, -1 on error.
+ */
+static int client_RecvChunk(struct client_t *client, int timeout)
+{
+    char *chunk;
+    int n;
+
+    if (client->input.nchunks == CLIENT_INPUT_CHUNKS)
+    {
+        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "Input buffer too short");
+        return -1;
+    }
+    if (clientOutputPending(client) && clientFlush(client) < 0)
+        return -1;
+    n = uringRecvBuffer(client->ring, client->sock, &chunk, timeout);
+    if (n < 0 && errno == ETIMEDOUT)
+        DEBUG_CLIENT(DLEVEL_INFO, "%s", "Timeout, closing connection");
+    if (n > 0)
+    {
+        client->input.chunk[client->input.nchunks++] = chunk;
+        client->input.len += n;
+    }
+    return n;
+}
+/*
+ * Write data to socket. What can not be written without blocking is put
+ * to output queue. Caller waits only if queue is already above high-water
+ * mark, so one large write is queued at once.
+ *
+ * RETURN
+ *     Number of accepted bytes on success, -1 on error.
  */
 int clientSendChars(struct client_t *client, const void *buf, size_t len)
 {
-    return threadSend(&client->thread, client->sock, buf, len, 0);
+    struct iovec iov;
+
+    iov.iov_base = (void *)buf;
+    iov.iov_len  = len;
+    if (clientSendCharsv(client, &iov, 1) < 0)
+        return -1;
+    return len;
+}
+/*
+ * Write several buffers to socket with one writev(), e.g. headers and body
+ * of response. See clientSendChars().
+ *
+ * ARGS
+ *     iov       Buffers, modified by call.
+ *     iovcnt    Number of buffers, not more than IOV_MAX.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+int clientSendCharsv(struct client_t *client, struct iovec *iov, int iovcnt)
+{
+    ssize_t n;
+
+    while (client->output.size > (size_t)server.outputLimit)
+    {
+        if (client_Wait(client, POLLOUT, server.writeTimeout) < 0)
+            return -1;
+        if (clientFlush(client) < 0)
+            return -1;
+    }
+
+    /* NOTE Data may be written directly only if nothing is queued. */
+    while (iovcnt > 0 && !clientOutputPending(client) && !client->output.corked)
+    {
+        if (iov->iov_len == 0)
+        {
+            iov++;
+            iovcnt--;
+            continue;
+        }
+        n = writev(client->sock, iov, iovcnt);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+            return -1;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base  = (char *)iov->iov_base + n;
+            iov->iov_len  -= n;
+        }
+    }
+    for (; iovcnt > 0; iov++, iovcnt--)
+    {
+        if (client_Queue(client, iov->iov_base, iov->iov_len) < 0)
+            return -1;
+    }
+    return 0;
+}
+/*
+ * Write part of file to socket after data queued before. File is owned by
+ * client after call and closed when written, also on error.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+int clientSendFile(struct client_t *client, int fd, off_t offset, size_t len)
+{
+    struct clientOutput_t *out;
+
+    out = client_Append(client, 0);
+    if (!out)
+    {
+        close(fd);
+        return -1;
+    }
+    out->fd     = fd;
+    out->offset = offset;
+    out->len    = len;
+
+    /* NOTE File is not counted in output size, it does not hold memory. */
+    if (client->output.head == out && !client->output.corked && clientFlush(client) < 0)
+        return -1;
+    return 0;
+}
+/*
+ * Write data that stays valid while server runs (e.g. content of mromfs
+ * image). Data is queued by reference, it is not copied.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+int clientSendStatic(struct client_t *client, const void *buf, size_t len)
+{
+    struct clientOutput_t *out;
+
+    if (len == 0)
+        return 0;
+    out = client_Append(client, 0);
+    if (!out)
+        return -1;
+    out->ptr = buf;
+    out->len = len;
+    client->output.size += len;
+
+    if (client->output.head == out && !client->output.corked && clientFlush(client) < 0)
+        return -1;
+    return 0;
+}
+/*
+ * Hold writes in output queue, so response parts written separately go to
+ * socket with one writev(). Calls can be nested.
+ */
+void clientCork(struct client_t *client)
+{
+    client->output.corked++;
+}
+/*
+ * Write data queued since outermost clientCork().
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+int clientUncork(struct client_t *client)
+{
+    if (--client->output.corked > 0)
+        return 0;
+    return clientFlush(client) < 0 ? -1 : 0;
+}
+/*
+ * Write queued data until socket would block. Data segments are written
+ * with sendmsg(), parts of files with sendfile(). Data followed by file
+ * (headers of response) is written with MSG_MORE, so it shares packet with
+ * start of file.
+ *
+ * RETURN
+ *     1 if queue is empty, 0 if socket would block, -1 on error.
+ */
+int clientFlush(struct client_t *client)
+{
+    struct iovec iov[CLIENT_FLUSH_IOV];
+    struct clientOutput_t *out;
+    struct msghdr msg;
+    ssize_t r;
+    int niov;
+
+    while (client->output.head)
+    {
+        out = client->output.head;
+        if (out->fd >= 0)
+        {
+            r = client_FlushFile(client, out);
+            if (r <= 0)
+                return r;
+            client->output.head = out->next;
+            if (!client->output.head)
+                client->output.tail = NULL;
+            close(out->fd);
+            free(out);
+            continue;
+        }
+
+        niov = 0;
+        for (; out && out->fd < 0 && niov < CLIENT_FLUSH_IOV; out = out->next)
+        {
+            iov[niov].iov_base = (void *)(out->ptr + out->pos);
+            iov[niov].iov_len  = out->len - out->pos;
+            niov++;
+        }
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = niov;
+        r = sendmsg(client->sock, &msg, out && out->fd >= 0 ? MSG_MORE : 0);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            DEBUG_CLIENT(DLEVEL_NOISE, "Sendmsg failed, %s", strerror(errno));
+            return -1;
+        }
+        client_Consume(client, r);
+    }
+    return 1;
+}
+/*
+ * Write queued output and close socket with one io_uring submission, so
+ * connection which is closed after response costs one system call. Socket
+ * is closed if client->sock is set to -1. On error output is dropped,
+ * caller closes connection.
+ *
+ * NOTE Send waits until all data is written, so only output which fits
+ * socket buffer is sent this way, worker does not wait for slow client.
+ *
+ * RETURN
+ *     0 if output is sent or dropped, -1 if output is left in queue
+ *     (it contains part of file, is too long or is not sent at once).
+ */
+static int client_SendClose(struct client_t *client)
+{
+    struct iovec iov[CLIENT_FLUSH_IOV];
+    struct clientOutput_t *out;
+    ssize_t r;
+    int niov, closed;
+
+    if (client->output.size > CLIENT_SEND_CLOSE_MAX)
+        return -1;
+    niov = 0;
+    for (out = client->output.head; out; out = out->next)
+    {
+        if (out->fd >= 0 || niov == CLIENT_FLUSH_IOV)
+            return -1;
+        iov[niov].iov_base = (void *)(out->ptr + out->pos);
+        iov[niov].iov_len  = out->len - out->pos;
+        niov++;
+    }
+    r = uringSendClose(client->ring, client->sock, iov, niov, server.writeTimeout, &closed);
+    if (closed)
+        client->sock = -1;
+    if (r < 0)
+    {
+        if (errno == ETIMEDOUT)
+            DEBUG_CLIENT(DLEVEL_INFO, "%s", "Timeout, closing connection");
+        else
+            DEBUG_CLIENT(DLEVEL_NOISE, "Sendmsg failed, %s", strerror(errno));
+        client_FreeOutput(client);
+        return 0;
+    }
+    client_Consume(client, r);
+    return clientOutputPending(client) ? -1 : 0;
+}
+/*
+ * Send part of file with sendfile() in bounded chunks.
+ *
+ * RETURN
+ *     1 if whole part is sent, 0 if socket would block, -1 on error.
+ */
+static int client_FlushFile(struct client_t *client, struct clientOutput_t *out)
+{
+    off_t offset;
+    size_t n;
+    ssize_t r;
+
+    while (out->pos < out->len)
+    {
+        n = out->len - out->pos;
+        if (n > CLIENT_SENDFILE_CHUNK)
+            n = CLIENT_SENDFILE_CHUNK;
+        offset = out->offset + out->pos;
+        r = sendfile(client->sock, out->fd, &offset, n);
+        if (r > 0)
+        {
+            out->pos += r;
+            continue;
+        }
+        if (r == 0)
+        {
+            DEBUG_CLIENT(DLEVEL_WARNING, "%s", "File is shorter than expected");
+            return -1;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        DEBUG_CLIENT(DLEVEL_NOISE, "Sendfile failed, %s", strerror(errno));
+        return -1;
+    }
+    return 1;
+}
+/*
+ * Remove written bytes from output queue.
+ */
+static void client_Consume(struct client_t *client, size_t len)
+{
+    struct clientOutput_t *out;
+    size_t n;
+
+    client->output.size -= len;
+    while (len > 0)
+    {
+        out = client->output.head;
+        n   = out->len - out->pos;
+        if (len < n)
+        {
+            out->pos += len;
+            break;
+        }
+        len -= n;
+        client->output.head = out->next;
+        free(out);
+    }
+    if (!client->output.head)
+        client->output.tail = NULL;
+}
+/*
+ * Append data to output queue. Small writes are merged in last segment.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+static int client_Queue(struct client_t *client, const char *buf, size_t len)
+{
+    struct clientOutput_t *out;
+    size_t n;
+
+    if (len == 0)
+        return 0;
+    out = client->output.tail;
+    if (out && out->ptr == out->data && out->size > out->len)
+    {
+        n = out->size - out->len;
+        if (n > len)
+            n = len;
+        memcpy(out->data + out->len, buf, n);
+        out->len += n;
+        client->output.size += n;
+        buf += n;
+        len -= n;
+    }
+    if (len == 0)
+        return 0;
+
+    out = client_Append(client,
+            len > CLIENT_OUTPUT_SEGMENT_SIZE ? len : CLIENT_OUTPUT_SEGMENT_SIZE);
+    if (!out)
+        return -1;
+    memcpy(out->data, buf, len);
+    out->len = len;
+    client->output.size += len;
+    return 0;
 }
+/*
+ * Allocate empty data segment with capacity "size" at end of output queue.
+ *
+ * RETURN
+ *     Segment on success, NULL on error.
+ */
+static struct clientOutput_t *client_Append(struct client_t *client, size_t size)
+{
+    struct clientOutput_t *out;
 
+    out = malloc(sizeof(struct clientOutput_t) + size);
+    if (!out)
+    {
+        DEBUG_CLIENT(DLEVEL_ERROR, "%s", "Failed to allocate output segment");
+        return NULL;
+    }
+    out->next   = NULL;
+    out->fd     = -1;
+    out->offset = 0;
+    out->ptr    = out->data;
+    out->size   = size;
+    out->len    = 0;
+    out->pos    = 0;
+    if (client->output.tail)
+        client->output.tail->next = out;
+    else
+        client->output.head = out;
+    client->output.tail = out;
+    return out;
+}
+/*
+ *
+ */
+static void client_FreeOutput(struct client_t *client)
+{
+    struct clientOutput_t *out;
+
+    while (client->output.head)
+    {
+        out = client->output.head;
+        client->output.head = out->next;
+        if (out->fd >= 0)
+            close(out->fd);
+        free(out);
+    }
+    client->output.tail = NULL;
+    client->output.size = 0;
+}
+/*
+ * Wait for socket event.
+ *
+ * ARGS
+ *     timeout    Timeout in seconds, 0 to wait forever.
+ *
+ * RETURN
+ *     0 on success, -1 on error or timeout.
+ */
+static int client_Wait(struct client_t *client, short events, int timeout)
+{
+    struct pollfd pfd;
+    int r;
+
+    if (client->ring)
+    {
+        if (uringPoll(client->ring, client->sock, events, timeout) == 0)
+            return 0;
+        if (errno == ETIMEDOUT)
+            DEBUG_CLIENT(DLEVEL_INFO, "%s", "Timeout, closing connection");
+        return -1;
+    }
+
+    pfd.fd      = client->sock;
+    pfd.events  = events;
+    pfd.revents = 0;
+    while ((r = poll(&pfd, 1, timeout ? timeout * 1000 : -1)) < 0 && errno == EINTR)
+        ;
+    if (r < 0)
+    {
+        DEBUG_CLIENT(DLEVEL_NOISE, "Poll failed, %s", strerror(errno));
+        return -1;
+    }
+    if (r == 0)
+    {
+        DEBUG_CLIENT(DLEVEL_INFO, "%s", "Timeout, closing connection");
+        return -1;
+    }
+    return 0;
+}
+/*
+ * RETURN
+ *     Pointer to byte of input at given offset.
+ */
+static char *client_InputAt(struct client_t *client, int offset)
+{
+    return client->input.chunk[offset / CLIENT_INPUT_SIZE] + offset % CLIENT_INPUT_SIZE;
+}
+/*
+ * RETURN
+ *     Number of bytes of input from offset to end of its chunk or to end
+ *     of data.
+ */
+static int client_InputSpan(struct client_t *client, int offset)
+{
+    int end;
+
+    end = offset - offset % CLIENT_INPUT_SIZE + CLIENT_INPUT_SIZE;
+    if (end > client->input.len)
+        end = client->input.len;
+    return end - offset;
+}
+/*
+ * Copy bytes of input which can lie in several chunks.
+ */
+static void client_InputCopy(struct client_t *client, char *buf, int offset, int len)
+{
+    int n;
+
+    while (len > 0)
+    {
+        n = client_InputSpan(client, offset);
+        if (n > len)
+            n = len;
+        memcpy(buf, client_InputAt(client, offset), n);
+        buf    += n;
+        offset += n;
+        len    -= n;
+    }
+}
+/*
+ * Make room for received data, chunk is added if last one is full.
+ *
+ * RETURN
+ *     Number of free bytes at end of input, -1 on error.
+ */
+static int client_InputReserve(struct client_t *client)
+{
+    char *chunk;
+
+    if (client->input.len < client->input.nchunks * CLIENT_INPUT_SIZE)
+        return client->input.nchunks * CLIENT_INPUT_SIZE - client->input.len;
+    if (client->input.nchunks == CLIENT_INPUT_CHUNKS)
+    {
+        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "Input buffer too short");
+        return -1;
+    }
+    chunk = malloc(CLIENT_INPUT_SIZE);
+    if (!chunk)
+    {
+        DEBUG_CLIENT(DLEVEL_ERROR, "%s", "Failed to allocate input buffer");
+        return -1;
+    }
+    client->input.chunk[client->input.nchunks++] = chunk;
+    return CLIENT_INPUT_SIZE;
+}
+/*
+ * Release chunks which are processed. Offsets are shifted, data stays in
+ * place. If all data is processed, chain is rewound to start of first
+ * chunk.
+ */
+static void client_InputRelease(struct client_t *client)
+{
+    int i;
+
+    while (client->input.nchunks > 1 && client->input.pos >= CLIENT_INPUT_SIZE)
+    {
+        free(client->input.chunk[0]);
+        for (i = 1; i < client->input.nchunks; i++)
+            client->input.chunk[i - 1] = client->input.chunk[i];
+        client->input.nchunks--;
+        client->input.len  -= CLIENT_INPUT_SIZE;
+        client->input.pos  -= CLIENT_INPUT_SIZE;
+        client->input.scan -= CLIENT_INPUT_SIZE;
+        client->input.head -= CLIENT_INPUT_SIZE;
+        if (client->input.scan < 0)
+            client->input.scan = 0;
+        if (client->input.head < 0)
+            client->input.head = 0;
+    }
+    if (client->input.pos == client->input.len)
+    {
+        client->input.len  = 0;
+        client->input.pos  = 0;
+        client->input.scan = 0;
+        client->input.head = 0;
+    }
+}
+/*
+ *
+ */
+static void client_InputFree(struct client_t *client)
+{
+    int i;
+
+    for (i = 0; i < client->input.nchunks; i++)
+        free(client->input.chunk[i]);
+    client->input.nchunks = 0;
+    client->input.len  = 0;
+    client->input.pos  = 0;
+    client->input.scan = 0;
+    client->input.head = 0;
+}
@@ -29,13 +29,35 @@
 #define _CLIENT_H
 
 #include <lua.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 /* */
 #include "debug.h"
+#include "header.h"
 #include "thread.h"
-#include "token.h"
+#include "timer.h"
+#include "uring.h"
+
+/*
+ * Segment of output queue. Segment holds either data in memory or part of
+ * file (fd is not -1) written with sendfile(). Data in memory is copied to
+ * segment, or referenced if it is static (ptr points outside of segment).
+ */
+struct clientOutput_t {
+    struct clientOutput_t *next;
+    int fd;          /* File, -1 for data segment. */
+    off_t offset;    /* Start of part of file. */
+    const char *ptr; /* Data, "data" field or static data. */
+    size_t size;     /* Capacity of data. */
+    size_t len;      /* Number of bytes in data or in part of file. */
+    size_t pos;      /* Number of bytes already written. */
+    char data[];
+};
 
 struct client_t {
-    int lease;
+    atomic_int lease; /* Slot is leased, read by clientpoolForEach() in other thread. */
 
     int sock;
     struct {
@@ -43,26 +65,107 @@ struct client_t {
         char addr[CLIENT_ADDR_INFO_ADDR_LENGTH + 1];
         int port;
     } addrInfo;
-    struct thread_t thread;
 
     int serverPort;
 
-    int (*getChars)(char *, int, void *);
+    /*
+     * Received data not processed yet. Data is received to chain of
+     * chunks, positions are offsets into chain: byte at offset N is in
+     * chunk N / CLIENT_INPUT_SIZE. Data is never moved, chunks before read
+     * position are released instead. Chain is allocated only while
+     * connection has unprocessed data, so idle keep-alive connection does
+     * not hold it.
+     */
+    struct {
+#define CLIENT_INPUT_SIZE      16384 /* Size of chunk. */
+#define CLIENT_INPUT_MAX       65536 /* Limit of unprocessed data, longest request head. */
+#define CLIENT_INPUT_CHUNKS    (CLIENT_INPUT_MAX / CLIENT_INPUT_SIZE + 1)
+        char *chunk[CLIENT_INPUT_CHUNKS];
+        int nchunks;
+        int len;  /* Number of bytes in chain. */
+        int pos;  /* Read position of request parser. */
+        int scan; /* Position to continue search of end of request head. */
+        int head; /* Position after end of request head, 0 if not found. */
+    } input;
+    /*
+     * Data not written to socket yet. Worker appends data, reactor finishes
+     * transfer when request is processed.
+     */
+    struct {
+#define CLIENT_OUTPUT_SEGMENT_SIZE    16384
+        struct clientOutput_t *head;
+        struct clientOutput_t *tail;
+        size_t size; /* Number of queued bytes. */
+        int corked;  /* Depth of clientCork(), data is only queued while not zero. */
+    } output;
+    int closing; /* Close connection when output is written. */
 
-    struct token_t token;
+    struct client_t *next;    /* Link in reactor or worker queue. */
+    int watched;              /* Connection is registered in reactor. */
+    int idle;                 /* Keep-alive connection waits for request. */
+    struct timerNode_t timer; /* Timeout of connection owned by reactor. */
+    int nrequests;            /* Number of requests served on connection. */
+
+    /*
+     * State of request parser, kept while request head is received.
+     */
+    struct {
+        int state;  /* Element of request grammar expected next. */
+        int id;     /* Header field which value is parsed. */
+        int length; /* Number of bytes of request head consumed. */
+    } parser;
     lua_State *luaState;
+    struct uring_t *ring;     /* io_uring of worker, NULL if not used. */
     /*
      * Fields from HTTP request header.
      */
     struct {
         int keepAlive; /* "Connection" field, 0 for "close", 1 for "keep-alive" */
+        int64_t contentLength; /* "Content-Length" field, -1 if not given. */
+        int64_t contentRemain; /* Number of bytes of body (of current chunk) not read yet. */
+        int64_t contentRead;   /* Number of bytes of body read. */
+        int chunked;           /* Chunked body, until its last chunk is read. */
+        int expect;            /* "Expect: 100-continue", interim response not sent yet. */
+        struct headerIndex_t *headers; /* Other fields, index of worker. */
     } request;
+    /*
+     * Response streamed by handler, see response:begin() (lclient.c).
+     */
+    struct {
+#define CLIENT_RESPONSE_NONE      0 /* Not started. */
+#define CLIENT_RESPONSE_STREAM    1 /* Head is sent, content is written. */
+#define CLIENT_RESPONSE_DONE      2 /* Content is finished. */
+        int state;
+        int64_t remain; /* Bytes of declared content not written, -1 if chunked. */
+        char *buf;      /* Content not written yet, CLIENT_OUTPUT_SEGMENT_SIZE bytes. */
+        int len;        /* Number of bytes in buffer. */
+    } response;
 };
 
 int clientStart(struct client_t *client);
 void clientStop(struct client_t *client);
+int clientRead(struct client_t *client);
+int clientHeadReady(struct client_t *client);
+int clientFill(struct client_t *client, int timeout);
+int clientParse(struct client_t *client,
+        int (*parse)(struct client_t *, char *, int, int *), int timeout);
+int clientReadBody(struct client_t *client, char *buf, int len);
+int clientProcess(struct client_t *client);
+
+/* Return values of clientRead(). */
+#define CLIENT_READ_AGAIN     0  /* Request head is not complete yet. */
+#define CLIENT_READ_READY     1  /* Request head is complete. */
+#define CLIENT_READ_CLOSED  (-1) /* Connection closed or failed. */
 
 int clientSendChars(struct client_t *client, const void *buf, size_t len);
+int clientSendCharsv(struct client_t *client, struct iovec *iov, int iovcnt);
+int clientSendStatic(struct client_t *client, const void *buf, size_t len);
+int clientSendFile(struct client_t *client, int fd, off_t offset, size_t len);
+void clientCork(struct client_t *client);
+int clientUncork(struct client_t *client);
+int clientFlush(struct client_t *client);
+
+#define clientOutputPending(client)    ((client)->output.head != NULL)
 
 #define DEBUG_CLIENT(level, fmt, ...) \
         debugPrint(level, "[Client (%p) %s:%d]: " fmt,    \
@@ -0,0 +1,282 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+/* */
+#include "clientpool.h"
+/* */
+#include "client.h"
+#include "debug.h"
+#include "thread.h"
+
+/*
+ * Client slots are allocated in slabs on demand and never freed until
+ * shutdown, so slot memory stays valid for lock-free list traversal. Free
+ * slots form a stack. Head of stack holds index of top slot (plus one, zero
+ * for empty stack) in low 32 bits and modification counter in high 32 bits
+ * to avoid ABA problem.
+ */
+struct clientpoolSlot_t {
+    struct client_t client;
+    uint32_t index;            /* Index of this slot. */
+    _Atomic uint32_t next;     /* Index of next free slot plus one. */
+} __attribute__((aligned(CLIENTPOOL_CACHE_LINE)));
+
+#define CLIENTPOOL_INDEX_MASK    0xFFFFFFFFULL
+
+static struct {
+    struct clientpoolSlot_t *_Atomic *slabs;
+    int maxSlabs;
+    int maxClients;
+    _Atomic int nslabs;
+    _Atomic uint64_t head;
+    atomic_int count;          /* Number of leased slots, taken before slot is popped. */
+    struct threadMutex_t growMutex;
+} pool;
+
+static struct clientpoolSlot_t *clientpool_Slot(uint32_t index);
+static struct clientpoolSlot_t *clientpool_Pop();
+static void clientpool_Push(struct clientpoolSlot_t *slot);
+static struct clientpoolSlot_t *clientpool_Grow();
+
+/*
+ * ARGS
+ *     maxClients    Limit of simultaneous connections.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+int clientpoolInit(int maxClients)
+{
+    pool.maxClients = maxClients;
+    pool.maxSlabs   = (maxClients + CLIENTPOOL_SLAB_SIZE - 1) / CLIENTPOOL_SLAB_SIZE;
+    pool.slabs    = calloc(pool.maxSlabs, sizeof(*pool.slabs));
+    if (!pool.slabs)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "Failed to allocate client pool");
+        return -1;
+    }
+    atomic_store(&pool.nslabs, 0);
+    atomic_store(&pool.head, 0);
+    atomic_store(&pool.count, 0);
+    threadMutexFill(&pool.growMutex);
+    if (threadMutexInit(&pool.growMutex) < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "Mutex init failed");
+        return -1;
+    }
+    return 0;
+}
+/*
+ * Release all slabs. No client may be in use.
+ */
+void clientpoolDestroy()
+{
+    int i;
+
+    if (pool.slabs)
+    {
+        for (i = 0; i < atomic_load(&pool.nslabs); i++)
+            free(pool.slabs[i]);
+        free(pool.slabs);
+    }
+    pool.slabs = NULL;
+    atomic_store(&pool.nslabs, 0);
+    atomic_store(&pool.head, 0);
+    threadMutexDestroy(&pool.growMutex);
+    threadMutexFill(&pool.growMutex);
+}
+/*
+ * Lease client slot.
+ *
+ * RETURN
+ *     Pointer to client, NULL if limit of clients reached.
+ */
+struct client_t *clientpoolGet()
+{
+    struct clientpoolSlot_t *slot;
+    int count;
+
+    /* NOTE Last slab may have more slots than limit, count enforces it. */
+    count = atomic_fetch_add(&pool.count, 1) + 1;
+    if (count > pool.maxClients)
+    {
+        atomic_fetch_sub(&pool.count, 1);
+        return NULL;
+    }
+    slot = clientpool_Pop();
+    if (!slot)
+        slot = clientpool_Grow();
+    if (!slot)
+    {
+        atomic_fetch_sub(&pool.count, 1);
+        return NULL;
+    }
+
+    atomic_store_explicit(&slot->client.lease, 1, memory_order_release);
+    debugPrint(DLEVEL_NOISE, "NCLIENTS(%d)", count);
+    return &slot->client;
+}
+/*
+ * Return client slot to pool.
+ */
+void clientpoolPut(struct client_t *client)
+{
+    struct clientpoolSlot_t *slot;
+    int count;
+
+    slot = (struct clientpoolSlot_t *)client; /* NOTE client is first member. */
+    atomic_store_explicit(&client->lease, 0, memory_order_release);
+    count = atomic_fetch_sub(&pool.count, 1) - 1;
+    debugPrint(DLEVEL_NOISE, "NCLIENTS(%d)", count);
+    clientpool_Push(slot);
+}
+/*
+ * RETURN
+ *     Number of leased clients.
+ */
+int clientpoolCount()
+{
+    return atomic_load(&pool.count);
+}
+/*
+ * Call function for every leased client. Lease flag of every slot is
+ * checked, free slots are skipped. Other threads may release or lease
+ * clients meanwhile, so function may only use fields owned by calling
+ * thread.
+ */
+void clientpoolForEach(void (*func)(struct client_t *client))
+{
+    struct clientpoolSlot_t *slab;
+    int nslabs;
+    int i, j;
+
+    nslabs = atomic_load(&pool.nslabs);
+    for (i = 0; i < nslabs; i++)
+    {
+        slab = atomic_load_explicit(&pool.slabs[i], memory_order_acquire);
+        for (j = 0; j < CLIENTPOOL_SLAB_SIZE; j++)
+        {
+            if (atomic_load_explicit(&slab[j].client.lease, memory_order_acquire))
+                (*func)(&slab[j].client);
+        }
+    }
+}
+/*
+ *
+ */
+static struct clientpoolSlot_t *clientpool_Slot(uint32_t index)
+{
+    struct clientpoolSlot_t *slab;
+
+    slab = atomic_load_explicit(&pool.slabs[index / CLIENTPOOL_SLAB_SIZE],
+            memory_order_acquire);
+    return &slab[index % CLIENTPOOL_SLAB_SIZE];
+}
+/*
+ *
+ */
+static struct clientpoolSlot_t *clientpool_Pop()
+{
+    struct clientpoolSlot_t *slot;
+    uint64_t head, newHead;
+    uint32_t next;
+
+    head = atomic_load(&pool.head);
+    do {
+        if ((head & CLIENTPOOL_INDEX_MASK) == 0)
+            return NULL;
+        slot = clientpool_Slot((uint32_t)(head & CLIENTPOOL_INDEX_MASK) - 1);
+        next = atomic_load(&slot->next);
+        newHead = (((head >> 32) + 1) << 32) | next;
+    } while (!atomic_compare_exchange_weak(&pool.head, &head, newHead));
+
+    return slot;
+}
+/*
+ *
+ */
+static void clientpool_Push(struct clientpoolSlot_t *slot)
+{
+    uint64_t head, newHead;
+
+    head = atomic_load(&pool.head);
+    do {
+        atomic_store(&slot->next, (uint32_t)(head & CLIENTPOOL_INDEX_MASK));
+        newHead = (((head >> 32) + 1) << 32) | (slot->index + 1);
+    } while (!atomic_compare_exchange_weak(&pool.head, &head, newHead));
+}
+/*
+ * Allocate new slab. First slot of slab is returned to caller, other slots
+ * are pushed to free stack.
+ *
+ * RETURN
+ *     Pointer to slot, NULL if limit reached or allocation failed.
+ */
+static struct clientpoolSlot_t *clientpool_Grow()
+{
+    struct clientpoolSlot_t *slab;
+    struct clientpoolSlot_t *slot;
+    int nslabs;
+    int i;
+
+    threadMutexLock(&pool.growMutex);
+    /* Other thread could grow pool while we was waiting for mutex. */
+    slot = clientpool_Pop();
+    if (slot)
+        goto done;
+
+    nslabs = atomic_load(&pool.nslabs);
+    if (nslabs >= pool.maxSlabs)
+        goto done;
+
+    if (posix_memalign((void **)&slab, CLIENTPOOL_CACHE_LINE,
+            sizeof(struct clientpoolSlot_t) * CLIENTPOOL_SLAB_SIZE) != 0)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "Failed to allocate client slab");
+        goto done;
+    }
+    memset(slab, 0, sizeof(struct clientpoolSlot_t) * CLIENTPOOL_SLAB_SIZE);
+    for (i = 0; i < CLIENTPOOL_SLAB_SIZE; i++)
+        slab[i].index = nslabs * CLIENTPOOL_SLAB_SIZE + i;
+
+    atomic_store_explicit(&pool.slabs[nslabs], slab, memory_order_release);
+    atomic_store(&pool.nslabs, nslabs + 1);
+    debugPrint(DLEVEL_NOISE, "Client pool grown to %d slots",
+            (nslabs + 1) * CLIENTPOOL_SLAB_SIZE);
+
+    for (i = CLIENTPOOL_SLAB_SIZE - 1; i > 0; i--)
+        clientpool_Push(&slab[i]);
+    slot = &slab[0];
+done:
+    threadMutexUnlock(&pool.growMutex);
+    return slot;
+}
+
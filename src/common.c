@@ -25,6 +25,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *
  */
+#include <stdlib.h>
 #include <string.h>
 #include "common.h"
 /*
@@ -83,4 +84,52 @@ int commonString2Number(char *sdata, int slen, int64_t *value)
 error:
     return -1;
 }
+/*
+ * Parse list of CPUs like "0-3,8,10-11".
+ *
+ * ARGS
+ *     s       List, 0-terminated.
+ *     cpus    Array for CPU numbers, in order of list.
+ *     max     Size of "cpus" array.
+ *
+ * RETURN
+ *     Number of CPUs in list, -1 on error.
+ */
+int commonParseCpuList(const char *s, int *cpus, int max)
+{
+    long first, last;
+    char *end;
+    int n;
+
+    n = 0;
+    while (*s)
+    {
+        if (*s < '0' || *s > '9')
+            return -1;
+        first = strtol(s, &end, 10);
+        last  = first;
+        s     = end;
+        if (*s == '-')
+        {
+            s++;
+            if (*s < '0' || *s > '9')
+                return -1;
+            last = strtol(s, &end, 10);
+            s    = end;
+        }
+        if (last < first)
+            return -1;
+        for (; first <= last; first++)
+        {
+            if (n == max)
+                return -1;
+            cpus[n++] = first;
+        }
+        if (*s == ',')
+            s++;
+        else if (*s)
+            return -1;
+    }
+    return n;
+}
 
@@ -30,6 +30,7 @@
 
 #include <stdint.h>
 int commonString2Number(char *sdata, int slen, int64_t *value);
+int commonParseCpuList(const char *s, int *cpus, int max);
 
 #endif
 
@@ -0,0 +1,379 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#define _GNU_SOURCE /* accept4(), MSG_CMSG_CLOEXEC */
+
+/*
+ * Restart of server without closing of listening sockets. Running server
+ * spawns new one and passes listening sockets to it over Unix socket
+ * (SCM_RIGHTS), then new server accepts connections while old one drains.
+ *
+ * Path starting with "@" is name of abstract socket, it is not subject to
+ * file permissions. Both sides check peer (SO_PEERCRED): old server accepts
+ * only process it spawned, new server takes sockets only from its parent.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+/* */
+#include "handoff.h"
+/* */
+#include "debug.h"
+
+static int inheritSock = -1; /* Connection to old server, closed when ready. */
+
+static int handoff_Address(const char *path, struct sockaddr_un *addr, socklen_t *addrlen);
+static int handoff_CheckPeer(int sock, pid_t pid);
+static int handoff_Wait(int sock, int timeout);
+static pid_t handoff_Spawn(char **argv);
+
+/*
+ * Spawn new server and pass listening sockets to it. Function blocks until
+ * new server reports that it is ready, or timeout.
+ *
+ * ARGS
+ *     path    Path of Unix socket used for transfer.
+ *     argv    Arguments of new server, "-i" option is appended.
+ *     fds     Listening sockets.
+ *
+ * RETURN
+ *     0 if new server took sockets, -1 on error.
+ */
+int handoffRestart(const char *path, char **argv, int *fds, int nfds)
+{
+    struct sockaddr_un addr;
+    socklen_t addrlen;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    pid_t pid;
+    int lsock, sock;
+    char ack;
+    int ret;
+
+    ret  = -1;
+    sock = -1;
+    pid  = -1;
+    if (nfds <= 0 || nfds > HANDOFF_MAX_FDS || handoff_Address(path, &addr, &addrlen) < 0)
+        return -1;
+
+    lsock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lsock < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "Failed to open handoff socket, %s", strerror(errno));
+        return -1;
+    }
+    if (addr.sun_path[0])
+        unlink(path);
+    if (bind(lsock, (struct sockaddr *)&addr, addrlen) < 0 || listen(lsock, 1) < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "Failed to bind handoff socket \"%s\", %s", path, strerror(errno));
+        goto done;
+    }
+
+    pid = handoff_Spawn(argv);
+    if (pid < 0)
+        goto done;
+
+    if (handoff_Wait(lsock, HANDOFF_TIMEOUT) < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "New server did not connect");
+        goto done;
+    }
+    sock = accept4(lsock, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "Handoff accept failed, %s", strerror(errno));
+        goto done;
+    }
+    if (handoff_CheckPeer(sock, pid) < 0)
+        goto done;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    ack = (char)nfds;
+    iov.iov_base       = &ack;
+    iov.iov_len        = 1;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "Failed to pass listening sockets, %s", strerror(errno));
+        goto done;
+    }
+
+    /* New server writes one byte when it serves connections. */
+    if (handoff_Wait(sock, HANDOFF_TIMEOUT) < 0 || recv(sock, &ack, 1, 0) != 1)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "New server failed to start");
+        goto done;
+    }
+    debugPrint(DLEVEL_INFO, "Listening sockets passed to new server (pid %d)", (int)pid);
+    ret = 0;
+done:
+    if (sock >= 0)
+        close(sock);
+    close(lsock);
+    if (addr.sun_path[0])
+        unlink(path);
+    /* NOTE New server must not serve together with this one. */
+    if (ret < 0 && pid > 0)
+    {
+        kill(pid, SIGTERM);
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+            ;
+    }
+    return ret;
+}
+/*
+ * Take listening sockets from running server. Connection is kept until
+ * handoffReady() is called.
+ *
+ * RETURN
+ *     Number of received sockets, -1 on error.
+ */
+int handoffInherit(const char *path, int *fds, int maxfds)
+{
+    struct sockaddr_un addr;
+    socklen_t addrlen;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    char nfds;
+    int n, i;
+
+    if (handoff_Address(path, &addr, &addrlen) < 0)
+        return -1;
+    inheritSock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (inheritSock < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "Failed to open handoff socket, %s", strerror(errno));
+        return -1;
+    }
+    if (connect(inheritSock, (struct sockaddr *)&addr, addrlen) < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "Failed to connect to \"%s\", %s", path, strerror(errno));
+        goto error;
+    }
+    /* NOTE Old server is parent of this one, it spawned it. */
+    if (handoff_CheckPeer(inheritSock, getppid()) < 0)
+        goto error;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base       = &nfds;
+    iov.iov_len        = 1;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (handoff_Wait(inheritSock, HANDOFF_TIMEOUT) < 0 ||
+            recvmsg(inheritSock, &msg, MSG_CMSG_CLOEXEC) != 1)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "Failed to receive listening sockets");
+        goto error;
+    }
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "No listening sockets received");
+        goto error;
+    }
+    n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (n != nfds || n > maxfds || (msg.msg_flags & MSG_CTRUNC))
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "Invalid number of listening sockets");
+        for (i = 0; i < n; i++)
+        {
+            int fd;
+
+            memcpy(&fd, CMSG_DATA(cmsg) + sizeof(int) * i, sizeof(int));
+            close(fd);
+        }
+        goto error;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * n);
+    debugPrint(DLEVEL_INFO, "Inherited %d listening sockets", n);
+
+    return n;
+error:
+    close(inheritSock);
+    inheritSock = -1;
+    return -1;
+}
+/*
+ * Tell old server that new one serves connections, so old one may stop
+ * accepting.
+ */
+void handoffReady()
+{
+    char ack;
+
+    if (inheritSock < 0)
+        return;
+    ack = 1;
+    if (send(inheritSock, &ack, 1, MSG_NOSIGNAL) != 1)
+        debugPrint(DLEVEL_WARNING, "Failed to notify old server, %s", strerror(errno));
+    close(inheritSock);
+    inheritSock = -1;
+}
+/*
+ * Form address of handoff socket, name of abstract socket if path starts
+ * with "@".
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+static int handoff_Address(const char *path, struct sockaddr_un *addr, socklen_t *addrlen)
+{
+    size_t len;
+
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    len = strlen(path);
+    if (len >= sizeof(addr->sun_path))
+    {
+        debugPrint(DLEVEL_ERROR, "Handoff socket path is too long \"%s\"", path);
+        return -1;
+    }
+    memcpy(addr->sun_path, path, len);
+    if (path[0] == '@')
+    {
+        addr->sun_path[0] = '\0';
+        *addrlen = offsetof(struct sockaddr_un, sun_path) + len;
+    } else {
+        *addrlen = sizeof(struct sockaddr_un);
+    }
+    return 0;
+}
+/*
+ * Check that peer of handoff socket is process "pid" of same user.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+static int handoff_CheckPeer(int sock, pid_t pid)
+{
+    struct ucred cred;
+    socklen_t len;
+
+    len = sizeof(cred);
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "Failed to get handoff peer, %s", strerror(errno));
+        return -1;
+    }
+    if (cred.uid != geteuid() || cred.pid != pid)
+    {
+        debugPrint(DLEVEL_ERROR, "Unexpected handoff peer (pid %d, uid %d)",
+                (int)cred.pid, (int)cred.uid);
+        return -1;
+    }
+    return 0;
+}
+/*
+ * Wait until socket is readable.
+ *
+ * RETURN
+ *     0 on success, -1 on error or timeout.
+ */
+static int handoff_Wait(int sock, int timeout)
+{
+    struct pollfd pfd;
+    int r;
+
+    pfd.fd      = sock;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+    while ((r = poll(&pfd, 1, timeout * 1000)) < 0 && errno == EINTR)
+        ;
+    return r > 0 ? 0 : -1;
+}
+/*
+ * Start new server with same arguments plus "-i".
+ *
+ * RETURN
+ *     pid of new process, -1 on error.
+ */
+static pid_t handoff_Spawn(char **argv)
+{
+    char **args;
+    pid_t pid;
+    int inherit;
+    int n;
+
+    inherit = 0;
+    for (n = 0; argv[n]; n++)
+    {
+        if (strcmp(argv[n], "-i") == 0)
+            inherit = 1;
+    }
+    /* NOTE Arguments are prepared before fork, child only calls exec. */
+    args = calloc(n + 2, sizeof(char *));
+    if (!args)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "Failed to allocate arguments");
+        return -1;
+    }
+    memcpy(args, argv, sizeof(char *) * n);
+    if (!inherit)
+        args[n] = "-i";
+
+    pid = fork();
+    if (pid == 0)
+    {
+        execvp(args[0], args);
+        _exit(127);
+    }
+    free(args);
+    if (pid < 0)
+        debugPrint(DLEVEL_ERROR, "Fork failed, %s", strerror(errno));
+    return pid;
+}
+
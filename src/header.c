@@ -0,0 +1,323 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+/* */
+#include "header.h"
+
+static int header_Reserve(struct headerIndex_t *index, int len);
+
+/*
+ * Names of known fields, indexed by HEADER_* value.
+ */
+static const struct {
+    const char *name;
+    int len;
+} header_Names[HEADER_MAX] = {
+#define _NAME(id, name) [id] = {name, sizeof(name) - 1}
+    _NAME(HEADER_ACCEPT,                        "accept"),
+    _NAME(HEADER_ACCEPT_ENCODING,               "accept-encoding"),
+    _NAME(HEADER_ACCEPT_LANGUAGE,               "accept-language"),
+    _NAME(HEADER_ACCESS_CONTROL_REQUEST_METHOD, "access-control-request-method"),
+    _NAME(HEADER_AUTHORIZATION,                 "authorization"),
+    _NAME(HEADER_CACHE_CONTROL,                 "cache-control"),
+    _NAME(HEADER_CONNECTION,                    "connection"),
+    _NAME(HEADER_CONTENT_LENGTH,                "content-length"),
+    _NAME(HEADER_CONTENT_TYPE,                  "content-type"),
+    _NAME(HEADER_COOKIE,                        "cookie"),
+    _NAME(HEADER_EXPECT,                        "expect"),
+    _NAME(HEADER_HOST,                          "host"),
+    _NAME(HEADER_IF_MODIFIED_SINCE,             "if-modified-since"),
+    _NAME(HEADER_IF_NONE_MATCH,                 "if-none-match"),
+    _NAME(HEADER_ORIGIN,                        "origin"),
+    _NAME(HEADER_RANGE,                         "range"),
+    _NAME(HEADER_REFERER,                       "referer"),
+    _NAME(HEADER_SEC_WEBSOCKET_KEY,             "sec-websocket-key"),
+    _NAME(HEADER_SEC_WEBSOCKET_VERSION,         "sec-websocket-version"),
+    _NAME(HEADER_TRANSFER_ENCODING,             "transfer-encoding"),
+    _NAME(HEADER_UPGRADE,                       "upgrade"),
+    _NAME(HEADER_USER_AGENT,                    "user-agent"),
+#undef _NAME
+};
+/*
+ * Hash of name is (length + 6 * first + 3 * last) mod 64, characters in lower
+ * case. It has no collisions for known names, so only one name has to be
+ * compared.
+ *
+ * NOTE Table must be updated when known field is added.
+ */
+#define _HASH(name, len) \
+    (((len) + 6 * ((name)[0] | 0x20) + 3 * ((name)[(len) - 1] | 0x20)) & 63)
+static const unsigned char header_Hash[64] = {
+    [0]  = HEADER_EXPECT,
+    [4]  = HEADER_ACCEPT_LANGUAGE,
+    [7]  = HEADER_COOKIE,
+    [9]  = HEADER_REFERER,
+    [10] = HEADER_ACCEPT_ENCODING,
+    [13] = HEADER_CONTENT_TYPE,
+    [15] = HEADER_ACCESS_CONTROL_REQUEST_METHOD,
+    [16] = HEADER_HOST,
+    [17] = HEADER_SEC_WEBSOCKET_VERSION,
+    [24] = HEADER_CONTENT_LENGTH,
+    [29] = HEADER_AUTHORIZATION,
+    [32] = HEADER_RANGE,
+    [35] = HEADER_CACHE_CONTROL,
+    [36] = HEADER_USER_AGENT,
+    [38] = HEADER_CONNECTION,
+    [40] = HEADER_ACCEPT,
+    [42] = HEADER_ORIGIN,
+    [46] = HEADER_SEC_WEBSOCKET_KEY,
+    [52] = HEADER_UPGRADE,
+    [54] = HEADER_IF_MODIFIED_SINCE,
+    [59] = HEADER_IF_NONE_MATCH,
+    [62] = HEADER_TRANSFER_ENCODING,
+};
+
+/*
+ *
+ */
+void headerInit(struct headerIndex_t *index)
+{
+    index->data = NULL;
+    index->size = 0;
+    headerReset(index);
+}
+/*
+ * Forget fields of previous request. Data buffer is kept.
+ */
+void headerReset(struct headerIndex_t *index)
+{
+    int i;
+
+    index->len     = 0;
+    index->nfields = 0;
+    memset(index->known, 0, sizeof(index->known));
+    for (i = 0; i < HEADER_STRING_MAX; i++)
+        index->strings[i].len = -1;
+}
+/*
+ *
+ */
+void headerDestroy(struct headerIndex_t *index)
+{
+    free(index->data);
+    index->data = NULL;
+    index->size = 0;
+}
+/*
+ * Identify field by name.
+ *
+ * RETURN
+ *     HEADER_* value, HEADER_OTHER if field is not known.
+ */
+int headerId(const char *name, int len)
+{
+    int id;
+
+    if (len <= 0)
+        return HEADER_OTHER;
+    id = header_Hash[_HASH((const unsigned char *)name, len)];
+    if (id != HEADER_OTHER && header_Names[id].len == len &&
+            strncasecmp(header_Names[id].name, name, len) == 0)
+        return id;
+    return HEADER_OTHER;
+}
+/*
+ * Add field to index, name is stored in lower case. Value is set by
+ * headerSetValue().
+ *
+ * ARGS
+ *     id      Value returned by headerId().
+ *
+ * RETURN
+ *     Zero on success, -1 if limit of fields or data is reached.
+ */
+int headerAdd(struct headerIndex_t *index, int id, const char *name, int len)
+{
+    struct header_t *field;
+    char *p;
+    int i;
+
+    if (index->nfields >= HEADER_FIELDS_MAX)
+        return -1;
+    if (header_Reserve(index, len) < 0)
+        return -1;
+
+    field = &index->fields[index->nfields];
+    field->id       = id;
+    field->name     = index->len;
+    field->nameLen  = len;
+    field->value    = index->len + len;
+    field->valueLen = 0;
+
+    p = index->data + index->len;
+    for (i = 0; i < len; i++)
+        p[i] = (name[i] >= 'A' && name[i] <= 'Z') ? name[i] | 0x20 : name[i];
+    index->len += len;
+
+    index->nfields++;
+    if (id != HEADER_OTHER)
+        index->known[id] = index->nfields;
+    return 0;
+}
+/*
+ * Set value of last added field.
+ *
+ * RETURN
+ *     Zero on success, -1 if limit of data is reached.
+ */
+int headerSetValue(struct headerIndex_t *index, const char *value, int len)
+{
+    struct header_t *field;
+
+    if (index->nfields == 0)
+        return -1;
+    if (header_Reserve(index, len) < 0)
+        return -1;
+
+    field = &index->fields[index->nfields - 1];
+    field->value    = index->len;
+    field->valueLen = len;
+    memcpy(index->data + index->len, value, len);
+    index->len += len;
+    return 0;
+}
+/*
+ * Find field by name, case is ignored. If field appears several times last
+ * one is returned.
+ *
+ * RETURN
+ *     Pointer to field, NULL if request has no such field.
+ */
+struct header_t *headerFind(struct headerIndex_t *index, const char *name, int len)
+{
+    struct header_t *field;
+    int id, i;
+
+    id = headerId(name, len);
+    if (id != HEADER_OTHER)
+        return index->known[id] ? &index->fields[index->known[id] - 1] : NULL;
+
+    for (i = index->nfields - 1; i >= 0; i--)
+    {
+        field = &index->fields[i];
+        if (field->id == HEADER_OTHER && field->nameLen == len &&
+                strncasecmp(headerName(index, field), name, len) == 0)
+            return field;
+    }
+    return NULL;
+}
+/*
+ * Set string of request.
+ *
+ * ARGS
+ *     string    HEADER_STRING_* value.
+ *
+ * RETURN
+ *     Zero on success, -1 if limit of data is reached.
+ */
+int headerSetString(struct headerIndex_t *index, int string, const char *s, int len)
+{
+    if (header_Reserve(index, len) < 0)
+        return -1;
+    index->strings[string].offset = index->len;
+    index->strings[string].len    = len;
+    memcpy(index->data + index->len, s, len);
+    index->len += len;
+    return 0;
+}
+/*
+ * Append characters to string of request. String is moved to end of data
+ * if something was stored after it.
+ *
+ * RETURN
+ *     Zero on success, -1 if limit of data is reached.
+ */
+int headerAppendString(struct headerIndex_t *index, int string, const char *s, int len)
+{
+    int offset, slen;
+
+    offset = index->strings[string].offset;
+    slen   = index->strings[string].len;
+    if (slen < 0)
+        return headerSetString(index, string, s, len);
+    if (offset + slen != index->len)
+    {
+        if (header_Reserve(index, slen + len) < 0)
+            return -1;
+        memcpy(index->data + index->len, index->data + offset, slen);
+        index->strings[string].offset = index->len;
+        index->len += slen;
+    } else if (header_Reserve(index, len) < 0) {
+        return -1;
+    }
+    memcpy(index->data + index->len, s, len);
+    index->strings[string].len += len;
+    index->len += len;
+    return 0;
+}
+/*
+ * Get temporary space after data, e.g. for decoding of strings. Space is
+ * valid until something is stored in index.
+ *
+ * RETURN
+ *     Pointer to space of "len" bytes, NULL if limit of data is reached.
+ */
+char *headerScratch(struct headerIndex_t *index, int len)
+{
+    if (header_Reserve(index, len) < 0)
+        return NULL;
+    return index->data + index->len;
+}
+/*
+ * Make room for "len" bytes in data buffer.
+ */
+static int header_Reserve(struct headerIndex_t *index, int len)
+{
+    char *data;
+    int size;
+
+    if (index->len + len <= index->size)
+        return 0;
+    if (index->len + len > HEADER_DATA_MAX)
+        return -1;
+
+    size = index->size ? index->size : HEADER_DATA_SIZE;
+    while (size < index->len + len)
+        size *= 2;
+    if (size > HEADER_DATA_MAX)
+        size = HEADER_DATA_MAX;
+    data = realloc(index->data, size);
+    if (!data)
+        return -1;
+    index->data = data;
+    index->size = size;
+    return 0;
+}
+
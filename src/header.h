@@ -0,0 +1,118 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef _HEADER_H
+#define _HEADER_H
+
+/*
+ * Known header fields, identified by perfect hash of name.
+ */
+enum {
+    HEADER_OTHER,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_ACCEPT_LANGUAGE,
+    HEADER_ACCESS_CONTROL_REQUEST_METHOD,
+    HEADER_AUTHORIZATION,
+    HEADER_CACHE_CONTROL,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_COOKIE,
+    HEADER_EXPECT,
+    HEADER_HOST,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_ORIGIN,
+    HEADER_RANGE,
+    HEADER_REFERER,
+    HEADER_SEC_WEBSOCKET_KEY,
+    HEADER_SEC_WEBSOCKET_VERSION,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_UPGRADE,
+    HEADER_USER_AGENT,
+    HEADER_MAX,
+};
+
+/*
+ * Strings of request line and of fields parsed by server.
+ */
+enum {
+    HEADER_STRING_METHOD,
+    HEADER_STRING_PATH,
+    HEADER_STRING_QUERY,
+    HEADER_STRING_CONTENT_TYPE,
+    HEADER_STRING_BOUNDARY,
+    HEADER_STRING_MAX,
+};
+
+/*
+ * Header fields of request. Names (in lower case) and values are kept in
+ * one data buffer, fields refer to them by offset. Strings of request line
+ * are kept in same buffer. Index belongs to worker and is reused for every
+ * request.
+ */
+struct headerIndex_t {
+#define HEADER_FIELDS_MAX    100
+#define HEADER_DATA_SIZE     4096
+#define HEADER_DATA_MAX      65536
+    char *data;   /* Names and values. */
+    int len;      /* Number of used bytes of data. */
+    int size;     /* Size of data buffer. */
+    struct header_t {
+        int id;       /* HEADER_* value. */
+        int name;     /* Offset of name in data. */
+        int nameLen;
+        int value;    /* Offset of value in data. */
+        int valueLen;
+    } fields[HEADER_FIELDS_MAX];
+    int nfields;
+    int known[HEADER_MAX]; /* Number (index + 1) of last field with given id, 0 if none. */
+    struct {
+        int offset;
+        int len;  /* -1 if string is not set. */
+    } strings[HEADER_STRING_MAX];
+};
+
+void headerInit(struct headerIndex_t *index);
+void headerReset(struct headerIndex_t *index);
+void headerDestroy(struct headerIndex_t *index);
+int headerId(const char *name, int len);
+int headerAdd(struct headerIndex_t *index, int id, const char *name, int len);
+int headerSetValue(struct headerIndex_t *index, const char *value, int len);
+struct header_t *headerFind(struct headerIndex_t *index, const char *name, int len);
+int headerSetString(struct headerIndex_t *index, int string, const char *s, int len);
+int headerAppendString(struct headerIndex_t *index, int string, const char *s, int len);
+char *headerScratch(struct headerIndex_t *index, int len);
+
+#define headerName(index, field)  ((index)->data + (field)->name)
+#define headerValue(index, field) ((index)->data + (field)->value)
+#define headerString(index, string) ((index)->data + (index)->strings[string].offset)
+#define headerStringLen(index, string) ((index)->strings[string].len)
+
+#endif
+
@@ -33,7 +33,9 @@
 #include "client.h"
 #include "common.h"
 #include "debug.h"
+#include "header.h"
 #include "lclient.h"
+#include "server.h"
 #include "token.h"
 
 #if 0
@@ -41,12 +43,8 @@
 #endif
 
 /* */
-static int http_ParseRelPath(struct client_t *client);
-static int http_ParseQuery(struct client_t *client);
-static int http_ParseHeaders(struct client_t *client);
-static int http_LexAnalyze(struct token_info_t *tinfo, char *ch, int type);
-static int http_LexPostAnalyze(struct token_info_t *tinfo, int type);
-static char *http_Strnstr(char *haystack, size_t haystacklen, char *needle, size_t needlelen);
+static int http_Persistent(struct client_t *client);
+static int http_HasOption(const char *value, int len, const char *option);
 enum {
     TOKEN_TYPE_CRLF,
     TOKEN_TYPE_SP,
@@ -61,6 +59,7 @@ enum {
     TOKEN_TYPE_ALPHA,
     TOKEN_TYPE_HIALPHA,
     TOKEN_TYPE_DIGIT,
+    TOKEN_TYPE_HEX,
     TOKEN_TYPE_FSLASH,
     TOKEN_TYPE_QUESTION,
     TOKEN_TYPE_PCHARX,
@@ -70,18 +69,207 @@ enum {
     TOKEN_TYPE_TCHARS,
     TOKEN_TYPE_BOUNDARY,
     TOKEN_TYPE_ANY_NOT_CRLF,
+    TOKEN_TYPE_MAX,
+};
+/*
+ * Character classes, one bit for each class.
+ */
+enum {
+    HTTP_CLASS_CR        = (1 << 0),
+    HTTP_CLASS_LF        = (1 << 1),
+    HTTP_CLASS_SP        = (1 << 2),
+    HTTP_CLASS_AND       = (1 << 3),
+    HTTP_CLASS_EQUAL     = (1 << 4),
+    HTTP_CLASS_DOT       = (1 << 5),
+    HTTP_CLASS_COLON     = (1 << 6),
+    HTTP_CLASS_SEMICOLON = (1 << 7),
+    HTTP_CLASS_FSLASH    = (1 << 8),
+    HTTP_CLASS_QUESTION  = (1 << 9),
+    HTTP_CLASS_PERCENT   = (1 << 10),
+    HTTP_CLASS_ALPHA     = (1 << 11),
+    HTTP_CLASS_HIALPHA   = (1 << 12),
+    HTTP_CLASS_DIGIT     = (1 << 13),
+    HTTP_CLASS_HEX       = (1 << 14),
+    HTTP_CLASS_PCHARX    = (1 << 15),
+    HTTP_CLASS_QUERY     = (1 << 16),
+    HTTP_CLASS_OWS       = (1 << 17),
+    HTTP_CLASS_TCHAR     = (1 << 18),
+    HTTP_CLASS_BOUNDARY  = (1 << 19),
+    HTTP_CLASS_NOT_CR    = (1 << 20),
+};
+/*
+ * Grammar of characters.
+ */
+#define _LOWHEX(c)      ((c) >= 'A' && (c) <= 'F')
+#define _HIHEX(c)       ((c) >= 'a' && (c) <= 'f')
+#define _LOWALPHA(c)    ((c) >= 'a' && (c) <= 'z')
+#define _HIALPHA(c)     ((c) >= 'A' && (c) <= 'Z')
+#define _DIGIT(c)       ((c) >= '0' && (c) <= '9')
+#define _SAFE(c)        ((c) == '$' || (c) == '-' || (c) == '_' || (c) == '.' || (c) == '+')
+#define _EXTRA(c)       ((c) == '!' || (c) == '*' || (c) == '\''|| (c) == '(' || (c) == ')' || (c) == ',')
+#define _HEX(c)         (_DIGIT(c) || _HIHEX(c) || _LOWHEX(c))
+#define _HEXVAL(c) ( \
+        ((c) >= '0' && (c) <= '9') ? (c) - '0' :      \
+        ((c) >= 'a' && (c) <= 'f') ? (c) - 'a' + 10 : \
+        ((c) >= 'A' && (c) <= 'F') ? (c) - 'A' + 10 : -1)
+
+#define _ALPHA(c)       (_LOWALPHA(c) || _HIALPHA(c))
+#define _UNRESERVED(c)  (_ALPHA(c) || _DIGIT(c) || _SAFE(c) || _EXTRA(c))
+#define _UCHARX(c)      (_UNRESERVED(c) /* NOTE no "escape" token */)
+#define _AND(c)         ((c) == '&')
+#define _EQUAL(c)       ((c) == '=')
+#define _PCHAR_(c)      (_UCHARX(c) || ((c) == ':' || (c) == '@'))
+#define _PCHARX(c)      (_PCHAR_(c) || _AND(c) || _EQUAL(c))
+#define _QUERY(c)       (_PCHAR_(c))
+
+#define _DELIMETERS(c) ( \
+        (c) == '(' || (c) == ')' || (c) == ',' || (c) == '/' || \
+        (c) == ':' || (c) == ';' || (c) == '<' || (c) == '=' || \
+        (c) == '>' || (c) == '?' || (c) == '@' || (c) == '[' || \
+        (c) == '\\'|| (c) == ']' || (c) == '{' || (c) == '}'    \
+)
+#define _VCHAR_EXCEPT(c) (_DELIMETERS(c))
+#define _VCHAR_RANGE(c)  ((c) >= 0x21 && (c) <= 0x7E)
+#define _VCHAR(c)        (_VCHAR_RANGE(c) && !_VCHAR_EXCEPT(c))
+
+#define _BOUNDARY(c) ( \
+        _DIGIT(c) || _ALPHA(c) || \
+        (c) == '\''|| (c) == '(' || (c) == ')' || (c) == '.' || \
+        (c) == '+' || (c) == '_' || (c) == ',' || (c) == '-' || \
+        (c) == '/' || (c) == ':' || (c) == '=' || (c) == '?'    \
+)
+
+#define _CLASS(cond, class) ((cond) ? (class) : 0)
+#define _CLASSES(c) ( \
+        _CLASS((c) == '\r',     HTTP_CLASS_CR)        | \
+        _CLASS((c) == '\n',     HTTP_CLASS_LF)        | \
+        _CLASS((c) == ' ',      HTTP_CLASS_SP)        | \
+        _CLASS(_AND(c),         HTTP_CLASS_AND)       | \
+        _CLASS(_EQUAL(c),       HTTP_CLASS_EQUAL)     | \
+        _CLASS((c) == '.',      HTTP_CLASS_DOT)       | \
+        _CLASS((c) == ':',      HTTP_CLASS_COLON)     | \
+        _CLASS((c) == ';',      HTTP_CLASS_SEMICOLON) | \
+        _CLASS((c) == '/',      HTTP_CLASS_FSLASH)    | \
+        _CLASS((c) == '?',      HTTP_CLASS_QUESTION)  | \
+        _CLASS((c) == '%',      HTTP_CLASS_PERCENT)   | \
+        _CLASS(_ALPHA(c),       HTTP_CLASS_ALPHA)     | \
+        _CLASS(_HIALPHA(c),     HTTP_CLASS_HIALPHA)   | \
+        _CLASS(_DIGIT(c),       HTTP_CLASS_DIGIT)     | \
+        _CLASS(_HEX(c),         HTTP_CLASS_HEX)       | \
+        _CLASS(_PCHARX(c),      HTTP_CLASS_PCHARX)    | \
+        _CLASS(_QUERY(c),       HTTP_CLASS_QUERY)     | \
+        _CLASS((c) == ' ' || (c) == '\t', HTTP_CLASS_OWS) | \
+        _CLASS(_VCHAR(c),       HTTP_CLASS_TCHAR)     | \
+        _CLASS(_BOUNDARY(c),    HTTP_CLASS_BOUNDARY)  | \
+        _CLASS((c) != '\r',     HTTP_CLASS_NOT_CR)      \
+)
+#define _CLASSES4(c)   _CLASSES(c), _CLASSES(c + 1), _CLASSES(c + 2), _CLASSES(c + 3)
+#define _CLASSES16(c)  _CLASSES4(c), _CLASSES4(c + 4), _CLASSES4(c + 8), _CLASSES4(c + 12)
+#define _CLASSES64(c)  _CLASSES16(c), _CLASSES16(c + 16), _CLASSES16(c + 32), _CLASSES16(c + 48)
+/*
+ * NOTE Characters with high bit set (obs-text) does not belong to any class
+ * except "not CR".
+ */
+static const uint32_t http_Classes[256] = {
+    _CLASSES64(0), _CLASSES64(64),
+    _CLASSES64(-128), _CLASSES64(-64),
+};
+/*
+ * Rules of tokens, first character, other characters, minimum and maximum
+ * length.
+ */
+static const struct tokenRule_t http_Rules[TOKEN_TYPE_MAX] = {
+    [TOKEN_TYPE_CRLF]         = {HTTP_CLASS_CR,        HTTP_CLASS_LF,       2, 2},
+    [TOKEN_TYPE_SP]           = {HTTP_CLASS_SP,        0,                   1, 1},
+    [TOKEN_TYPE_AND]          = {HTTP_CLASS_AND,       0,                   1, 1},
+    [TOKEN_TYPE_EQUAL]        = {HTTP_CLASS_EQUAL,     0,                   1, 1},
+    [TOKEN_TYPE_DOT]          = {HTTP_CLASS_DOT,       0,                   1, 1},
+    [TOKEN_TYPE_COLON]        = {HTTP_CLASS_COLON,     0,                   1, 1},
+    [TOKEN_TYPE_SEMICOLON]    = {HTTP_CLASS_SEMICOLON, 0,                   1, 1},
+    [TOKEN_TYPE_ALPHA]        = {HTTP_CLASS_ALPHA,     HTTP_CLASS_ALPHA,    1, 0},
+    [TOKEN_TYPE_HIALPHA]      = {HTTP_CLASS_HIALPHA,   HTTP_CLASS_HIALPHA,  1, 0},
+    [TOKEN_TYPE_DIGIT]        = {HTTP_CLASS_DIGIT,     HTTP_CLASS_DIGIT,    1, 0},
+    [TOKEN_TYPE_HEX]          = {HTTP_CLASS_HEX,       HTTP_CLASS_HEX,      1, 0},
+    [TOKEN_TYPE_FSLASH]       = {HTTP_CLASS_FSLASH,    0,                   1, 1},
+    [TOKEN_TYPE_QUESTION]     = {HTTP_CLASS_QUESTION,  0,                   1, 1},
+    [TOKEN_TYPE_PCHARX]       = {HTTP_CLASS_PCHARX,    HTTP_CLASS_PCHARX,   1, 0},
+    [TOKEN_TYPE_QUERY]        = {HTTP_CLASS_QUERY,     HTTP_CLASS_QUERY,    1, 0},
+    [TOKEN_TYPE_ESCAPE]       = {HTTP_CLASS_PERCENT,   HTTP_CLASS_HEX,      3, 3}, /* %xx */
+    [TOKEN_TYPE_OWS]          = {HTTP_CLASS_OWS,       HTTP_CLASS_OWS,      1, 0},
+    [TOKEN_TYPE_TCHARS]       = {HTTP_CLASS_TCHAR,     HTTP_CLASS_TCHAR,    1, 0},
+    [TOKEN_TYPE_BOUNDARY]     = {HTTP_CLASS_BOUNDARY,  HTTP_CLASS_BOUNDARY, 1, 0},
+    [TOKEN_TYPE_ANY_NOT_CRLF] = {HTTP_CLASS_NOT_CR,    HTTP_CLASS_NOT_CR,   1, 0},
+};
+static const struct tokenGrammar_t http_Grammar = {
+    .classes = http_Classes,
+    .rules   = http_Rules,
+};
+#define TOKEN_MATCH(type) do {                                          \
+        tval = buf + pos;                                               \
+        tlen = tokenMatch(&http_Grammar, type, tval, len - pos);        \
+        if (tlen == TOKEN_MORE)                                         \
+            goto more;                                                  \
+    } while (0)
+#define TOKEN_DROP()    (pos += tlen)
+#define STATE(s)        (client->parser.state = (s))
+
+/*
+ * States of request parser, element of request grammar expected next.
+ */
+enum {
+    HTTP_STATE_START,
+    HTTP_STATE_METHOD,
+    HTTP_STATE_METHOD_SP,
+    HTTP_STATE_ABS_PATH,
+    HTTP_STATE_REL_PATH,
+    HTTP_STATE_QUESTION,
+    HTTP_STATE_QUERY,
+    HTTP_STATE_URI_SP,
+    HTTP_STATE_VERSION,
+    HTTP_STATE_VERSION_FSLASH,
+    HTTP_STATE_VERSION_MAJOR,
+    HTTP_STATE_VERSION_DOT,
+    HTTP_STATE_VERSION_MINOR,
+    HTTP_STATE_LINE_CRLF,
+    HTTP_STATE_FIELD_NAME,
+    HTTP_STATE_FIELD_COLON,
+    HTTP_STATE_FIELD_OWS,
+    HTTP_STATE_FIELD_VALUE,
+    HTTP_STATE_CONTENT_TYPE_FSLASH,
+    HTTP_STATE_CONTENT_TYPE_SUBTYPE,
+    HTTP_STATE_CONTENT_TYPE_PARAMS,
+    HTTP_STATE_MULTIPART_FSLASH,
+    HTTP_STATE_MULTIPART_SUBTYPE,
+    HTTP_STATE_MULTIPART_SEMICOLON,
+    HTTP_STATE_MULTIPART_OWS,
+    HTTP_STATE_MULTIPART_BOUNDARY_NAME,
+    HTTP_STATE_MULTIPART_EQUAL,
+    HTTP_STATE_MULTIPART_BOUNDARY,
+    HTTP_STATE_VALUE_OWS,
+    HTTP_STATE_FIELD_CRLF,
+    HTTP_STATE_HEAD_CRLF,
+    HTTP_STATE_DONE,
+    /* Chunked request body. */
+    HTTP_STATE_CHUNK_SIZE,
+    HTTP_STATE_CHUNK_EXT,
+    HTTP_STATE_CHUNK_CRLF,
+    HTTP_STATE_CHUNK_DATA_CRLF,
+    HTTP_STATE_TRAILER,
+    HTTP_STATE_TRAILER_CRLF,
 };
-#define TOKEN_GET(type) tokenGet(token, &tlen, &eof, http_LexAnalyze, http_LexPostAnalyze, type)
 
 /*
  * Retrieve client request.
- * Fields of lua "request" filled in this call:
+ * Strings of request stored in header index in this call:
  *     method    "GET" or "POST"
  *     path      abs_path
  *     query     query
- *     qtable     query table, items a split of "query" by "&".
  *     ...
  *     TODO Full documentation.
+ * Fields of lua "request" are made from them on first access (lclient.c).
+ *
+ * Request head is parsed from input, more data is read to input
+ * while parser needs it.
  *
  * RETURN
  *     -1 if imposible to continue processing, connection must be dropped.
@@ -90,16 +278,60 @@ enum {
  */
 int httpProcessRequest(struct client_t *client)
 {
-    struct token_t *token = &client->token;
+    int r;
+
+    httpReset(client);
+    r = clientParse(client, httpParse, server.headerTimeout);
+    if (r == HTTP_PARSE_NEED_MORE)
+    {
+        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Request head too large");
+        return HTTP_400_BAD_REQUEST;
+    }
+    if (r != HTTP_PARSE_DONE)
+        return r;
+    if (client->request.chunked)
+        STATE(HTTP_STATE_CHUNK_SIZE);
+    return HTTP_200_OK;
+}
+/*
+ * Prepare parser for next request.
+ */
+void httpReset(struct client_t *client)
+{
+    client->parser.state  = HTTP_STATE_START;
+    client->parser.id     = HEADER_OTHER;
+    client->parser.length = 0;
+}
+/*
+ * Parse slice of request head. Parser state is kept in client structure,
+ * so head can be fed in slices of any size. Token which is split by end of
+ * slice is not consumed, it must be passed again at start of next slice.
+ *
+ * ARGS
+ *     client    Client with parser state, strings and fields of request
+ *               are stored in its header index.
+ *     buf       Slice of request head.
+ *     len       Length of slice.
+ *     used      Pointer where number of consumed bytes will be placed.
+ *
+ * RETURN
+ *     HTTP_PARSE_DONE if whole request head is parsed.
+ *     HTTP_PARSE_NEED_MORE if next slice is needed.
+ *     -1 on error when connection must be dropped.
+ *     HTTP error code on other error.
+ */
+int httpParse(struct client_t *client, char *buf, int len, int *used)
+{
+    struct headerIndex_t *headers = client->request.headers;
+    int64_t number;
     char *tval;
     int tlen;
-    int eof;
     int error;
+    int pos;
+    int id;
 
+    pos   = 0;
     error = -1;
-    /* Drop any previous tokens. */
-    tokenDrop(token);
-
     /*
      * :::: RFC 2616
      * :: generic-message = start-line
@@ -110,15 +342,7 @@ int httpProcessRequest(struct client_t *client)
      * ::
      * ::
      * :: LWS            = [CRLF] 1*( SP | HT )
-     */
-
-    /* Drop any leading CRLF. */
-    while (TOKEN_GET(TOKEN_TYPE_CRLF))
-        tokenDrop(token);
-    if (eof)
-        goto error_eof;
-
-    /*
+     *
      * :::: RFC 2616
      * :: Request       = Request-Line              ; Section 5.1
      * ::                 *(( general-header        ; Section 4.5
@@ -129,1284 +353,1001 @@ int httpProcessRequest(struct client_t *client)
      * ::
      * :: Request-Line   = Method SP Request-URI SP HTTP-Version CRLF
      */
-
-    /* Request-Line. */
+    while (1)
     {
-        /* Method. */
+        switch (client->parser.state)
         {
-            tval = TOKEN_GET(TOKEN_TYPE_HIALPHA);
-            if (!tval)
-            {
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No method token");
-                goto error;
-            }
-            /* Supported methods. */
-            if (
-                strncmp(tval, "GET", tlen)  == 0 ||
-                strncmp(tval, "POST", tlen) == 0 ||
-                strncmp(tval, "OPTIONS", tlen) == 0
-            ) {
-
-            } else {
-                DEBUG_CLIENT(DLEVEL_NOISE, "(E) Unknown method %.*s", tlen, tval);
-                error = HTTP_400_BAD_REQUEST;
-                /* 
-                 * TODO
-                 * Response with HTTP_405_METHOD_NOT_ALLOWED.
-                 *
-                 * :::: RFC 2616
-                 * :: The response MUST include an
-                 * :: Allow header containing a list of valid methods for the requested
-                 * :: resource.
-                 */
-                goto error;
-            }
-            lclientSetRequestFieldL(client->luaState, "method", tval, tlen);
-            tokenDrop(token);
-        }
-        /* SP. */
-        {
-            if (!TOKEN_GET(TOKEN_TYPE_SP))
-            {
-                /* Discard LWS (started with CRLF). */
-                if (TOKEN_GET(TOKEN_TYPE_CRLF))
+            case HTTP_STATE_START:
+                /* Drop any leading CRLF. */
+                TOKEN_MATCH(TOKEN_TYPE_CRLF);
+                if (tlen)
+                    TOKEN_DROP();
+                else
+                    STATE(HTTP_STATE_METHOD);
+                break;
+            case HTTP_STATE_METHOD:
+                TOKEN_MATCH(TOKEN_TYPE_HIALPHA);
+                if (!tlen)
                 {
-                    error = HTTP_400_BAD_REQUEST;
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No method token");
                     goto error;
                 }
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No SP after \"Method\"");
-                goto error;
-            }
-            tokenDrop(token);
-        }
-
-        /*
-         * :::: RFC 2616
-         * :: Request-URI    = "*" | absoluteURI | abs_path | authority
-         *
-         * No support for "*".
-         * No support for authority.
-         * No support for absoluteURI.
-         *
-         */
+                /* Supported methods. */
+                if (
+                    strncmp(tval, "GET", tlen)  == 0 ||
+                    strncmp(tval, "POST", tlen) == 0 ||
+                    strncmp(tval, "OPTIONS", tlen) == 0
+                ) {
 
-        /*
-         * abs_path.
-         *
-         * :::: RFC 1808
-         * :: abs_path    = "/"  rel_path
-         */
-        {
-            if (!TOKEN_GET(TOKEN_TYPE_FSLASH))
-            {
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No \"/\" character in \"abs_path\"");
-                goto error;
-            }
-            tokenDrop(token);
-            lclientSetRequestFieldL(client->luaState, "path", "/", 1);
-            if (!http_ParseRelPath(client))
-                goto error;
-        }
-        /* SP. */
-        {
-            if (!TOKEN_GET(TOKEN_TYPE_SP))
-            {
-                /* Discard LWS (started with CRLF). */
-                if (TOKEN_GET(TOKEN_TYPE_CRLF))
+                } else {
+                    DEBUG_CLIENT(DLEVEL_NOISE, "(E) Unknown method %.*s", tlen, tval);
+                    /* 
+                     * TODO
+                     * Response with HTTP_405_METHOD_NOT_ALLOWED.
+                     *
+                     * :::: RFC 2616
+                     * :: The response MUST include an
+                     * :: Allow header containing a list of valid methods for the requested
+                     * :: resource.
+                     */
+                    goto bad_request;
+                }
+                if (headerSetString(headers, HEADER_STRING_METHOD, tval, tlen) < 0)
+                    goto error;
+                TOKEN_DROP();
+                STATE(HTTP_STATE_METHOD_SP);
+                break;
+            case HTTP_STATE_METHOD_SP:
+                TOKEN_MATCH(TOKEN_TYPE_SP);
+                if (!tlen)
                 {
-                    error = HTTP_400_BAD_REQUEST;
+                    /* Discard LWS (started with CRLF). */
+                    TOKEN_MATCH(TOKEN_TYPE_CRLF);
+                    if (tlen)
+                        goto bad_request;
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No SP after \"Method\"");
                     goto error;
                 }
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No SP after \"Request-URI\"");
-                goto error;
-            }
-            tokenDrop(token);
-        }
-        /*
-         * HTTP-Version.
-         *
-         * :::: RFC 2616
-         * :: HTTP-Version   = "HTTP" "/" 1*DIGIT "." 1*DIGIT
-         *
-         * TODO read carefuly RFC 2145
-         */
-        {
-            int versionError;
-            int64_t major;
-            int64_t minor;
-
-            versionError = 1;
-            do {
-                /* "HTTP" */
-                if (!(tval = TOKEN_GET(TOKEN_TYPE_HIALPHA)))
-                    break;
-                if (strncmp(tval, "HTTP", tlen) != 0)
-                    break;
-                tokenDrop(token);
-                /* "/" */
-                if (!(tval = TOKEN_GET(TOKEN_TYPE_FSLASH)))
+                TOKEN_DROP();
+                STATE(HTTP_STATE_ABS_PATH);
+                break;
+            /*
+             * :::: RFC 2616
+             * :: Request-URI    = "*" | absoluteURI | abs_path | authority
+             *
+             * No support for "*".
+             * No support for authority.
+             * No support for absoluteURI.
+             *
+             * :::: RFC 1808
+             * :: abs_path    = "/"  rel_path
+             */
+            case HTTP_STATE_ABS_PATH:
+                TOKEN_MATCH(TOKEN_TYPE_FSLASH);
+                if (!tlen)
+                {
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No \"/\" character in \"abs_path\"");
+                    goto error;
+                }
+                if (headerSetString(headers, HEADER_STRING_PATH, "/", 1) < 0)
+                    goto error;
+                TOKEN_DROP();
+                STATE(HTTP_STATE_REL_PATH);
+                break;
+            /*
+             * :::: RFC 1808
+             * :: rel_path    = [ path ] [ ";" params ] [ "?" query ]
+             * ::
+             * :: path        = fsegment *( "/" segment )
+             * :: fsegment    = 1*pchar
+             * :: segment     =  *pchar
+             * ::
+             * :: pchar       = uchar | ":" | "@" | "&" | "="
+             * :: uchar       = unreserved | escape
+             * :: unreserved  = alpha | digit | safe | extra
+             * ::
+             * :: escape      = "%" hex hex
+             * :: hex         = digit | "A" | "B" | "C" | "D" | "E" | "F" |
+             * ::                       "a" | "b" | "c" | "d" | "e" | "f"
+             * ::
+             * :: alpha       = lowalpha | hialpha
+             * :: lowalpha    = "a" | "b" | "c" | "d" | "e" | "f" | "g" | "h" | "i" |
+             * ::               "j" | "k" | "l" | "m" | "n" | "o" | "p" | "q" | "r" |
+             * ::               "s" | "t" | "u" | "v" | "w" | "x" | "y" | "z"
+             * :: hialpha     = "A" | "B" | "C" | "D" | "E" | "F" | "G" | "H" | "I" |
+             * ::               "J" | "K" | "L" | "M" | "N" | "O" | "P" | "Q" | "R" |
+             * ::               "S" | "T" | "U" | "V" | "W" | "X" | "Y" | "Z"
+             * ::
+             * :: digit       = "0" | "1" | "2" | "3" | "4" | "5" | "6" | "7" |
+             * ::               "8" | "9"
+             * ::
+             * :: safe        = "$" | "-" | "_" | "." | "+"
+             * :: extra       = "!" | "*" | "'" | "(" | ")" | ","
+             * :: national    = "{" | "}" | "|" | "\" | "^" | "~" | "[" | "]" | "`"
+             * :: reserved    = ";" | "/" | "?" | ":" | "@" | "&" | "="
+             * :: punctuation = "<" | ">" | "#" | "%" | <">
+             *
+             * Does "query" have same rules as "path"?
+             */
+            /* 
+             * XXX
+             * Is "//.." path token allowed? Firefox 45.0 permit to user to enter
+             * such request. Rules in RFC 1808 does not permit.
+             */
+            case HTTP_STATE_REL_PATH:
+                /* :: path        = fsegment *( "/" segment ) */
+                TOKEN_MATCH(TOKEN_TYPE_PCHARX);
+                if (!tlen)
+                    TOKEN_MATCH(TOKEN_TYPE_ESCAPE);
+                if (!tlen)
+                    TOKEN_MATCH(TOKEN_TYPE_FSLASH);
+                if (!tlen)
+                {
+                    /* No support for [";" params ] */
+                    STATE(HTTP_STATE_QUESTION);
                     break;
-                tokenDrop(token);
-                /* MAJOR */
-                if (!(tval = TOKEN_GET(TOKEN_TYPE_DIGIT)))
+                }
+                if (headerAppendString(headers, HEADER_STRING_PATH, tval, tlen) < 0)
+                    goto error;
+                TOKEN_DROP();
+                break;
+            case HTTP_STATE_QUESTION:
+                TOKEN_MATCH(TOKEN_TYPE_QUESTION);
+                if (!tlen)
+                {
+                    STATE(HTTP_STATE_URI_SP);
                     break;
-                if (commonString2Number(tval, tlen, &major) < 0)
+                }
+                if (headerSetString(headers, HEADER_STRING_QUERY, "?", 1) < 0)
+                    goto error;
+                TOKEN_DROP();
+                STATE(HTTP_STATE_QUERY);
+                break;
+            case HTTP_STATE_QUERY:
+                /*
+                 * NOTE Query is split to "qtable" on first access (lclient.c).
+                 */
+                TOKEN_MATCH(TOKEN_TYPE_QUERY);
+                if (!tlen)
+                    TOKEN_MATCH(TOKEN_TYPE_ESCAPE);
+                if (!tlen)
+                    TOKEN_MATCH(TOKEN_TYPE_EQUAL);
+                if (!tlen)
+                    TOKEN_MATCH(TOKEN_TYPE_AND);
+                if (!tlen)
+                {
+                    STATE(HTTP_STATE_URI_SP);
                     break;
-                tokenDrop(token);
-                if (major != 1)
+                }
+                if (headerAppendString(headers, HEADER_STRING_QUERY, tval, tlen) < 0)
+                    goto error;
+                TOKEN_DROP();
+                break;
+            case HTTP_STATE_URI_SP:
+                TOKEN_MATCH(TOKEN_TYPE_SP);
+                if (!tlen)
+                {
+                    /* Discard LWS (started with CRLF). */
+                    TOKEN_MATCH(TOKEN_TYPE_CRLF);
+                    if (tlen)
+                        goto bad_request;
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No SP after \"Request-URI\"");
+                    goto error;
+                }
+                TOKEN_DROP();
+                STATE(HTTP_STATE_VERSION);
+                break;
+            /*
+             * :::: RFC 2616
+             * :: HTTP-Version   = "HTTP" "/" 1*DIGIT "." 1*DIGIT
+             *
+             * TODO read carefuly RFC 2145
+             */
+            case HTTP_STATE_VERSION:
+                TOKEN_MATCH(TOKEN_TYPE_HIALPHA);
+                if (!tlen || strncmp(tval, "HTTP", tlen) != 0)
+                    goto version_error;
+                TOKEN_DROP();
+                STATE(HTTP_STATE_VERSION_FSLASH);
+                break;
+            case HTTP_STATE_VERSION_FSLASH:
+                TOKEN_MATCH(TOKEN_TYPE_FSLASH);
+                if (!tlen)
+                    goto version_error;
+                TOKEN_DROP();
+                STATE(HTTP_STATE_VERSION_MAJOR);
+                break;
+            case HTTP_STATE_VERSION_MAJOR:
+                TOKEN_MATCH(TOKEN_TYPE_DIGIT);
+                if (!tlen || commonString2Number(tval, tlen, &number) < 0)
+                    goto version_error;
+                TOKEN_DROP();
+                if (number != 1)
                 {
                     /* TODO Proper handling. */
                     DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Invalid MAJOR version of HTTP, must be 1");
-                    break;
+                    goto version_error;
                 }
-                /* "." */
-                if (!(tval = TOKEN_GET(TOKEN_TYPE_DOT)))
-                    break;
-                tokenDrop(token);
-                /* MINOR */
-                if (!(tval = TOKEN_GET(TOKEN_TYPE_DIGIT)))
-                    break;
-                if (commonString2Number(tval, tlen, &minor) < 0)
-                    break;
-                tokenDrop(token);
-                if (minor != 1)
+                STATE(HTTP_STATE_VERSION_DOT);
+                break;
+            case HTTP_STATE_VERSION_DOT:
+                TOKEN_MATCH(TOKEN_TYPE_DOT);
+                if (!tlen)
+                    goto version_error;
+                TOKEN_DROP();
+                STATE(HTTP_STATE_VERSION_MINOR);
+                break;
+            case HTTP_STATE_VERSION_MINOR:
+                TOKEN_MATCH(TOKEN_TYPE_DIGIT);
+                if (!tlen || commonString2Number(tval, tlen, &number) < 0)
+                    goto version_error;
+                TOKEN_DROP();
+                if (number != 1)
                 {
                     /* TODO Proper handling. */
                     DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Invalid MINOR version of HTTP, must be 1");
-                    break;
+                    goto version_error;
                 }
-                versionError = 0;
-            } while (0);
-            if (versionError)
-            {
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Error in \"HTTP-Version\"");
-                goto error;
-            }
-        }
-        /*
-         * CRLF
-         */
-        {
-            if (!TOKEN_GET(TOKEN_TYPE_CRLF))
-            {
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No CRLF at end of \"Request-Line\"");
-                goto error;
-            }
-            tokenDrop(token);
-        }
-    }
-
-    error = http_ParseHeaders(client);
-    if (error < 0 || error != HTTP_200_OK)
-        goto error;
-
-#if 0
-    /*
-     * XXX Debug, disable this block.
-     */
-    return -1;
-#endif
-    return HTTP_200_OK;
-error_eof:
-    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(W) EOF");
-error:
-    return error;
-}
-/*
- * RETURN
- *     0 on error, 1 on success.
- */
-static int http_ParseRelPath(struct client_t *client)
-{
-    struct token_t *token = &client->token;
-    char *tval;
-    int tlen;
-    int eof;
-
-    /*
-     * :::: RFC 1808
-     * :: rel_path    = [ path ] [ ";" params ] [ "?" query ]
-     * ::
-     * :: path        = fsegment *( "/" segment )
-     * :: fsegment    = 1*pchar
-     * :: segment     =  *pchar
-     * ::
-     * :: pchar       = uchar | ":" | "@" | "&" | "="
-     * :: uchar       = unreserved | escape
-     * :: unreserved  = alpha | digit | safe | extra
-     * ::
-     * :: escape      = "%" hex hex
-     * :: hex         = digit | "A" | "B" | "C" | "D" | "E" | "F" |
-     * ::                       "a" | "b" | "c" | "d" | "e" | "f"
-     * ::
-     * :: alpha       = lowalpha | hialpha
-     * :: lowalpha    = "a" | "b" | "c" | "d" | "e" | "f" | "g" | "h" | "i" |
-     * ::               "j" | "k" | "l" | "m" | "n" | "o" | "p" | "q" | "r" |
-     * ::               "s" | "t" | "u" | "v" | "w" | "x" | "y" | "z"
-     * :: hialpha     = "A" | "B" | "C" | "D" | "E" | "F" | "G" | "H" | "I" |
-     * ::               "J" | "K" | "L" | "M" | "N" | "O" | "P" | "Q" | "R" |
-     * ::               "S" | "T" | "U" | "V" | "W" | "X" | "Y" | "Z"
-     * ::
-     * :: digit       = "0" | "1" | "2" | "3" | "4" | "5" | "6" | "7" |
-     * ::               "8" | "9"
-     * ::
-     * :: safe        = "$" | "-" | "_" | "." | "+"
-     * :: extra       = "!" | "*" | "'" | "(" | ")" | ","
-     * :: national    = "{" | "}" | "|" | "\" | "^" | "~" | "[" | "]" | "`"
-     * :: reserved    = ";" | "/" | "?" | ":" | "@" | "&" | "="
-     * :: punctuation = "<" | ">" | "#" | "%" | <">
-     *
-     * Does "query" have same rules as "path"?
-     */
-
-    /* 
-     * XXX
-     * Is "//.." path token allowed? Firefox 45.0 permit to user to enter
-     * such request. Rules in RFC 1808 does not permit.
-     */
-
-    /* fsegment. */
-    while (1) {
-        if ((tval = TOKEN_GET(TOKEN_TYPE_PCHARX)))
-        {
-            lclientAppendRequestFieldL(client->luaState, "path", tval, tlen);
-            tokenDrop(token);
-        } else if ((tval = TOKEN_GET(TOKEN_TYPE_ESCAPE))) {
-            lclientAppendRequestFieldL(client->luaState, "path", tval, tlen);
-            tokenDrop(token);
-        } else {
-            break;
-        }
-    }
-    /* :: *( "/" segment) */
-    while (1)
-    {
-        /* "/" */
-        if (!TOKEN_GET(TOKEN_TYPE_FSLASH))
-            break;
-        tokenDrop(token);
-        lclientAppendRequestFieldL(client->luaState, "path", "/", 1);
-        /*
-         * segment.
-         */
-        while (1) {
-            if ((tval = TOKEN_GET(TOKEN_TYPE_PCHARX)))
-            {
-                lclientAppendRequestFieldL(client->luaState, "path", tval, tlen);
-                tokenDrop(token);
-            } else if ((tval = TOKEN_GET(TOKEN_TYPE_ESCAPE))) {
-                lclientAppendRequestFieldL(client->luaState, "path", tval, tlen);
-                tokenDrop(token);
-            } else {
-                break;
-            }
-        }
-    }
-    /* No support for [";" params ] */
-    return http_ParseQuery(client);
-}
-/*
- * RETURN
- *     0 on error, 1 on success.
- */
-static int http_ParseQuery(struct client_t *client)
-{
-    struct token_t *token = &client->token;
-    lua_State *L = client->luaState;
-    char *tval;
-    int tlen;
-    int eof;
-
-    lua_getglobal(L, "request");   /* [request]->TOS */
-    lua_newtable(L);               /* [request][qtable]->TOS */
-    lua_setfield(L, -2, "qtable"); /* [request]->TOS */
-    lua_pop(L, 1);                 /* ->TOS */
-
-    if (!TOKEN_GET(TOKEN_TYPE_QUESTION))
-        return 1;
-    tokenDrop(token);
-
-    lclientSetRequestFieldL(client->luaState, "query", "?", 1);
-
-    lua_newtable(L); /* [qtable]->TOS */
-
-    while (1) {
-        /*
-         * Get name of parameter.
-         */
-        lua_pushstring(L, ""); /* [qtable][name]->TOS */
-        while (1) {
-            if ((tval = TOKEN_GET(TOKEN_TYPE_QUERY)))
-            {
-                lclientAppendRequestFieldL(client->luaState, "query", tval, tlen);
-                lua_pushlstring(L, tval, tlen); /* [qtable][name][name1]->TOS */
-                lua_concat(L, 2);               /* [qtable][name..name1]->TOS */
-                tokenDrop(token);
-            } else if ((tval = TOKEN_GET(TOKEN_TYPE_ESCAPE))) {
-                lclientAppendRequestFieldL(client->luaState, "query", tval, tlen);
-                lua_pushlstring(L, tval, tlen);  /* [qtable][name][name1]->TOS */
-                lua_concat(L, 2);                 /* [qtable][name..name1]->TOS */
-                tokenDrop(token);
-            } else {
+                /* NOTE HTTP/1.1 connection is persistent unless "Connection: close" is given. */
+                client->request.keepAlive = http_Persistent(client);
+                STATE(HTTP_STATE_LINE_CRLF);
                 break;
-            }
-        }
-        lua_pushstring(L, ""); /* [qtable][name][value]->TOS*/
-        /* = */
-        if ((tval = TOKEN_GET(TOKEN_TYPE_EQUAL)))
-        {
-            lclientAppendRequestFieldL(client->luaState, "query", tval, tlen);
-            tokenDrop(token);
-            /*
-             * Get value of parameter.
-             */
-            while (1) {
-                if ((tval = TOKEN_GET(TOKEN_TYPE_QUERY)))
+            case HTTP_STATE_LINE_CRLF:
+                TOKEN_MATCH(TOKEN_TYPE_CRLF);
+                if (!tlen)
                 {
-                    lclientAppendRequestFieldL(client->luaState, "query", tval, tlen);
-                    lua_pushlstring(L, tval, tlen);  /* [qtable][name][value][value1]->TOS */
-                    lua_concat(L, 2);                 /* [qtable][name][value .. value1]->TOS */
-                    tokenDrop(token);
-                } else if ((tval = TOKEN_GET(TOKEN_TYPE_ESCAPE))) {
-                    lclientAppendRequestFieldL(client->luaState, "query", tval, tlen);
-                    lua_pushlstring(L, tval, tlen);  /* [qtable][name][value][value1]->TOS */
-                    lua_concat(L, 2);                 /* [qtable][name][value .. value1]->TOS */
-                    tokenDrop(token);
-                } else {
-                    break;
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No CRLF at end of \"Request-Line\"");
+                    goto error;
                 }
-            }
-            /* Set only non-empty name values, drop value and name otherwise. */
-            if (lua_rawlen(L, -2))
-                lua_settable(L, -3); /* [qtable]->TOS */
-            else
-                lua_pop(L, 2); /* [qtable]->TOS */
-        } else if ((tval = TOKEN_GET(TOKEN_TYPE_AND))) {
-            lclientAppendRequestFieldL(client->luaState, "query", tval, tlen);
-            tokenDrop(token);
-            /* Set only non-empty name values, drop value and name otherwise. */
-            if (lua_rawlen(L, -2))
-                lua_settable(L, -3); /* [qtable]->TOS */
-            else
-                lua_pop(L, 2); /* [qtable]->TOS */
-        } else {
-            /* Set only non-empty name values, drop value and name otherwise. */
-            if (lua_rawlen(L, -2))
-                lua_settable(L, -3); /* [qtable]->TOS */
-            else
-                lua_pop(L, 2); /* [qtable]->TOS */
-            break;
-        }
-    }
-
-    {
-        lua_getglobal(L, "request"); /* [qtable][request]->TOS */
-#if 1
-        lua_insert(L, -2);           /* [request][qtable]->TOS */
-        lua_pushstring(L, "qtable");  /* [request][qtable]["qtable"]->TOS */
-        lua_insert(L, -2);           /* [request]["qtable"][qtable]->TOS */
-#else
-        lua_pushstring(L, "qtable");               /* [qtable][request]["qtable"]->TOS */
-        lua_rotate(L, -3 /* idx */, -1 /* n */);  /* [request]["qtable"][qtable]->TOS */
-#endif
-        lua_settable(L, -3);                      /* [request]->TOS */
-        lua_pop(L, 1);                            /* ->TOS */
-    }
-
-#if (0 && (defined DEBUG_THIS))
-        /* Stack MUST be empty (gettop return 0). */
-        debugPrint(DLEVEL_NOISE, "%s stack \"%d\" [sock %d].",
-                __FUNCTION__, lua_gettop(L), client->sock);
-#endif
-    return 1;
-}
-/*
- *
- * RETURN
- *     see clientreqRead()
- */
-static int _parseHeaderValue(struct client_t *client);
-
-static int http_ParseHeaders(struct client_t *client)
-{
-    struct token_t *token = &client->token;
-    int error             = -1;
-    char *tval;
-    int tlen;
-    int eof;
-    /*
-     * :::: RFC 7230
-     * :: Each header field consists of a case-insensitive field name followed
-     * :: by a colon (":"), optional leading whitespace, the field value, and
-     * :: optional trailing whitespace.    
-     *
-     * :: header-field   = field-name ":" OWS field-value OWS
-     * :: field-name     = token
-     * :: field-value    = *( field-content / obs-fold )
-     * :: field-content  = field-vchar [ 1*( SP / HTAB ) field-vchar ]
-     * :: field-vchar    = VCHAR / obs-text
-     * ::
-     * :: obs-fold       = CRLF 1*( SP / HTAB )
-     * ::                ; obsolete line folding
-     * ::                ; see Section 3.2.4
-     * ::
-     * :: BWS = OWS             ; "bad" whitespace
-     * :: OWS = *( SP / HTAB )  ; optional whitespace
-     * :: RWS = 1*( SP / HTAB ) ; required whitespace
-     * ::
-     * :: No whitespace is allowed between the header field-name and colon.  In
-     * :: the past, differences in the handling of such whitespace have led to
-     * :: security vulnerabilities in request routing and response handling.  A
-     * :: server MUST reject any received request message that contains
-     * :: whitespace between a header field-name and colon with a response code
-     * :: of 400 (Bad Request).  A proxy MUST remove any such whitespace from a
-     * :: response message before forwarding the message downstream.
-     * ::
-     * :: A field value might be preceded and/or followed by optional
-     * :: whitespace (OWS); a single SP preceding the field-value is preferred
-     * :: for consistent readability by humans.  The field value does not
-     * :: include any leading or trailing whitespace: OWS occurring before the
-     * :: first non-whitespace octet of the field value or after the last
-     * :: non-whitespace octet of the field value ought to be excluded by
-     * :: parsers when extracting the field value from a header field.
-     * ::
-     * :: Historically, HTTP header field values could be extended over
-     * :: multiple lines by preceding each extra line with at least one space
-     * :: or horizontal tab (obs-fold).  This specification deprecates such
-     * :: line folding except within the message/http media type
-     * :: (Section 8.3.1).  A sender MUST NOT generate a message that includes
-     * :: line folding (i.e., that has any field-value that contains a match to
-     * :: the obs-fold rule) unless the message is intended for packaging
-     * :: within the message/http media type.
-     * ::
-     * :: A server that receives an obs-fold in a request message that is not
-     * :: within a message/http container MUST either reject the message by
-     * :: sending a 400 (Bad Request), preferably with a representation
-     * :: explaining that obsolete line folding is unacceptable, or replace
-     * :: each received obs-fold with one or more SP octets prior to
-     * :: interpreting the field value or forwarding the message downstream.
-     * ::
-     * ::
-     * :: Most HTTP header field values are defined using common syntax
-     * :: components (token, quoted-string, and comment) separated by
-     * :: whitespace or specific delimiting characters.  Delimiters are chosen
-     * :: from the set of US-ASCII visual characters not allowed in a token
-     * :: (DQUOTE and "(),/:;<=>?@[\]{}").
-     * :: 
-     * ::   token          = 1*tchar
-     * :: 
-     * ::   tchar          = "!" / "#" / "$" / "%" / "&" / "'" / "*"
-     * ::                  / "+" / "-" / "." / "^" / "_" / "`" / "|" / "~"
-     * ::                  / DIGIT / ALPHA
-     * ::                  ; any VCHAR, except delimiters
-     * :: 
-     * :: A string of text is parsed as a single value if it is quoted using
-     * :: double-quote marks.
-     * :: 
-     * ::   quoted-string  = DQUOTE *( qdtext / quoted-pair ) DQUOTE
-     * ::   qdtext         = HTAB / SP /%x21 / %x23-5B / %x5D-7E / obs-text
-     * ::   obs-text       = %x80-FF
-     * :: 
-     * :: Comments can be included in some HTTP header fields by surrounding
-     * :: the comment text with parentheses.  Comments are only allowed in
-     * :: fields containing "comment" as part of their field value definition.
-     * :: 
-     * ::   comment        = "(" *( ctext / quoted-pair / comment ) ")"
-     * ::   ctext          = HTAB / SP / %x21-27 / %x2A-5B / %x5D-7E / obs-text
-     * :: 
-     * :: The backslash octet ("\") can be used as a single-octet quoting
-     * :: mechanism within quoted-string and comment constructs.  Recipients
-     * :: that process the value of a quoted-string MUST handle a quoted-pair
-     * :: as if it were replaced by the octet following the backslash.
-     * :: 
-     * ::   quoted-pair    = "\" ( HTAB / SP / VCHAR / obs-text )
-     * :: 
-     * :: A sender SHOULD NOT generate a quoted-pair in a quoted-string except
-     * :: where necessary to quote DQUOTE and backslash octets occurring within
-     * :: that string.  A sender SHOULD NOT generate a quoted-pair in a comment
-     * :: except where necessary to quote parentheses ["(" and ")"] and
-     * :: backslash octets occurring within that comment.
-     * ::
-     * ::
-     * :: HTTP does not place a predefined limit on the length of each header
-     * :: field or on the length of the header section as a whole, as described
-     * :: in Section 2.5.  Various ad hoc limitations on individual header
-     * :: field length are found in practice, often depending on the specific
-     * :: field semantics.
-     * ::
-     * :: A server that receives a request header field, or set of fields,
-     * :: larger than it wishes to process MUST respond with an appropriate 4xx
-     * :: (Client Error) status code.  Ignoring such header fields would
-     * :: increase the server's vulnerability to request smuggling attacks
-     * :: (Section 9.5).
-     *
-     * NOTE
-     * Are VCHAR characters lying in range 0x21 - 0x7E? Look at RFC 5234.
-     * Except (DQUOTE and "(),/:;<=>?@[\]{}")
-     *
-     * :::: RFC 2616
-     * :: Request       = Request-Line              ; Section 5.1
-     * ::                 *(( general-header        ; Section 4.5
-     * ::                  | request-header         ; Section 5.3
-     * ::                  | entity-header ) CRLF)  ; Section 7.1
-     * ::
-     * :: general-header = Cache-Control     ; Section 14.9
-     * ::         | Connection               ; Section 14.10
-     * ::         | Date                     ; Section 14.18
-     * ::         | Pragma                   ; Section 14.32
-     * ::         | Trailer                  ; Section 14.40
-     * ::         | Transfer-Encoding        ; Section 14.41
-     * ::         | Upgrade                  ; Section 14.42
-     * ::         | Via                      ; Section 14.45
-     * ::         | Warning                  ; Section 14.46
-     * ::
-     * ::
-     * :: request-header = Accept                   ; Section 14.1
-     * ::                | Accept-Charset           ; Section 14.2
-     * ::                | Accept-Encoding          ; Section 14.3
-     * ::                | Accept-Language          ; Section 14.4
-     * ::                | Authorization            ; Section 14.8
-     * ::                | Expect                   ; Section 14.20
-     * ::                | From                     ; Section 14.22
-     * ::                | Host                     ; Section 14.23
-     * ::                | If-Match                 ; Section 14.24
-     * ::                | If-Modified-Since        ; Section 14.25
-     * ::                | If-None-Match            ; Section 14.26
-     * ::                | If-Range                 ; Section 14.27
-     * ::                | If-Unmodified-Since      ; Section 14.28
-     * ::                | Max-Forwards             ; Section 14.31
-     * ::                | Proxy-Authorization      ; Section 14.34
-     * ::                | Range                    ; Section 14.35
-     * ::                | Referer                  ; Section 14.36
-     * ::                | TE                       ; Section 14.39
-     * ::                | User-Agent               ; Section 14.43
-     * ::
-     * ::
-     * :: entity-header  = Allow                    ; Section 14.7
-     * ::                | Content-Encoding         ; Section 14.11
-     * ::                | Content-Language         ; Section 14.12
-     * ::                | Content-Length           ; Section 14.13
-     * ::                | Content-Location         ; Section 14.14
-     * ::                | Content-MD5              ; Section 14.15
-     * ::                | Content-Range            ; Section 14.16
-     * ::                | Content-Type             ; Section 14.17
-     * ::                | Expires                  ; Section 14.21
-     * ::                | Last-Modified            ; Section 14.29
-     * ::                | extension-header
-     * ::
-     * :: extension-header = message-header
-     * ::
-     * :: The extension-header mechanism allows additional entity-header fields
-     * :: to be defined without changing the protocol, but these fields cannot
-     * :: be assumed to be recognizable by the recipient. Unrecognized header
-     * :: fields SHOULD be ignored by the recipient and MUST be forwarded by
-     * :: transparent proxies.
-     */
-
-    /* Get header fields. */
-    while (1)
-    {
-        /*
-         * Field-name.
-         */
-        if (!(tval = TOKEN_GET(TOKEN_TYPE_TCHARS)))
-        {
-            DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"Field-name\" missing");
-            error = HTTP_400_BAD_REQUEST;
-            goto error;
-        }
-#if (1 && (defined DEBUG_THIS))
-        DEBUG_CLIENT(DLEVEL_NOISE, "Field-name: %.*s", tlen, tval);
-#endif
-        lclientSetGlobalValL(client->luaState, LSTATE_GLOBAL_VAR_FIELD_NAME, tval, tlen);
-        tokenDrop(token);
-
-        /* Colon. */
-        if (!TOKEN_GET(TOKEN_TYPE_COLON))
-        {
-            DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Colon missing after \"Field-name\"");
-            error = HTTP_400_BAD_REQUEST;
-            goto error;
-        }
-        tokenDrop(token);
-        /* OWS. */
-        if (TOKEN_GET(TOKEN_TYPE_OWS))
-            tokenDrop(token);
-
-        /* field-value. */
-        error = _parseHeaderValue(client);
-        if (error < 0 || error != HTTP_200_OK)
-        {
-            error = HTTP_400_BAD_REQUEST;
-            goto error;
-        }
-
-        /* OWS. */
-        if (TOKEN_GET(TOKEN_TYPE_OWS))
-            tokenDrop(token);
-        /* CRLF. */
-        if (!TOKEN_GET(TOKEN_TYPE_CRLF))
-        {
-            DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) CRLF missing at end of field-value");
-            error = HTTP_400_BAD_REQUEST;
-            goto error;
-        }
-        tokenDrop(token);
-        /* End of headers. */
-        if (TOKEN_GET(TOKEN_TYPE_CRLF))
-        {
-            tokenDrop(token);
-            break;
-        }
-    }
-
-    return HTTP_200_OK;
-error:
-    return error;
-}
-/*
- *
- */
-static int _parseHeaderValue(struct client_t *client)
-{
-    struct token_t *token = &client->token;
-    char *tval;
-    int tlen;
-    int eof;
-
-#define _FNAME       LSTATE_GLOBAL_VAR_FIELD_NAME
-#define _FNAME_CMP   LSTATE_GLOBAL_VAR_FIELD_NAME_CMP
-#define _FVALUE      LSTATE_GLOBAL_VAR_FIELD_VALUE
-#define _FVALUE_CMP  LSTATE_GLOBAL_VAR_FIELD_VALUE_CMP
-
-#define _CMP_CASE    LSTATE_COMPARE_CASE
-#define _CMP_NO_CASE LSTATE_COMPARE_NOCASE
-#define _CMP_LUA     LSTATE_COMPARE_LUA_EQUAL
-
-    do {
-        lclientSetGlobalVal(client->luaState, _FNAME_CMP, "Connection");
-        if (lclientCompareGlobalVals(client->luaState, _FNAME, _FNAME_CMP, _CMP_NO_CASE))
-        {
+                TOKEN_DROP();
+                STATE(HTTP_STATE_FIELD_NAME);
+                break;
             /*
              * :::: RFC 7230
-             * ::   Connection        = 1#connection-option
-             * ::   connection-option = token
+             * :: Each header field consists of a case-insensitive field name followed
+             * :: by a colon (":"), optional leading whitespace, the field value, and
+             * :: optional trailing whitespace.    
+             *
+             * :: header-field   = field-name ":" OWS field-value OWS
+             * :: field-name     = token
+             * :: field-value    = *( field-content / obs-fold )
+             * :: field-content  = field-vchar [ 1*( SP / HTAB ) field-vchar ]
+             * :: field-vchar    = VCHAR / obs-text
+             * ::
+             * :: obs-fold       = CRLF 1*( SP / HTAB )
+             * ::                ; obsolete line folding
+             * ::                ; see Section 3.2.4
+             * ::
+             * :: BWS = OWS             ; "bad" whitespace
+             * :: OWS = *( SP / HTAB )  ; optional whitespace
+             * :: RWS = 1*( SP / HTAB ) ; required whitespace
              * ::
-             * :: Connection options are case-insensitive.
+             * :: No whitespace is allowed between the header field-name and colon.  In
+             * :: the past, differences in the handling of such whitespace have led to
+             * :: security vulnerabilities in request routing and response handling.  A
+             * :: server MUST reject any received request message that contains
+             * :: whitespace between a header field-name and colon with a response code
+             * :: of 400 (Bad Request).  A proxy MUST remove any such whitespace from a
+             * :: response message before forwarding the message downstream.
+             * ::
+             * :: A field value might be preceded and/or followed by optional
+             * :: whitespace (OWS); a single SP preceding the field-value is preferred
+             * :: for consistent readability by humans.  The field value does not
+             * :: include any leading or trailing whitespace: OWS occurring before the
+             * :: first non-whitespace octet of the field value or after the last
+             * :: non-whitespace octet of the field value ought to be excluded by
+             * :: parsers when extracting the field value from a header field.
+             * ::
+             * :: Historically, HTTP header field values could be extended over
+             * :: multiple lines by preceding each extra line with at least one space
+             * :: or horizontal tab (obs-fold).  This specification deprecates such
+             * :: line folding except within the message/http media type
+             * :: (Section 8.3.1).  A sender MUST NOT generate a message that includes
+             * :: line folding (i.e., that has any field-value that contains a match to
+             * :: the obs-fold rule) unless the message is intended for packaging
+             * :: within the message/http media type.
+             * ::
+             * :: A server that receives an obs-fold in a request message that is not
+             * :: within a message/http container MUST either reject the message by
+             * :: sending a 400 (Bad Request), preferably with a representation
+             * :: explaining that obsolete line folding is unacceptable, or replace
+             * :: each received obs-fold with one or more SP octets prior to
+             * :: interpreting the field value or forwarding the message downstream.
+             * ::
+             * ::
+             * :: Most HTTP header field values are defined using common syntax
+             * :: components (token, quoted-string, and comment) separated by
+             * :: whitespace or specific delimiting characters.  Delimiters are chosen
+             * :: from the set of US-ASCII visual characters not allowed in a token
+             * :: (DQUOTE and "(),/:;<=>?@[\]{}").
+             * :: 
+             * ::   token          = 1*tchar
+             * :: 
+             * ::   tchar          = "!" / "#" / "$" / "%" / "&" / "'" / "*"
+             * ::                  / "+" / "-" / "." / "^" / "_" / "`" / "|" / "~"
+             * ::                  / DIGIT / ALPHA
+             * ::                  ; any VCHAR, except delimiters
+             * :: 
+             * :: A string of text is parsed as a single value if it is quoted using
+             * :: double-quote marks.
+             * :: 
+             * ::   quoted-string  = DQUOTE *( qdtext / quoted-pair ) DQUOTE
+             * ::   qdtext         = HTAB / SP /%x21 / %x23-5B / %x5D-7E / obs-text
+             * ::   obs-text       = %x80-FF
+             * :: 
+             * :: Comments can be included in some HTTP header fields by surrounding
+             * :: the comment text with parentheses.  Comments are only allowed in
+             * :: fields containing "comment" as part of their field value definition.
+             * :: 
+             * ::   comment        = "(" *( ctext / quoted-pair / comment ) ")"
+             * ::   ctext          = HTAB / SP / %x21-27 / %x2A-5B / %x5D-7E / obs-text
+             * :: 
+             * :: The backslash octet ("\") can be used as a single-octet quoting
+             * :: mechanism within quoted-string and comment constructs.  Recipients
+             * :: that process the value of a quoted-string MUST handle a quoted-pair
+             * :: as if it were replaced by the octet following the backslash.
+             * :: 
+             * ::   quoted-pair    = "\" ( HTAB / SP / VCHAR / obs-text )
+             * :: 
+             * :: A sender SHOULD NOT generate a quoted-pair in a quoted-string except
+             * :: where necessary to quote DQUOTE and backslash octets occurring within
+             * :: that string.  A sender SHOULD NOT generate a quoted-pair in a comment
+             * :: except where necessary to quote parentheses ["(" and ")"] and
+             * :: backslash octets occurring within that comment.
+             * ::
+             * ::
+             * :: HTTP does not place a predefined limit on the length of each header
+             * :: field or on the length of the header section as a whole, as described
+             * :: in Section 2.5.  Various ad hoc limitations on individual header
+             * :: field length are found in practice, often depending on the specific
+             * :: field semantics.
+             * ::
+             * :: A server that receives a request header field, or set of fields,
+             * :: larger than it wishes to process MUST respond with an appropriate 4xx
+             * :: (Client Error) status code.  Ignoring such header fields would
+             * :: increase the server's vulnerability to request smuggling attacks
+             * :: (Section 9.5).
+             *
+             * NOTE
+             * Are VCHAR characters lying in range 0x21 - 0x7E? Look at RFC 5234.
+             * Except (DQUOTE and "(),/:;<=>?@[\]{}")
              *
-             * Possible values are "close", "keep-alive".
-             */
-
-            /* 
-             * TODO
-             * Valid parsing of field-values.
-             * At this time only simple TOKEN_TYPE_ANY_NOT_CRLF parser used.
-             */
-            if (!(tval = TOKEN_GET(TOKEN_TYPE_ANY_NOT_CRLF)))
-            {
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Empty \"Connection\" value");
-                return HTTP_400_BAD_REQUEST;
-            }
-#define _KEEP_ALIVE "keep-alive"
-            if (http_Strnstr(tval, tlen, _KEEP_ALIVE, strlen(_KEEP_ALIVE)) != NULL)
-            {
-                client->request.keepAlive = 1;
-                lclientSetRequestField(client->luaState, "keepAlive", "true");
-            }
-            tokenDrop(token);
-            break;
-        }
-        lclientSetGlobalVal(client->luaState, _FNAME_CMP, "Content-Length");
-        if (lclientCompareGlobalVals(client->luaState, _FNAME, _FNAME_CMP, _CMP_NO_CASE))
-        {
-            int64_t contentLength;
-            /*
              * :::: RFC 2616
-             * :: Content-Length    = "Content-Length" ":" 1*DIGIT
-             */
-            if (!(tval = TOKEN_GET(TOKEN_TYPE_DIGIT)))
-            {
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Empty \"Content-Length\" value");
-                return HTTP_400_BAD_REQUEST;
-            }
-            if (commonString2Number(tval, tlen, &contentLength) < 0)
-            {
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Invalid \"Content-Length\" value");
-                return HTTP_400_BAD_REQUEST;
-            }
-            tokenDrop(token);
-            lclientSetRequestFieldNum(client->luaState, "contentLength", contentLength);
-            break;
-        }
-        lclientSetGlobalVal(client->luaState, _FNAME_CMP, "Content-Type");
-        if (lclientCompareGlobalVals(client->luaState, _FNAME, _FNAME_CMP, _CMP_NO_CASE))
-        {
-            /*
-             * Content-Type value.
+             * :: Request       = Request-Line              ; Section 5.1
+             * ::                 *(( general-header        ; Section 4.5
+             * ::                  | request-header         ; Section 5.3
+             * ::                  | entity-header ) CRLF)  ; Section 7.1
+             * ::
+             * :: general-header = Cache-Control     ; Section 14.9
+             * ::         | Connection               ; Section 14.10
+             * ::         | Date                     ; Section 14.18
+             * ::         | Pragma                   ; Section 14.32
+             * ::         | Trailer                  ; Section 14.40
+             * ::         | Transfer-Encoding        ; Section 14.41
+             * ::         | Upgrade                  ; Section 14.42
+             * ::         | Via                      ; Section 14.45
+             * ::         | Warning                  ; Section 14.46
+             * ::
+             * ::
+             * :: request-header = Accept                   ; Section 14.1
+             * ::                | Accept-Charset           ; Section 14.2
+             * ::                | Accept-Encoding          ; Section 14.3
+             * ::                | Accept-Language          ; Section 14.4
+             * ::                | Authorization            ; Section 14.8
+             * ::                | Expect                   ; Section 14.20
+             * ::                | From                     ; Section 14.22
+             * ::                | Host                     ; Section 14.23
+             * ::                | If-Match                 ; Section 14.24
+             * ::                | If-Modified-Since        ; Section 14.25
+             * ::                | If-None-Match            ; Section 14.26
+             * ::                | If-Range                 ; Section 14.27
+             * ::                | If-Unmodified-Since      ; Section 14.28
+             * ::                | Max-Forwards             ; Section 14.31
+             * ::                | Proxy-Authorization      ; Section 14.34
+             * ::                | Range                    ; Section 14.35
+             * ::                | Referer                  ; Section 14.36
+             * ::                | TE                       ; Section 14.39
+             * ::                | User-Agent               ; Section 14.43
+             * ::
+             * ::
+             * :: entity-header  = Allow                    ; Section 14.7
+             * ::                | Content-Encoding         ; Section 14.11
+             * ::                | Content-Language         ; Section 14.12
+             * ::                | Content-Length           ; Section 14.13
+             * ::                | Content-Location         ; Section 14.14
+             * ::                | Content-MD5              ; Section 14.15
+             * ::                | Content-Range            ; Section 14.16
+             * ::                | Content-Type             ; Section 14.17
+             * ::                | Expires                  ; Section 14.21
+             * ::                | Last-Modified            ; Section 14.29
+             * ::                | extension-header
+             * ::
+             * :: extension-header = message-header
+             * ::
+             * :: The extension-header mechanism allows additional entity-header fields
+             * :: to be defined without changing the protocol, but these fields cannot
+             * :: be assumed to be recognizable by the recipient. Unrecognized header
+             * :: fields SHOULD be ignored by the recipient and MUST be forwarded by
+             * :: transparent proxies.
              */
-            if (!(tval = TOKEN_GET(TOKEN_TYPE_TCHARS)))
-            {
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"Content-Type\" value 1 missing");
-                return HTTP_400_BAD_REQUEST;
-            }
-            lclientSetRequestFieldL(client->luaState, "contentType", tval, tlen);
-            if (strncasecmp(tval, "multipart", tlen) == 0)
-            {
-                tokenDrop(token);
-                if (!TOKEN_GET(TOKEN_TYPE_FSLASH))
+            case HTTP_STATE_FIELD_NAME:
+                TOKEN_MATCH(TOKEN_TYPE_TCHARS);
+                if (!tlen)
                 {
-                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No \"/\" character in \"Content-Type\" separator");
-                    return HTTP_400_BAD_REQUEST;
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"Field-name\" missing");
+                    goto bad_request;
+                }
+#if (1 && (defined DEBUG_THIS))
+                DEBUG_CLIENT(DLEVEL_NOISE, "Field-name: %.*s", tlen, tval);
+#endif
+                id = headerId(tval, tlen);
+                /*
+                 * NOTE Fields parsed in HTTP_STATE_FIELD_VALUE are passed
+                 * to request fields, others are remembered in header index.
+                 */
+                if (id != HEADER_CONNECTION && id != HEADER_CONTENT_LENGTH && id != HEADER_CONTENT_TYPE &&
+                        headerAdd(headers, id, tval, tlen) < 0)
+                {
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Too many header fields");
+                    goto bad_request;
                 }
-                lclientAppendRequestField(client->luaState, "contentType", "/");
-                tokenDrop(token);
-                if (!(tval = TOKEN_GET(TOKEN_TYPE_TCHARS)))
+                client->parser.id = id;
+                TOKEN_DROP();
+                STATE(HTTP_STATE_FIELD_COLON);
+                break;
+            case HTTP_STATE_FIELD_COLON:
+                TOKEN_MATCH(TOKEN_TYPE_COLON);
+                if (!tlen)
                 {
-                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"Content-Type\" value 2 missing");
-                    return HTTP_400_BAD_REQUEST;
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Colon missing after \"Field-name\"");
+                    goto bad_request;
                 }
-                if (strncasecmp(tval, "form-data", tlen) == 0)
+                TOKEN_DROP();
+                STATE(HTTP_STATE_FIELD_OWS);
+                break;
+            case HTTP_STATE_FIELD_OWS:
+                TOKEN_MATCH(TOKEN_TYPE_OWS);
+                TOKEN_DROP();
+                STATE(HTTP_STATE_FIELD_VALUE);
+                break;
+            case HTTP_STATE_FIELD_VALUE:
+                id = client->parser.id;
+                if (id == HEADER_CONNECTION)
                 {
-                    lclientAppendRequestFieldL(client->luaState, "contentType", tval, tlen);
-                    tokenDrop(token);
-                    if (!TOKEN_GET(TOKEN_TYPE_SEMICOLON))
+                    /*
+                     * :::: RFC 7230
+                     * ::   Connection        = 1#connection-option
+                     * ::   connection-option = token
+                     * ::
+                     * :: Connection options are case-insensitive.
+                     *
+                     * Possible values are "close", "keep-alive".
+                     */
+
+                    /* 
+                     * TODO
+                     * Valid parsing of field-values.
+                     * At this time only simple TOKEN_TYPE_ANY_NOT_CRLF parser used.
+                     */
+                    TOKEN_MATCH(TOKEN_TYPE_ANY_NOT_CRLF);
+                    if (!tlen)
                     {
-                        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \";\" missing after multipart/form-data");
-                        return HTTP_400_BAD_REQUEST;
+                        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Empty \"Connection\" value");
+                        goto bad_request;
                     }
-                    tokenDrop(token);
-                    if (TOKEN_GET(TOKEN_TYPE_OWS))
-                        tokenDrop(token);
-                    if (!(tval = TOKEN_GET(TOKEN_TYPE_TCHARS)) || strncmp(tval, "boundary", tlen) != 0)
+                    if (http_HasOption(tval, tlen, "close"))
+                        client->request.keepAlive = 0;
+                    else if (http_HasOption(tval, tlen, "keep-alive"))
+                        client->request.keepAlive = http_Persistent(client);
+                    TOKEN_DROP();
+                    STATE(HTTP_STATE_VALUE_OWS);
+                    break;
+                }
+                if (id == HEADER_CONTENT_LENGTH)
+                {
+                    /*
+                     * :::: RFC 2616
+                     * :: Content-Length    = "Content-Length" ":" 1*DIGIT
+                     */
+                    TOKEN_MATCH(TOKEN_TYPE_DIGIT);
+                    if (!tlen)
                     {
-                        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"boundary\" missing for multipart/form-data");
-                        return HTTP_400_BAD_REQUEST;
+                        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Empty \"Content-Length\" value");
+                        goto bad_request;
                     }
-                    tokenDrop(token);
-                    if (!TOKEN_GET(TOKEN_TYPE_EQUAL))
+                    if (commonString2Number(tval, tlen, &number) < 0)
                     {
-                        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"=\" missing after boundary");
-                        return HTTP_400_BAD_REQUEST;
+                        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Invalid \"Content-Length\" value");
+                        goto bad_request;
                     }
-                    tokenDrop(token);
+                    client->request.contentLength = number;
+                    TOKEN_DROP();
+                    STATE(HTTP_STATE_VALUE_OWS);
+                    break;
+                }
+                if (id == HEADER_CONTENT_TYPE)
+                {
                     /*
-                     * boundary := 0*69<bchars> bcharsnospace
-                     *
-                     * bchars := bcharsnospace / " "
-                     *
-                     * bcharsnospace := DIGIT / ALPHA / "'" / "(" / ")" /
-                     *                  "+" / "_" / "," / "-" / "." /
-                     *                  "/" / ":" / "=" / "?"
+                     * Content-Type value.
                      */
-                    if (!(tval = TOKEN_GET(TOKEN_TYPE_BOUNDARY)))
+                    TOKEN_MATCH(TOKEN_TYPE_TCHARS);
+                    if (!tlen)
                     {
-                        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) invalid \"boundary\"");
-                        return HTTP_400_BAD_REQUEST;
+                        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"Content-Type\" value 1 missing");
+                        goto bad_request;
                     }
-                    lclientSetRequestFieldL(client->luaState, "boundary", tval, tlen);
-                    tokenDrop(token);
+                    if (headerSetString(headers, HEADER_STRING_CONTENT_TYPE, tval, tlen) < 0)
+                        goto bad_request;
+                    if (strncasecmp(tval, "multipart", tlen) == 0)
+                        STATE(HTTP_STATE_MULTIPART_FSLASH);
+                    else
+                        STATE(HTTP_STATE_CONTENT_TYPE_FSLASH);
+                    TOKEN_DROP();
                     break;
                 }
-                break;
-            } else {
-                tokenDrop(token);
-                if (!TOKEN_GET(TOKEN_TYPE_FSLASH))
+                TOKEN_MATCH(TOKEN_TYPE_ANY_NOT_CRLF);
+                if (!tlen)
                 {
-                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No \"/\" character in \"Content-Type\" separator");
-                    return HTTP_400_BAD_REQUEST;
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Empty value");
+                    goto bad_request;
                 }
-                lclientAppendRequestField(client->luaState, "contentType", "/");
-                tokenDrop(token);
-                if (!(tval = TOKEN_GET(TOKEN_TYPE_TCHARS)))
+                /* NOTE Value is matched up to CRLF, trailing OWS is not part of it. */
+                while (tval[tlen - 1] == ' ' || tval[tlen - 1] == '\t')
+                    tlen--;
+                if (headerSetValue(headers, tval, tlen) < 0)
                 {
-                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"Content-Type\" value 2 missing");
-                    return HTTP_400_BAD_REQUEST;
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Header fields too large");
+                    goto bad_request;
                 }
-                lclientAppendRequestFieldL(client->luaState, "contentType", tval, tlen);
-                tokenDrop(token);
-                /* Skip any trailing data */
-                if (TOKEN_GET(TOKEN_TYPE_ANY_NOT_CRLF))
-                    tokenDrop(token);
-                break;
-            }
-            tokenDrop(token);
-        }
-#if 0
-        lclientSetGlobalVal(client->luaState, _FNAME_CMP, "Host");
-        if (lclientCompareGlobalVals(client->luaState, _FNAME, _FNAME_CMP, _CMP_NO_CASE))
-        {
-            /*
-             * :::: RFC 7230
-             * ::   Host = "Host" ":" host [ ":" port ] ; Section 3.2.2
-             * ::
-             */
-
-            /* 
-             * TODO
-             * Valid parsing of field-values.
-             * At this time only simple TOKEN_TYPE_ANY_NOT_CRLF parser used.
-             */
-            if (!(tval = TOKEN_GET(TOKEN_TYPE_ANY_NOT_CRLF)))
-            {
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Empty \"Host\" value");
-                return HTTP_400_BAD_REQUEST;
-            }
-            lclientSetRequestFieldL(client->luaState, "host", tval, tlen);
-            tokenDrop(token);
-            break;
-        }
-#endif
-#if 0
-        lclientSetGlobalVal(client->luaState, _FNAME_CMP, "Origin");
-        if (lclientCompareGlobalVals(client->luaState, _FNAME, _FNAME_CMP, _CMP_NO_CASE))
-        {
-            /* 
-             * TODO
-             * Valid parsing of field-values.
-             * At this time only simple TOKEN_TYPE_ANY_NOT_CRLF parser used.
-             */
-            if (!(tval = TOKEN_GET(TOKEN_TYPE_ANY_NOT_CRLF)))
-            {
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Empty \"Origin\" value");
-                return HTTP_400_BAD_REQUEST;
-            }
-            lclientSetRequestFieldL(client->luaState, "origin", tval, tlen);
-            tokenDrop(token);
-            break;
-        }
-        lclientSetGlobalVal(client->luaState, _FNAME_CMP, "Access-Control-Request-Method");
-        if (lclientCompareGlobalVals(client->luaState, _FNAME, _FNAME_CMP, _CMP_NO_CASE))
-        {
-            /* 
-             * TODO
-             * Valid parsing of field-values.
-             * At this time only simple TOKEN_TYPE_ANY_NOT_CRLF parser used.
-             */
-            if (!(tval = TOKEN_GET(TOKEN_TYPE_ANY_NOT_CRLF)))
-            {
-                DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Empty \"Origin\" value");
-                return HTTP_400_BAD_REQUEST;
-            }
-            lclientSetRequestFieldL(client->luaState, "accessControlRequestMethod", tval, tlen);
-            tokenDrop(token);
-            break;
-        }
-        /*
-         * Skip values for any unknown fields.
-         */
-        if (!(tval = TOKEN_GET(TOKEN_TYPE_ANY_NOT_CRLF)))
-        {
-            DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Empty value");
-            return HTTP_400_BAD_REQUEST;
-        }
-#else
-        if (!(tval = TOKEN_GET(TOKEN_TYPE_ANY_NOT_CRLF)))
-        {
-            DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Empty value");
-            return HTTP_400_BAD_REQUEST;
-        }
-        lclientSetGlobalValL(client->luaState, _FVALUE, tval, tlen);
-        lclientHeadersAdd(client->luaState);
-        tokenDrop(token);
-#endif
-
-    } while (0);
-    return HTTP_200_OK;
-}
-/*
- *
- * ARGS
- *     tinfo    Pointer to token info structure.
- *     ch       Input character.
- *     type     Type of token to get.
- * RETURN
- *     Return 1 if token is complete or does not appear in input stream,
- *     zero if waiting for other characters.
- */
-static int http_LexAnalyze(struct token_info_t *tinfo, char *ch, int type)
-{
-    if (ch == NULL) /* EOF */
-        return 1;
-
-#define _LOWHEX      (*ch >= 'A' && *ch <= 'F')
-#define _HIHEX       (*ch >= 'a' && *ch <= 'f')
-#define _LOWALPHA    (*ch >= 'a' && *ch <= 'z')
-#define _HIALPHA     (*ch >= 'A' && *ch <= 'Z')
-#define _DIGIT       (*ch >= '0' && *ch <= '9')
-#define _SAFE        (*ch == '$' || *ch == '-' || *ch == '_' || *ch == '.' || *ch == '+')
-#define _EXTRA       (*ch == '!' || *ch == '*' || *ch == '\''|| *ch == '(' || *ch == ')' || *ch == ',')
-#define _HEX         (_DIGIT || _HIHEX || _LOWHEX)
-
-#define _ALPHA       (_LOWALPHA || _HIALPHA)
-#define _UNRESERVED  (_ALPHA || _DIGIT || _SAFE || _EXTRA)
-#define _UCHARX      (_UNRESERVED /* NOTE no "escape" token */)
-#define _AND         (*ch == '&')
-#define _EQUAL       (*ch == '=')
-#define _PCHAR_      (_UCHARX || (*ch == ':' || *ch == '@'))
-#define _PCHARX      (_PCHAR_ || _AND || _EQUAL)
-#define _QUERY       (_PCHAR_)
-
-#define _DELIMETERS ( \
-        *ch == '(' || *ch == ')' || *ch == ',' || *ch == '/' || \
-        *ch == ':' || *ch == ';' || *ch == '<' || *ch == '=' || \
-        *ch == '>' || *ch == '?' || *ch == '@' || *ch == '[' || \
-        *ch == '\\'|| *ch == ']' || *ch == '{' || *ch == '}'    \
-)
-#define _VCHAR_EXCEPT (_DELIMETERS)
-#define _VCHAR_RANGE  (*ch >= 0x21 && *ch <= 0x7E)
-#define _VCHAR        (_VCHAR_RANGE && !_VCHAR_EXCEPT)
-
-#define _BOUNDARY ( \
-        _DIGIT || _ALPHA || \
-        *ch == '\''|| *ch == '(' || *ch == ')' || *ch == '.' || \
-        *ch == '+' || *ch == '_' || *ch == ',' || *ch == '-' || \
-        *ch == '/' || *ch == ':' || *ch == '=' || *ch == '?'    \
-)
-
-    if (tinfo->lenp == 0)
-    {
-        /*
-         * For tokens with one character.
-         */
-        char cmp; /* Character to compare with. */
-        cmp = 0; /* NOTE No possible to compare 0-terminator. */
-        switch (type)
-        {
-            case TOKEN_TYPE_SP:        cmp = ' '; break; 
-            case TOKEN_TYPE_FSLASH:    cmp = '/'; break; 
-            case TOKEN_TYPE_QUESTION:  cmp = '?'; break; 
-            case TOKEN_TYPE_AND:       cmp = '&'; break; 
-            case TOKEN_TYPE_EQUAL:     cmp = '='; break; 
-            case TOKEN_TYPE_DOT:       cmp = '.'; break; 
-            case TOKEN_TYPE_COLON:     cmp = ':'; break; 
-            case TOKEN_TYPE_SEMICOLON: cmp = ';'; break; 
-        }
-        if (cmp)
-        {
-            if (*ch == cmp)
-            {
-                tinfo->lenw++;
-                tinfo->lenp++;
-                return 1; /* Complete. */
-            } else {
-                return 1; /* Unexpected character. */
-            }
-        }
-        /*
-         * For tokens with more then one character.
-         */
-        switch (type)
-        {
-            case TOKEN_TYPE_CRLF:
-                if (*ch == '\r')
+                if (id == HEADER_TRANSFER_ENCODING)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    /*
+                     * :::: RFC 7230
+                     * ::   Transfer-Encoding = 1#transfer-coding
+                     *
+                     * Only "chunked" alone is supported, body with other
+                     * codings can not be read.
+                     */
+                    if (tlen != strlen("chunked") || strncasecmp(tval, "chunked", tlen) != 0)
+                    {
+                        DEBUG_CLIENT(DLEVEL_NOISE, "(E) Transfer coding \"%.*s\" not supported", tlen, tval);
+                        error = HTTP_501_NOT_IMPLEMENTED;
+                        goto error;
+                    }
+                    client->request.chunked = 1;
+                } else if (id == HEADER_EXPECT) {
+                    /*
+                     * :::: RFC 7231
+                     * ::   Expect  = "100-continue"
+                     */
+                    if (tlen == strlen("100-continue") && strncasecmp(tval, "100-continue", tlen) == 0)
+                        client->request.expect = 1;
                 }
+                TOKEN_DROP();
+                STATE(HTTP_STATE_VALUE_OWS);
                 break;
-#if 0
-            case TOKEN_TYPE_LWS:
-                if (*ch == '\r' || *ch == ' ' || *ch == '\t')
+            case HTTP_STATE_CONTENT_TYPE_FSLASH:
+            case HTTP_STATE_MULTIPART_FSLASH:
+                TOKEN_MATCH(TOKEN_TYPE_FSLASH);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) No \"/\" character in \"Content-Type\" separator");
+                    goto bad_request;
                 }
+                if (headerAppendString(headers, HEADER_STRING_CONTENT_TYPE, "/", 1) < 0)
+                    goto bad_request;
+                TOKEN_DROP();
+                if (client->parser.state == HTTP_STATE_MULTIPART_FSLASH)
+                    STATE(HTTP_STATE_MULTIPART_SUBTYPE);
+                else
+                    STATE(HTTP_STATE_CONTENT_TYPE_SUBTYPE);
                 break;
-#endif
-            case TOKEN_TYPE_ALPHA:
-                if (_ALPHA)
+            case HTTP_STATE_CONTENT_TYPE_SUBTYPE:
+                TOKEN_MATCH(TOKEN_TYPE_TCHARS);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"Content-Type\" value 2 missing");
+                    goto bad_request;
                 }
+                if (headerAppendString(headers, HEADER_STRING_CONTENT_TYPE, tval, tlen) < 0)
+                    goto bad_request;
+                TOKEN_DROP();
+                STATE(HTTP_STATE_CONTENT_TYPE_PARAMS);
                 break;
-            case TOKEN_TYPE_HIALPHA:
-                if (_HIALPHA)
-                {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
-                }
+            case HTTP_STATE_CONTENT_TYPE_PARAMS:
+                /* Skip any trailing data */
+                TOKEN_MATCH(TOKEN_TYPE_ANY_NOT_CRLF);
+                TOKEN_DROP();
+                STATE(HTTP_STATE_VALUE_OWS);
                 break;
-            case TOKEN_TYPE_DIGIT:
-                if (_DIGIT)
+            case HTTP_STATE_MULTIPART_SUBTYPE:
+                TOKEN_MATCH(TOKEN_TYPE_TCHARS);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"Content-Type\" value 2 missing");
+                    goto bad_request;
                 }
-                break;
-            case TOKEN_TYPE_PCHARX:
-                if (_PCHARX)
+                if (strncasecmp(tval, "form-data", tlen) == 0)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    if (headerAppendString(headers, HEADER_STRING_CONTENT_TYPE, tval, tlen) < 0)
+                        goto bad_request;
+                    STATE(HTTP_STATE_MULTIPART_SEMICOLON);
+                } else {
+                    STATE(HTTP_STATE_VALUE_OWS);
                 }
+                TOKEN_DROP();
                 break;
-            case TOKEN_TYPE_QUERY:
-                if (_QUERY)
+            case HTTP_STATE_MULTIPART_SEMICOLON:
+                TOKEN_MATCH(TOKEN_TYPE_SEMICOLON);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \";\" missing after multipart/form-data");
+                    goto bad_request;
                 }
+                TOKEN_DROP();
+                STATE(HTTP_STATE_MULTIPART_OWS);
                 break;
-            case TOKEN_TYPE_ESCAPE:
-                if (*ch == '%')
+            case HTTP_STATE_MULTIPART_OWS:
+                TOKEN_MATCH(TOKEN_TYPE_OWS);
+                TOKEN_DROP();
+                STATE(HTTP_STATE_MULTIPART_BOUNDARY_NAME);
+                break;
+            case HTTP_STATE_MULTIPART_BOUNDARY_NAME:
+                TOKEN_MATCH(TOKEN_TYPE_TCHARS);
+                if (!tlen || strncmp(tval, "boundary", tlen) != 0)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"boundary\" missing for multipart/form-data");
+                    goto bad_request;
                 }
+                TOKEN_DROP();
+                STATE(HTTP_STATE_MULTIPART_EQUAL);
                 break;
-            case TOKEN_TYPE_OWS:
-                if (*ch == ' ' || *ch == '\t')
+            case HTTP_STATE_MULTIPART_EQUAL:
+                TOKEN_MATCH(TOKEN_TYPE_EQUAL);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"=\" missing after boundary");
+                    goto bad_request;
                 }
+                TOKEN_DROP();
+                STATE(HTTP_STATE_MULTIPART_BOUNDARY);
                 break;
-            case TOKEN_TYPE_TCHARS:
-                if (_VCHAR)
+            case HTTP_STATE_MULTIPART_BOUNDARY:
+                /*
+                 * boundary := 0*69<bchars> bcharsnospace
+                 *
+                 * bchars := bcharsnospace / " "
+                 *
+                 * bcharsnospace := DIGIT / ALPHA / "'" / "(" / ")" /
+                 *                  "+" / "_" / "," / "-" / "." /
+                 *                  "/" / ":" / "=" / "?"
+                 */
+                TOKEN_MATCH(TOKEN_TYPE_BOUNDARY);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) invalid \"boundary\"");
+                    goto bad_request;
                 }
+                if (headerSetString(headers, HEADER_STRING_BOUNDARY, tval, tlen) < 0)
+                    goto bad_request;
+                TOKEN_DROP();
+                STATE(HTTP_STATE_VALUE_OWS);
                 break;
-            case TOKEN_TYPE_BOUNDARY:
-                if (_BOUNDARY)
+            case HTTP_STATE_VALUE_OWS:
+                TOKEN_MATCH(TOKEN_TYPE_OWS);
+                TOKEN_DROP();
+                STATE(HTTP_STATE_FIELD_CRLF);
+                break;
+            case HTTP_STATE_FIELD_CRLF:
+                TOKEN_MATCH(TOKEN_TYPE_CRLF);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) CRLF missing at end of field-value");
+                    goto bad_request;
                 }
+                TOKEN_DROP();
+                STATE(HTTP_STATE_HEAD_CRLF);
                 break;
-            case TOKEN_TYPE_ANY_NOT_CRLF:
-                if (*ch != '\r')
+            case HTTP_STATE_HEAD_CRLF:
+                /* End of headers, otherwise next field. */
+                TOKEN_MATCH(TOKEN_TYPE_CRLF);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    STATE(HTTP_STATE_FIELD_NAME);
+                    break;
                 }
-                break;
-        }
-    } else {
-        switch (type)
-        {
-            case TOKEN_TYPE_CRLF:
-                if (*ch == '\n')
+                TOKEN_DROP();
+                if (client->request.chunked && client->request.contentLength >= 0)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 1; /* Complete. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Both \"Transfer-Encoding\" and \"Content-Length\" given");
+                    goto bad_request;
                 }
-                break;
-#if 0
-             case TOKEN_TYPE_LWS:
-                if (tinfo->lenp == 1 && tinfo->p[0] == '\r')
+                /* NOTE Rejected before any byte of body is read. */
+                if (server.maxBody && client->request.contentLength > server.maxBody)
                 {
-                    if (*ch == '\n')
-                    {
-                        tinfo->lenw++;
-                        tinfo->lenp++;
-                        return 0; /* Wait more. */
-                    } else {
-                        tinfo->lenw++;
-                        tinfo->lenp++;
-                        return 1; /* Unexpected character. */
-                    }
-                } else {
-                    if (*ch == ' ' || *ch == '\t')
-                    {
-                        tinfo->lenw++;
-                        tinfo->lenp++;
-                        return 0; /* Wait more. */
-                    }
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Request body too large");
+                    error = HTTP_413_PAYLOAD_TOO_LARGE;
+                    goto error;
                 }
+                STATE(HTTP_STATE_DONE);
                 break;
-#endif
-            case TOKEN_TYPE_ALPHA:
-                if (_ALPHA)
+            case HTTP_STATE_DONE:
+                error = HTTP_PARSE_DONE;
+                goto done;
+        }
+    }
+more:
+    error = HTTP_PARSE_NEED_MORE;
+    goto done;
+version_error:
+    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Error in \"HTTP-Version\"");
+    goto error;
+bad_request:
+    error = HTTP_400_BAD_REQUEST;
+error:
+done:
+    *used = pos;
+    client->parser.length += pos;
+    return error;
+}
+/*
+ * Read head of next chunk of chunked request body. Chunk data is left in
+ * input buffer (or socket), its length is placed to request.contentRemain.
+ *
+ * RETURN
+ *     1 if chunk data follows, 0 if last chunk and trailer are read, -1 on
+ *     error.
+ */
+int httpReadChunk(struct client_t *client)
+{
+    int r;
+
+    client->parser.length = 0;
+    r = clientParse(client, httpParseChunk, server.bodyTimeout);
+    if (r == HTTP_PARSE_NEED_MORE)
+    {
+        DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Chunk head too large");
+        return -1;
+    }
+    if (r != HTTP_PARSE_DONE)
+        return -1;
+    return client->request.chunked ? 1 : 0;
+}
+/*
+ * Parse slice of chunked body up to start of chunk data or up to end of
+ * body. Slices are fed same way as for httpParse().
+ *
+ * ARGS
+ *     client    Client with parser state.
+ *     buf       Slice of body.
+ *     len       Length of slice.
+ *     used      Pointer where number of consumed bytes will be placed.
+ *
+ * RETURN
+ *     HTTP_PARSE_DONE if chunk data follows (request.contentRemain is set)
+ *         or if end of body reached (request.chunked is cleared).
+ *     HTTP_PARSE_NEED_MORE if next slice is needed.
+ *     HTTP error code on error.
+ */
+int httpParseChunk(struct client_t *client, char *buf, int len, int *used)
+{
+    int64_t size;
+    char *tval;
+    int tlen;
+    int error;
+    int pos;
+    int i;
+
+    pos   = 0;
+    error = -1;
+    /*
+     * :::: RFC 7230
+     * :: chunked-body   = *chunk
+     * ::                  last-chunk
+     * ::                  trailer-part
+     * ::                  CRLF
+     * ::
+     * :: chunk          = chunk-size [ chunk-ext ] CRLF
+     * ::                  chunk-data CRLF
+     * :: chunk-size     = 1*HEXDIG
+     * :: last-chunk     = 1*("0") [ chunk-ext ] CRLF
+     * ::
+     * :: chunk-ext      = *( ";" chunk-ext-name [ "=" chunk-ext-val ] )
+     * :: trailer-part   = *( header-field CRLF )
+     */
+    while (1)
+    {
+        switch (client->parser.state)
+        {
+            case HTTP_STATE_CHUNK_SIZE:
+                TOKEN_MATCH(TOKEN_TYPE_HEX);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"chunk-size\" missing");
+                    goto bad_request;
                 }
-                break;
-            case TOKEN_TYPE_HIALPHA:
-                if (_HIALPHA)
+                /* NOTE Up to 15 digits, so size can not overflow. */
+                if (tlen > 15)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) \"chunk-size\" too large");
+                    goto bad_request;
                 }
+                size = 0;
+                for (i = 0; i < tlen; i++)
+                    size = (size << 4) | _HEXVAL(tval[i]);
+                client->request.contentRemain = size;
+                TOKEN_DROP();
+                STATE(HTTP_STATE_CHUNK_EXT);
                 break;
-            case TOKEN_TYPE_DIGIT:
-                if (_DIGIT)
+            case HTTP_STATE_CHUNK_EXT:
+                /* Chunk extensions are skipped. */
+                TOKEN_MATCH(TOKEN_TYPE_ANY_NOT_CRLF);
+                if (tlen && tval[0] != ';' && tval[0] != ' ' && tval[0] != '\t')
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Invalid \"chunk-size\"");
+                    goto bad_request;
                 }
+                TOKEN_DROP();
+                STATE(HTTP_STATE_CHUNK_CRLF);
                 break;
-            case TOKEN_TYPE_PCHARX:
-                if (_PCHARX)
+            case HTTP_STATE_CHUNK_CRLF:
+                TOKEN_MATCH(TOKEN_TYPE_CRLF);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) CRLF missing after \"chunk-size\"");
+                    goto bad_request;
                 }
-                break;
-            case TOKEN_TYPE_QUERY:
-                if (_QUERY)
+                TOKEN_DROP();
+                if (client->request.contentRemain == 0)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    STATE(HTTP_STATE_TRAILER);
+                    break;
                 }
-                break;
-            case TOKEN_TYPE_ESCAPE:
-                if (_HEX && tinfo->lenp < 3 /* %xx */)
+                if (server.maxBody && client->request.contentRead + client->request.contentRemain > server.maxBody)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Request body too large");
+                    client->request.contentRemain = 0;
+                    error = HTTP_413_PAYLOAD_TOO_LARGE;
+                    goto error;
                 }
-                break;
-            case TOKEN_TYPE_OWS:
-                if (*ch == ' ' || *ch == '\t')
+                STATE(HTTP_STATE_CHUNK_DATA_CRLF);
+                error = HTTP_PARSE_DONE;
+                goto done;
+            case HTTP_STATE_CHUNK_DATA_CRLF:
+                TOKEN_MATCH(TOKEN_TYPE_CRLF);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) CRLF missing after \"chunk-data\"");
+                    goto bad_request;
                 }
+                TOKEN_DROP();
+                STATE(HTTP_STATE_CHUNK_SIZE);
                 break;
-            case TOKEN_TYPE_TCHARS:
-                if (_VCHAR)
+            case HTTP_STATE_TRAILER:
+                /* End of body, otherwise trailer field which is skipped. */
+                TOKEN_MATCH(TOKEN_TYPE_CRLF);
+                if (tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    TOKEN_DROP();
+                    client->request.chunked = 0;
+                    STATE(HTTP_STATE_DONE);
+                    break;
                 }
-                break;
-            case TOKEN_TYPE_BOUNDARY:
-                if (_BOUNDARY)
+                TOKEN_MATCH(TOKEN_TYPE_ANY_NOT_CRLF);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) Invalid \"trailer-part\"");
+                    goto bad_request;
                 }
+                TOKEN_DROP();
+                STATE(HTTP_STATE_TRAILER_CRLF);
                 break;
-            case TOKEN_TYPE_ANY_NOT_CRLF:
-                if (*ch != '\r')
+            case HTTP_STATE_TRAILER_CRLF:
+                TOKEN_MATCH(TOKEN_TYPE_CRLF);
+                if (!tlen)
                 {
-                    tinfo->lenw++;
-                    tinfo->lenp++;
-                    return 0; /* Wait more. */
+                    DEBUG_CLIENT(DLEVEL_NOISE, "%s", "(E) CRLF missing at end of trailer field");
+                    goto bad_request;
                 }
+                TOKEN_DROP();
+                STATE(HTTP_STATE_TRAILER);
                 break;
+            case HTTP_STATE_DONE:
+                error = HTTP_PARSE_DONE;
+                goto done;
+            default:
+                goto error;
         }
     }
-    return 1; /* Unexpected character or done. */
+more:
+    error = HTTP_PARSE_NEED_MORE;
+    goto done;
+bad_request:
+    error = HTTP_400_BAD_REQUEST;
+error:
+done:
+    *used = pos;
+    client->parser.length += pos;
+    return error;
 }
 /*
- * Called only if token have payload length greater then 1. 
+ * Decode "%xx" escapes and "+" (space) of query component.
+ *
+ * ARGS
+ *     dst    Destination buffer, at least "len" bytes. Can be same as src.
+ *     src    Encoded string.
+ *     len    Length of encoded string.
  *
  * RETURN
- *     If token is valid return value of 1, 0 otherwise.
+ *     Length of decoded string.
  */
-static int http_LexPostAnalyze(struct token_info_t *tinfo, int type)
+int httpDecode(char *dst, const char *src, int len)
 {
-    switch (type)
+    const char *end;
+    char *p;
+    int hi, lo;
+
+    end = src + len;
+    p   = dst;
+    while (src < end)
     {
-        case TOKEN_TYPE_CRLF:
-            if (tinfo->lenp == 2)
-                return 1;
-            break;
-#if 0
-        case TOKEN_TYPE_LWS:
-            if (tinfo->p[0] == '\r' && tinfo->lenp < 2)
-                return 0;
-            else
-                return 1;
-            break;
-#endif
-        case TOKEN_TYPE_ESCAPE:
-            if (tinfo->lenp == 3)
-                return 1;
-            break;
-#if 1
-        case TOKEN_TYPE_SP:
-        case TOKEN_TYPE_FSLASH:
-        case TOKEN_TYPE_QUESTION:
-        case TOKEN_TYPE_AND:
-        case TOKEN_TYPE_EQUAL:
-        case TOKEN_TYPE_DOT:
-        case TOKEN_TYPE_COLON:
-        case TOKEN_TYPE_SEMICOLON:
-            if (tinfo->lenp == 1)
-                return 1;
-            break;
-        case TOKEN_TYPE_ALPHA:
-        case TOKEN_TYPE_HIALPHA:
-        case TOKEN_TYPE_DIGIT:
-        case TOKEN_TYPE_PCHARX:
-        case TOKEN_TYPE_QUERY:
-        case TOKEN_TYPE_OWS:
-        case TOKEN_TYPE_TCHARS:
-        case TOKEN_TYPE_BOUNDARY:
-        case TOKEN_TYPE_ANY_NOT_CRLF:
-            return 1;
-#else
-        default:
-            return 1;
-#endif
+        if (*src == '%' && end - src >= 3 &&
+                (hi = _HEXVAL(src[1])) >= 0 && (lo = _HEXVAL(src[2])) >= 0)
+        {
+            *p++ = (char)((hi << 4) | lo);
+            src += 3;
+        } else if (*src == '+') {
+            *p++ = ' ';
+            src++;
+        } else {
+            *p++ = *src++;
+        }
     }
-
-    return 0;
+    return p - dst;
+}
+/*
+ * Connection is closed after last allowed request and when server is
+ * draining.
+ *
+ * RETURN
+ *     1 if connection may be kept alive, 0 otherwise.
+ */
+static int http_Persistent(struct client_t *client)
+{
+    if (server.maxRequests && client->nrequests >= server.maxRequests)
+        return 0;
+    if (server.draining)
+        return 0;
+    return 1;
 }
 /*
+ * Search for option in comma separated list of "Connection" field.
+ * Options are compared case-insensitively.
  *
+ * RETURN
+ *     1 if option is in list, 0 otherwise.
  */
-static char *http_Strnstr(char *haystack, size_t haystacklen, char *needle, size_t needlelen)
+static int http_HasOption(const char *value, int len, const char *option)
 {
-    char *phaystack;
-
-    if (haystack == NULL || needle == NULL || haystacklen == 0 || needlelen == 0)
-        return NULL;
+    int olen;
+    int start, end;
+    int i;
 
-    phaystack = haystack;
-    while (haystacklen >= needlelen)
+    olen = strlen(option);
+    i = 0;
+    while (i < len)
     {
-        if (*phaystack == *needle)
-        {
-            char *pneedle;
-            char *pmatched;
-            size_t nchars;
-
-            pmatched = phaystack;
-            pneedle  = needle;
-            nchars   = needlelen;
-            while (*phaystack == *pneedle)
-            {
-                if (--nchars == 0)
-                    return pmatched;
-                phaystack++;
-                pneedle++;
-            }
-            phaystack = pmatched;
-        }
-
-        phaystack++;
-        haystacklen--;
+        while (i < len && (value[i] == ',' || value[i] == ' ' || value[i] == '\t'))
+            i++;
+        start = i;
+        while (i < len && value[i] != ',')
+            i++;
+        end = i;
+        while (end > start && (value[end - 1] == ' ' || value[end - 1] == '\t'))
+            end--;
+        if (end - start == olen && strncasecmp(value + start, option, olen) == 0)
+            return 1;
     }
-
-    return NULL;
+    return 0;
 }
 
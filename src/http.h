@@ -31,7 +31,13 @@
 #include "client.h"
 
 int httpProcessRequest(struct client_t *client);
+void httpReset(struct client_t *client);
+int httpParse(struct client_t *client, char *buf, int len, int *used);
+int httpReadChunk(struct client_t *client);
+int httpParseChunk(struct client_t *client, char *buf, int len, int *used);
+int httpDecode(char *dst, const char *src, int len);
 
+#define HTTP_100_CONTINUE            100
 #define HTTP_101_SWITCHING_PROTOCOLS 101
 #define HTTP_200_OK                  200
 #define HTTP_204_NO_CONTENT          204
@@ -45,7 +51,14 @@ int httpProcessRequest(struct client_t *client);
 #define HTTP_404_NOT_FOUND           404
 #define HTTP_405_METHOD_NOT_ALLOWED  405
 #define HTTP_409_CONFLICT            409
+#define HTTP_413_PAYLOAD_TOO_LARGE   413
 #define HTTP_500_INTERNAL_SERVER_ERROR 500
+#define HTTP_501_NOT_IMPLEMENTED     501
+#define HTTP_503_SERVICE_UNAVAILABLE 503
+
+/* Return values of httpParse(), HTTP error code is returned on error. */
+#define HTTP_PARSE_DONE           0
+#define HTTP_PARSE_NEED_MORE    (-2)
 
 
 #endif
@@ -25,7 +25,15 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *
  */
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 /* */
 #include <lua.h>
 #include <lualib.h>
@@ -36,8 +44,10 @@
 #include "lclient.h"
 /* */
 #include "client.h"
+#include "clientpool.h"
 #include "debug.h"
 #include "debug.h"
+#include "header.h"
 #include "http.h"
 #include "lmromfs.h"
 #include "lserver.h"
@@ -46,8 +56,11 @@
 #include "lua/ljson.h"
 #include "lua/process.h"
 #include "lua/util.h"
+#include "mromfs.h"
+#include "response.h"
 #include "server.h"
 #include "version.h"
+#include "worker.h"
 
 #if 0
     #define DEBUG_THIS
@@ -62,8 +75,26 @@ static int lclient_ServerNewSession(lua_State *L);
 static int lclient_ServerHasSession(lua_State *L);
 static int lclient_ServerSetSessionString(lua_State *L);
 static int lclient_ServerGetSessionString(lua_State *L);
+static int lclient_ServerStats(lua_State *L);
 static int lclient_requestGetContent(lua_State *L);
+static int lclient_requestRead(lua_State *L);
+static int lclient_requestIndex(lua_State *L);
+static int lclient_RequestField(lua_State *L, struct client_t *client, const char *key);
+static void lclient_SplitPairs(lua_State *L, const char *s, int len, char sep, char *scratch);
+static int lclient_requestHeader(lua_State *L);
+static int lclient_requestHeaders(lua_State *L);
 static int lclient_responseWriteSock(lua_State *L);
+static int lclient_responseSendFile(lua_State *L);
+static int lclient_responseSendMromfs(lua_State *L);
+static int lclient_responseSend(lua_State *L);
+static int lclient_responseBegin(lua_State *L);
+static int lclient_responseWrite(lua_State *L);
+static int lclient_responseFinish(lua_State *L);
+static int lclient_ResponseEmit(struct client_t *client, const char *data, size_t len);
+static int lclient_SendHeaders(lua_State *L, int selfArg, int typeArg,
+        struct client_t *client, size_t len);
+static void lclient_ResponseHead(lua_State *L, int selfArg, struct client_t *client,
+        int code, int64_t len, struct responseHead_t *head);
 
 static struct script_t {
     const char *data;
@@ -78,16 +109,18 @@ static struct script_t {
 };
 
 /*
- * Initialize lua state on client creation.
+ * Create lua state for worker. State is initialized once and then reused
+ * for all requests processed by worker.
  *
  * Global variables:
- *     client
- *
  *     MFS_PREFIX
  *
  *     RESOURCE_DIR
+ *
+ * RETURN
+ *     Lua state on success, NULL on error.
  */
-int lclientInit0(struct client_t *client)
+lua_State *lclientNewState()
 {
     lua_State *L;
     struct script_t *script;
@@ -95,16 +128,13 @@ int lclientInit0(struct client_t *client)
     L = luaL_newstate();
     if (!L)
     {
-        DEBUG_CLIENT(DLEVEL_ERROR, "%s", "Lua state init failed");
-        return -1;
+        debugPrint(DLEVEL_ERROR, "%s", "Lua state init failed");
+        return NULL;
     }
-    client->luaState = L;
     luaL_openlibs(L);
 
     lmromfsOpenLib(L);
 
-    lua_pushlightuserdata(L, client); lua_setglobal(L, "client");
-
     lua_pushstring(L, MFS_PREFIX);
     lua_setglobal(L, "MFS_PREFIX");
 
@@ -127,7 +157,10 @@ int lclientInit0(struct client_t *client)
     lua_pushinteger(L, HTTP_404_NOT_FOUND          ); lua_setglobal(L, "HTTP_404_NOT_FOUND");
     lua_pushinteger(L, HTTP_405_METHOD_NOT_ALLOWED ); lua_setglobal(L, "HTTP_405_METHOD_NOT_ALLOWED");
     lua_pushinteger(L, HTTP_409_CONFLICT           ); lua_setglobal(L, "HTTP_409_CONFLICT");
+    lua_pushinteger(L, HTTP_413_PAYLOAD_TOO_LARGE  ); lua_setglobal(L, "HTTP_413_PAYLOAD_TOO_LARGE");
     lua_pushinteger(L, HTTP_500_INTERNAL_SERVER_ERROR); lua_setglobal(L, "HTTP_500_INTERNAL_SERVER_ERROR");
+    lua_pushinteger(L, HTTP_501_NOT_IMPLEMENTED    ); lua_setglobal(L, "HTTP_501_NOT_IMPLEMENTED");
+    lua_pushinteger(L, HTTP_503_SERVICE_UNAVAILABLE); lua_setglobal(L, "HTTP_503_SERVICE_UNAVAILABLE");
 
     lua_pushinteger(L, DLEVEL_SYS    ); lua_setglobal(L, "DLEVEL_SYS");
     lua_pushinteger(L, DLEVEL_SILENT ); lua_setglobal(L, "DLEVEL_SILENT");
@@ -199,6 +232,10 @@ int lclientInit0(struct client_t *client)
         lua_pushcfunction(L, lclient_ServerGetSessionString); /* [newtable][key][value]->TOS */
         lua_rawset(L, -3);                             /* [newtable]->TOS */
 
+        lua_pushstring(L, "stats");                 /* [newtable][key]->TOS */
+        lua_pushcfunction(L, lclient_ServerStats);  /* [newtable][key][value]->TOS */
+        lua_rawset(L, -3);                          /* [newtable]->TOS */
+
         lua_pop(L, 1); /* ->TOS */
     }
 
@@ -206,18 +243,18 @@ int lclientInit0(struct client_t *client)
     {
         if (luaL_loadbufferx(L, script->data, script->size, script->name, "b") != LUA_OK)
         {
-            DEBUG_CLIENT(DLEVEL_ERROR, "(E) Failed to load init script, \"%s\": \"%s\".",
+            debugPrint(DLEVEL_ERROR, "(E) Failed to load init script, \"%s\": \"%s\".",
                     script->name,
                     lua_tostring(L, -1));
-            lua_pop(L, 1);
-            return -1;
+            lua_close(L);
+            return NULL;
         }
         if (lua_pcall(L, 0, LUA_MULTRET, 0) != LUA_OK)
         {
-            DEBUG_CLIENT(DLEVEL_ERROR, "(E) Failed to execute init script: \"%s\".",
+            debugPrint(DLEVEL_ERROR, "(E) Failed to execute init script: \"%s\".",
                     lua_tostring(L, -1));
-            lua_pop(L, 1);
-            return -1;
+            lua_close(L);
+            return NULL;
         }     
     }
 
@@ -227,34 +264,67 @@ int lclientInit0(struct client_t *client)
     lua_getglobal(L, "Request");              /* [Request]->TOS */
     lua_pushcfunction(L, lclient_requestGetContent); /* [Request][value]->TOS */
     lua_setfield(L, -2, "getContent");        /* [Request]->TOS */
+    lua_pushcfunction(L, lclient_requestRead);       /* [Request][value]->TOS */
+    lua_setfield(L, -2, "read");              /* [Request]->TOS */
     lua_pushcfunction(L, lclient_CloseConnection);   /* [Request]->TOS */
     lua_setfield(L, -2, "closeConnection");   /* [Request]->TOS */
-    lua_pushinteger(L, client->serverPort);   /* [Request][value]->TOS */
-    lua_setfield(L, -2, "serverPort");        /* [Request]->TOS */
+    lua_pushcfunction(L, lclient_requestIndex);      /* [Request][value]->TOS */
+    lua_setfield(L, -2, "__index");           /* [Request]->TOS */
     lua_pop(L, 1);                            /* ->TOS */
+    /*
+     * Metatable of request.headers.
+     */
+    lua_newtable(L);                                /* [RequestHeaders]->TOS */
+    lua_pushcfunction(L, lclient_requestHeader);    /* [RequestHeaders][value]->TOS */
+    lua_setfield(L, -2, "__index");                 /* [RequestHeaders]->TOS */
+    lua_pushcfunction(L, lclient_requestHeaders);   /* [RequestHeaders][value]->TOS */
+    lua_setfield(L, -2, "__pairs");                 /* [RequestHeaders]->TOS */
+    lua_setglobal(L, "RequestHeaders");             /* ->TOS */
 
     /*
      * Response table.
      */
     lua_getglobal(L, "Response");             /* [response]->TOS */
+    lua_pushcfunction(L, lclient_responseSend);      /* [response][value]->TOS */
+    lua_setfield(L, -2, "send");              /* [response]->TOS */
     lua_pushcfunction(L, lclient_responseWriteSock); /* [response][value]->TOS */
     lua_setfield(L, -2, "writeSock");         /* [response]->TOS */
+    lua_pushcfunction(L, lclient_responseSendFile); /* [response][value]->TOS */
+    lua_setfield(L, -2, "sendFile");          /* [response]->TOS */
+    lua_pushcfunction(L, lclient_responseSendMromfs); /* [response][value]->TOS */
+    lua_setfield(L, -2, "sendMromfs");        /* [response]->TOS */
+    lua_pushcfunction(L, lclient_responseBegin);     /* [response][value]->TOS */
+    lua_setfield(L, -2, "begin");             /* [response]->TOS */
+    lua_pushcfunction(L, lclient_responseWrite);     /* [response][value]->TOS */
+    lua_setfield(L, -2, "write");             /* [response]->TOS */
+    lua_pushcfunction(L, lclient_responseFinish);    /* [response][value]->TOS */
+    lua_setfield(L, -2, "finish");            /* [response]->TOS */
     lua_pop(L, 1);                            /* ->TOS */
 
 #if (1 && (defined DEBUG_THIS))
     /* Stack MUST be empty (gettop return 0). */
-    DEBUG_CLIENT(DLEVEL_NOISE, "%s, stack \"%d\"",
+    debugPrint(DLEVEL_NOISE, "%s, stack \"%d\"",
             __FUNCTION__, lua_gettop(L));
 #endif
-    return 0;
+    return L;
 }
 /*
- * Initialize lua state on new request.
+ * Initialize lua state on new request. Binds worker's lua state to client.
+ *
+ * Global variables:
+ *     client
  */
 int lclientInit1(struct client_t *client)
 {
     lua_State *L = client->luaState;
 
+    lua_pushlightuserdata(L, client); lua_setglobal(L, "client");
+
+    lua_getglobal(L, "Request");              /* [Request]->TOS */
+    lua_pushinteger(L, client->serverPort);   /* [Request][value]->TOS */
+    lua_setfield(L, -2, "serverPort");        /* [Request]->TOS */
+    lua_pop(L, 1);                            /* ->TOS */
+
     if (luaL_loadbufferx(L, init1Script, sizeof(init1Script), "init1Script", "b") != LUA_OK)
     {
         DEBUG_CLIENT(DLEVEL_ERROR, "Failed to load init1 script: \"%s\".",
@@ -280,10 +350,10 @@ int lclientInit1(struct client_t *client)
 /*
  *
  */
-void lclientDestroy(struct client_t *client)
+void lclientCloseState(lua_State *L)
 {
-    if (client->luaState)
-        lua_close(client->luaState);
+    if (L)
+        lua_close(L);
 }
 /*
  * Process http request.
@@ -312,6 +382,12 @@ int lclientProcessRequest(struct client_t *client, int httpError)
         lua_pop(L, 1);
         return 0;
     }     
+    /* NOTE End of unfinished content is unknown to client. */
+    if (client->response.state == CLIENT_RESPONSE_STREAM)
+    {
+        DEBUG_CLIENT(DLEVEL_WARNING, "%s", "Streamed response is not finished");
+        return 0;
+    }
 
     return 1;
 }
@@ -360,7 +436,11 @@ static int lclient_ServerDebugPrint(lua_State *L)
 #if 0
     debugPrint(level, (char*)s);
 #else
-    DEBUG_CLIENT(level, "%s", s);
+    /* NOTE Init scripts run in pre-warmed state, before any client is assigned. */
+    if (!client)
+        debugPrint(level, "%s", s);
+    else
+        DEBUG_CLIENT(level, "%s", s);
 #endif
     return 0;
 }
@@ -396,16 +476,48 @@ static int lclient_requestGetContent(lua_State *L)
     lua_pop(L, 1);
 
     data = luaL_buffinitsize(L, &lbuf, len);
-    r = tokenGetRemainedData(&client->token, data, len);
-    n = r;
-    if (n < len)
+    n = 0;
+    r = clientReadBody(client, data, len);
+    if (r > 0)
+        n = r;
+    luaL_pushresultsize(&lbuf, n);
+
+    return 1;
+}
+/*
+ * request:read([n]). Read next part of request body, at most "n" bytes.
+ * Chunked body is decoded, so length of body need not be known.
+ *
+ * RETURN
+ *     On stack index -1 string with part of body, nil at end of body.
+ */
+static int lclient_requestRead(lua_State *L)
+{
+    struct client_t *client;
+    luaL_Buffer lbuf;
+    lua_Integer len;
+    char *data;
+    int r;
+#define _LSTATE_READ_LEN_ARG    2
+
+    len = luaL_optinteger(L, _LSTATE_READ_LEN_ARG, CLIENT_INPUT_SIZE);
+    if (len <= 0 || len > INT_MAX)
+        luaL_argerror(L, _LSTATE_READ_LEN_ARG, "out of range");
+
+    lua_getglobal(L, "client");
+    client = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    data = luaL_buffinitsize(L, &lbuf, len);
+    r = clientReadBody(client, data, len);
+    if (r < 0)
+        luaL_error(L, "read of request body failed");
+    if (r == 0)
     {
-        data += n;
-        r = (*client->getChars)(data, len - n, client);
-        if (r > 0)
-            n += r;
+        lua_pushnil(L);
+        return 1;
     }
-    luaL_pushresultsize(&lbuf, n);
+    luaL_pushresultsize(&lbuf, r);
 
     return 1;
 }
@@ -437,6 +549,493 @@ static int lclient_responseWriteSock(lua_State *L)
 
     return 0;
 }
+/*
+ * response:send(errCode, content, contentLength)
+ *
+ * Send status line, headers, content-length and optionally content. Headers
+ * and content are written with one writev().
+ *
+ * ARGS
+ *     errCode          HTTP code, HTTP_403_FORBIDDEN if nil or unknown.
+ *     content          Content string, may be nil.
+ *     contentLength    Value of content-length, length of content if nil.
+ *
+ * RETURN
+ *     true.
+ */
+static int lclient_responseSend(lua_State *L)
+{
+    struct responseHead_t head;
+    struct client_t *client;
+    struct iovec iov[2];
+    const char *content;
+    lua_Integer length;
+    size_t len, clen;
+    int code, err;
+
+#define _SEND_SELF_ARG        1
+#define _SEND_CODE_ARG        2
+#define _SEND_CONTENT_ARG     3
+#define _SEND_LENGTH_ARG      4
+    luaL_checktype(L, _SEND_SELF_ARG, LUA_TTABLE);
+    code    = (int)luaL_optinteger(L, _SEND_CODE_ARG, HTTP_403_FORBIDDEN);
+    content = luaL_optlstring(L, _SEND_CONTENT_ARG, NULL, &clen);
+    if (!content)
+        clen = 0;
+    length = luaL_optinteger(L, _SEND_LENGTH_ARG, (lua_Integer)clen);
+    /* NOTE Negative length would make chunked head for unframed content. */
+    if (length < 0)
+        luaL_argerror(L, _SEND_LENGTH_ARG, "must be positive");
+    len = (size_t)length;
+
+    lua_getglobal(L, "client");
+    client = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    lclient_ResponseHead(L, _SEND_SELF_ARG, client, code, len, &head);
+    if (head.error)
+    {
+        responseHeadFree(&head);
+        luaL_error(L, "not enough memory for headers");
+    }
+
+    iov[0].iov_base = head.buf;
+    iov[0].iov_len  = head.len;
+    iov[1].iov_base = (void *)content;
+    iov[1].iov_len  = clen;
+    err = clientSendCharsv(client, iov, 2);
+    responseHeadFree(&head);
+    if (err < 0)
+        luaL_error(L, "write to socket failed");
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+/*
+ * response:begin(errCode, contentLength)
+ *
+ * Send status line and headers of streamed response. Content is written
+ * with response:write() and ended with response:finish(). Content is
+ * collected in buffer of CLIENT_OUTPUT_SEGMENT_SIZE bytes, which is
+ * written as one chunk when full, so memory used does not depend on
+ * length of content.
+ *
+ * ARGS
+ *     errCode          HTTP code, HTTP_200_OK if nil.
+ *     contentLength    Length of content, content is chunked if nil.
+ *
+ * RETURN
+ *     true.
+ */
+static int lclient_responseBegin(lua_State *L)
+{
+    struct responseHead_t head;
+    struct client_t *client;
+    lua_Integer len;
+    int code, err;
+
+#define _BEGIN_SELF_ARG        1
+#define _BEGIN_CODE_ARG        2
+#define _BEGIN_LENGTH_ARG      3
+    luaL_checktype(L, _BEGIN_SELF_ARG, LUA_TTABLE);
+    code = (int)luaL_optinteger(L, _BEGIN_CODE_ARG, HTTP_200_OK);
+    len  = luaL_optinteger(L, _BEGIN_LENGTH_ARG, -1);
+    if (len < -1)
+        luaL_argerror(L, _BEGIN_LENGTH_ARG, "must be positive");
+
+    lua_getglobal(L, "client");
+    client = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    if (client->response.state != CLIENT_RESPONSE_NONE)
+        luaL_error(L, "response is streamed already");
+    if (!client->response.buf)
+    {
+        client->response.buf = malloc(CLIENT_OUTPUT_SEGMENT_SIZE);
+        if (!client->response.buf)
+            luaL_error(L, "not enough memory for content");
+    }
+
+    lclient_ResponseHead(L, _BEGIN_SELF_ARG, client, code, len, &head);
+    if (head.error)
+    {
+        responseHeadFree(&head);
+        luaL_error(L, "not enough memory for headers");
+    }
+    err = clientSendChars(client, head.buf, head.len);
+    responseHeadFree(&head);
+    if (err < 0)
+        luaL_error(L, "write to socket failed");
+
+    client->response.state  = CLIENT_RESPONSE_STREAM;
+    client->response.remain = len;
+    client->response.len    = 0;
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+/*
+ * response:write(data)
+ *
+ * Write part of streamed content. Data is buffered, large data is written
+ * without copy to buffer.
+ *
+ * RETURN
+ *     true.
+ */
+static int lclient_responseWrite(lua_State *L)
+{
+    struct client_t *client;
+    const char *data;
+    size_t len;
+
+#define _WRITE_SELF_ARG        1
+#define _WRITE_DATA_ARG        2
+    luaL_checktype(L, _WRITE_SELF_ARG, LUA_TTABLE);
+    data = luaL_checklstring(L, _WRITE_DATA_ARG, &len);
+
+    lua_getglobal(L, "client");
+    client = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    if (client->response.state != CLIENT_RESPONSE_STREAM)
+        luaL_error(L, "response is not begun");
+    if (client->response.remain >= 0)
+    {
+        if ((lua_Integer)len > client->response.remain)
+            luaL_error(L, "content is longer than declared");
+        client->response.remain -= len;
+    }
+
+    if (client->response.len + len > CLIENT_OUTPUT_SEGMENT_SIZE)
+    {
+        if (lclient_ResponseEmit(client, client->response.buf, client->response.len) < 0)
+            luaL_error(L, "write to socket failed");
+        client->response.len = 0;
+        if (len >= CLIENT_OUTPUT_SEGMENT_SIZE)
+        {
+            if (lclient_ResponseEmit(client, data, len) < 0)
+                luaL_error(L, "write to socket failed");
+            len = 0;
+        }
+    }
+    memcpy(client->response.buf + client->response.len, data, len);
+    client->response.len += len;
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+/*
+ * response:finish()
+ *
+ * Write rest of streamed content and last chunk.
+ *
+ * RETURN
+ *     true.
+ */
+static int lclient_responseFinish(lua_State *L)
+{
+    struct client_t *client;
+    const char *last;
+    size_t lastlen;
+    int err;
+
+#define _FINISH_SELF_ARG        1
+    luaL_checktype(L, _FINISH_SELF_ARG, LUA_TTABLE);
+
+    lua_getglobal(L, "client");
+    client = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    if (client->response.state != CLIENT_RESPONSE_STREAM)
+        luaL_error(L, "response is not begun");
+    if (client->response.remain > 0)
+        luaL_error(L, "content is shorter than declared");
+
+    clientCork(client);
+    err = lclient_ResponseEmit(client, client->response.buf, client->response.len);
+    if (err == 0 && client->response.remain < 0)
+    {
+        last = responseLastChunk(&lastlen);
+        err  = clientSendStatic(client, last, lastlen);
+    }
+    if (clientUncork(client) < 0 || err < 0)
+        luaL_error(L, "write to socket failed");
+
+    client->response.state = CLIENT_RESPONSE_DONE;
+    client->response.len   = 0;
+    free(client->response.buf);
+    client->response.buf   = NULL;
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+/*
+ * Write part of streamed content, as one chunk if content is chunked.
+ * Queued data is written out, so client receives content while it is
+ * generated.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+static int lclient_ResponseEmit(struct client_t *client, const char *data, size_t len)
+{
+    char size[RESPONSE_CHUNK_HEAD_SIZE];
+    struct iovec iov[3];
+    int err;
+
+    if (len == 0)
+        return 0;
+    if (client->response.remain >= 0)
+    {
+        err = clientSendChars(client, data, len);
+    } else {
+        iov[0].iov_base = size;
+        iov[0].iov_len  = responseChunkHead(size, len);
+        iov[1].iov_base = (void *)data;
+        iov[1].iov_len  = len;
+        iov[2].iov_base = "\r\n";
+        iov[2].iov_len  = 2;
+        err = clientSendCharsv(client, iov, 3);
+    }
+    if (err < 0 || clientFlush(client) < 0)
+        return -1;
+    return 0;
+}
+/*
+ * response:sendFile(path, contentType)
+ *
+ * Send headers and content of file. Content is written with sendfile(),
+ * it is not copied to lua.
+ *
+ * RETURN
+ *     true on success, nil and message if file can not be opened.
+ */
+static int lclient_responseSendFile(lua_State *L)
+{
+    struct client_t *client;
+    const char *path;
+    struct stat st;
+    int fd, err;
+
+#define _SEND_FILE_SELF_ARG        1
+#define _SEND_FILE_PATH_ARG        2
+#define _SEND_FILE_TYPE_ARG        3
+    luaL_checktype(L, _SEND_FILE_SELF_ARG, LUA_TTABLE);
+    path = luaL_checkstring(L, _SEND_FILE_PATH_ARG);
+
+    lua_getglobal(L, "client");
+    client = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    /* NOTE Checked before file is opened, lclient_ResponseHead() would raise it. */
+    if (client->response.state == CLIENT_RESPONSE_STREAM)
+        luaL_error(L, "response is streamed");
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "failed to open \"%s\": %s", path, strerror(errno));
+        return 2;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        lua_pushnil(L);
+        lua_pushfstring(L, "not a regular file \"%s\"", path);
+        return 2;
+    }
+
+    clientCork(client);
+    err = lclient_SendHeaders(L, _SEND_FILE_SELF_ARG, _SEND_FILE_TYPE_ARG,
+                client, (size_t)st.st_size);
+    if (err < 0 || st.st_size == 0)
+        close(fd);
+    else
+        err = clientSendFile(client, fd, 0, (size_t)st.st_size);
+    if (clientUncork(client) < 0 || err < 0)
+        luaL_error(L, "write to socket failed");
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+/*
+ * response:sendMromfs(name, contentType)
+ *
+ * Send headers and content of file from mromfs image. Content is written
+ * from image itself, together with headers in one writev().
+ *
+ * RETURN
+ *     true on success, nil and message if file not found.
+ */
+static int lclient_responseSendMromfs(lua_State *L)
+{
+    struct client_t *client;
+    struct mromfs_fd_t fd;
+    const char *name;
+    int err;
+
+#define _SEND_MROMFS_SELF_ARG        1
+#define _SEND_MROMFS_NAME_ARG        2
+#define _SEND_MROMFS_TYPE_ARG        3
+    luaL_checktype(L, _SEND_MROMFS_SELF_ARG, LUA_TTABLE);
+    name = luaL_checkstring(L, _SEND_MROMFS_NAME_ARG);
+
+    if (mromfsOpen(&server.mromfs, &fd, name) < 0)
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "no mromfs file \"%s\"", name);
+        return 2;
+    }
+
+    lua_getglobal(L, "client");
+    client = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (client->response.state == CLIENT_RESPONSE_STREAM)
+        luaL_error(L, "response is streamed");
+
+    clientCork(client);
+    err = lclient_SendHeaders(L, _SEND_MROMFS_SELF_ARG, _SEND_MROMFS_TYPE_ARG,
+                client, fd.size);
+    if (err == 0)
+        err = clientSendStatic(client, mromfsData(&fd), fd.size);
+    if (clientUncork(client) < 0 || err < 0)
+        luaL_error(L, "write to socket failed");
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+/*
+ * Set content type (if argument at index "typeArg" is given) and write
+ * headers of HTTP_200_OK response at index "selfArg". Used by senders of
+ * files, headers are queued if client is corked.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+static int lclient_SendHeaders(lua_State *L, int selfArg, int typeArg,
+        struct client_t *client, size_t len)
+{
+    struct responseHead_t head;
+    int err;
+
+    if (!lua_isnoneornil(L, typeArg))
+    {
+        lua_getfield(L, selfArg, "headers");     /* [headers]->TOS */
+        if (lua_istable(L, -1))
+        {
+            lua_pushvalue(L, typeArg);           /* [headers][type]->TOS */
+            lua_setfield(L, -2, "content-type"); /* [headers]->TOS */
+        }
+        lua_pop(L, 1);                           /* ->TOS */
+    }
+
+    lclient_ResponseHead(L, selfArg, client, HTTP_200_OK, len, &head);
+    err = head.error ? -1 : clientSendChars(client, head.buf, head.len);
+    responseHeadFree(&head);
+    return err < 0 ? -1 : 0;
+}
+/*
+ * Form status line and headers of response at index "selfArg". Fields of
+ * "headers" table are written as is, table value gives several lines with
+ * same name. Content-type, content-length (transfer-encoding if "len" is
+ * negative) and connection fields are formed by server. Raises error if
+ * streamed response is begun.
+ *
+ * NOTE head must be freed with responseHeadFree().
+ */
+static void lclient_ResponseHead(lua_State *L, int selfArg, struct client_t *client,
+        int code, int64_t len, struct responseHead_t *head)
+{
+    const char *name, *value;
+    size_t nlen, vlen;
+    char clen[32];
+    int top, hidx;
+
+    if (client->response.state == CLIENT_RESPONSE_STREAM)
+        luaL_error(L, "response is streamed");
+    responseHeadInit(head);
+    responseHeadStatus(head, code);
+
+    top = lua_gettop(L);
+    lua_getfield(L, selfArg, "headers");           /* [headers]->TOS */
+    if (!lua_istable(L, -1))
+    {
+        lua_pop(L, 1);                             /* ->TOS */
+        lua_newtable(L);                           /* [headers]->TOS */
+    }
+    hidx = lua_gettop(L);
+
+    lua_getfield(L, hidx, "date");                 /* [headers][date]->TOS */
+    if (lua_isnil(L, -1))
+        responseHeadDate(head);
+    lua_pop(L, 1);                                 /* [headers]->TOS */
+
+    lua_getfield(L, hidx, "content-type");         /* [headers][type]->TOS */
+    value = lua_tolstring(L, -1, &vlen);
+    if (!value)
+    {
+        value = "text/html; charset=utf-8";
+        vlen  = strlen(value);
+    }
+    responseHeadField(head, "content-type", 12, value, vlen);
+    lua_pop(L, 1);                                 /* [headers]->TOS */
+
+    if (len < 0)
+    {
+        responseHeadField(head, "transfer-encoding", 17, "chunked", 7);
+    } else {
+        vlen = snprintf(clen, sizeof(clen), "%" PRId64, len);
+        responseHeadField(head, "content-length", 14, clen, vlen);
+    }
+
+    lua_pushnil(L);                                /* [headers][nil]->TOS */
+    while (lua_next(L, hidx))                      /* [headers][key][value]->TOS */
+    {
+        if (lua_type(L, -2) != LUA_TSTRING)
+        {
+            lua_pop(L, 1);                         /* [headers][key]->TOS */
+            continue;
+        }
+        name = lua_tolstring(L, -2, &nlen);
+        if (strcmp(name, "connection") == 0 || strcmp(name, "content-type") == 0)
+        {
+            lua_pop(L, 1);                         /* [headers][key]->TOS */
+            continue;
+        }
+        if (lua_istable(L, -1))
+        {
+            lua_pushnil(L);                        /* [headers][key][value][nil]->TOS */
+            while (lua_next(L, -2))                /* [headers][key][value][k][v]->TOS */
+            {
+                value = lua_tolstring(L, -1, &vlen);
+                if (value)
+                    responseHeadField(head, name, nlen, value, vlen);
+                lua_pop(L, 1);                     /* [headers][key][value][k]->TOS */
+            }
+        } else {
+            value = lua_tolstring(L, -1, &vlen);
+            if (value)
+                responseHeadField(head, name, nlen, value, vlen);
+        }
+        lua_pop(L, 1);                             /* [headers][key]->TOS */
+    }
+
+    responseHeadAppend(head, "connection: ", 12);
+    lua_getfield(L, hidx, "connection");           /* [headers][connection]->TOS */
+    value = lua_tolstring(L, -1, &vlen);
+    if (value)
+    {
+        responseHeadAppend(head, value, vlen);
+        responseHeadAppend(head, ", ", 2);
+    }
+    if (client->request.keepAlive)
+        responseHeadAppend(head, "keep-alive\r\n\r\n", 14);
+    else
+        responseHeadAppend(head, "close\r\n\r\n", 9);
+
+    lua_settop(L, top);                            /* ->TOS */
+}
 /*
  *
  */
@@ -566,194 +1165,266 @@ static int lclient_ServerGetSessionString(lua_State *L)
     return 1;
 }
 /*
+ * __index of request. Fields are made from strings of header index on
+ * first access and cached in request table, other keys are taken from
+ * metatable (Request).
  *
+ * Fields:
+ *     method, path, query, contentType, boundary    Strings.
+ *     qtable           Query split by "&" and "=", names and values decoded.
+ *     contentLength    Number.
+ *     keepAlive        "true" if connection is kept alive.
+ *     headers          Header fields, see lclient_requestHeader().
+ *     cookies          "Cookie" field split by ";" and "=".
  */
-static void lclient_SetRequestField(lua_State *L, char *field, char *value, int *vlen)
-{
-    lua_getglobal(L, "request");      /* [request]->TOS */
-    if (vlen)
-        lua_pushlstring(L, value, *vlen);  /* [request][value]->TOS */
-    else
-        lua_pushstring(L, value);  /* [request][value]->TOS */
-    lua_setfield(L, -2, field);       /* [request]->TOS */
-    lua_pop(L, 1);                    /* ->TOS */
-#if (0 && (defined DEBUG_THIS))
-    /* Stack MUST be empty (gettop return 0). */
-    debugPrint(DLEVEL_NOISE, "%s stack \"%d\" [sock %d].",
-            __FUNCTION__, lua_gettop(L), client->sock);
-#endif
-}
-void lclientSetRequestField(lua_State *L, char *field, char *value)
-{
-    lclient_SetRequestField(L, field, value, NULL);
-}
-void lclientSetRequestFieldL(lua_State *L, char *field, char *value, int vlen)
-{
-    lclient_SetRequestField(L, field, value, &vlen);
-}
-/*
- *
- */
-void lclient_AppendRequestField(lua_State *L, char *field, char *value, int *vlen)
+static int lclient_requestIndex(lua_State *L)
 {
-    lua_getglobal(L, "request");      /* [request]->TOS */
-    lua_getfield(L, -1, field);       /* [request][oldval]->TOS */
-    if (vlen)
-        lua_pushlstring(L, value, *vlen);  /* [request][oldval][newval]->TOS */
-    else
-        lua_pushstring(L, value);  /* [request][oldval][newval]->TOS */
-    lua_concat(L, 2);                 /* [request][oldval..newval]->TOS */
-    lua_setfield(L, -2, field);       /* [request]->TOS */
-    lua_pop(L, 1);                    /* ->TOS */
-#if (0 && (defined DEBUG_THIS))
-    /* Stack MUST be empty (gettop return 0). NOTE Not empty on parsing query string. */
-    debugPrint(DLEVEL_NOISE, "%s stack \"%d\" [sock %d].",
-            __FUNCTION__, lua_gettop(L), client->sock);
-#endif
-}
-void lclientAppendRequestField(lua_State *L, char *field, char *value)
-{
-    lclient_AppendRequestField(L, field, value, NULL);
-}
-void lclientAppendRequestFieldL(lua_State *L, char *field, char *value, int vlen)
-{
-    lclient_AppendRequestField(L, field, value, &vlen);
-}
-/*
- *
- */
-void lclientSetRequestFieldNum(lua_State *L, char *field, int64_t num)
-{
-    lua_getglobal(L, "request");           /* [request]->TOS */
-    lua_pushinteger(L, (lua_Integer)num);  /* [request][num]->TOS */
-    lua_setfield(L, -2, field);            /* [request]->TOS */
-    lua_pop(L, 1);                         /* ->TOS */
-#if (0 && (defined DEBUG_THIS))
-    /* Stack MUST be empty (gettop return 0). */
-    debugPrint(DLEVEL_NOISE, "%s stack \"%d\" [sock %d].",
-            __FUNCTION__, lua_gettop(L), client->sock);
-#endif
+    struct client_t *client;
+    const char *key;
+#define _REQUEST_TABLE_ARG    1
+#define _REQUEST_KEY_ARG      2
+
+    if (lua_type(L, _REQUEST_KEY_ARG) == LUA_TSTRING)
+    {
+        key = lua_tostring(L, _REQUEST_KEY_ARG);
+
+        lua_getglobal(L, "client");
+        client = lua_touserdata(L, -1);
+        lua_pop(L, 1);
+
+        if (client && client->request.headers && lclient_RequestField(L, client, key))
+        {
+            /* [value]->TOS */
+            lua_pushvalue(L, _REQUEST_KEY_ARG); /* [value][key]->TOS */
+            lua_pushvalue(L, -2);               /* [value][key][value]->TOS */
+            lua_rawset(L, _REQUEST_TABLE_ARG);  /* [value]->TOS */
+            return 1;
+        }
+    }
+
+    if (!lua_getmetatable(L, _REQUEST_TABLE_ARG)) /* [Request]->TOS */
+        return 0;
+    lua_pushvalue(L, _REQUEST_KEY_ARG);           /* [Request][key]->TOS */
+    lua_rawget(L, -2);                            /* [Request][value]->TOS */
+    return 1;
 }
 /*
+ * Push value of request field.
  *
+ * RETURN
+ *     1 if value is pushed, 0 if field is unknown or not set.
  */
-void lclientHeadersAdd(lua_State *L)
+static int lclient_RequestField(lua_State *L, struct client_t *client, const char *key)
 {
-    int t;
-
-#define _HEADERS_NAME "headers"
+    struct headerIndex_t *index;
+    int string;
+
+    index = client->request.headers;
+    string = -1;
+    if (strcmp(key, "path") == 0)
+        string = HEADER_STRING_PATH;
+    else if (strcmp(key, "method") == 0)
+        string = HEADER_STRING_METHOD;
+    else if (strcmp(key, "query") == 0)
+        string = HEADER_STRING_QUERY;
+    else if (strcmp(key, "contentType") == 0)
+        string = HEADER_STRING_CONTENT_TYPE;
+    else if (strcmp(key, "boundary") == 0)
+        string = HEADER_STRING_BOUNDARY;
+    if (string >= 0)
+    {
+        if (headerStringLen(index, string) < 0)
+            return 0;
+        lua_pushlstring(L, headerString(index, string), headerStringLen(index, string));
+        return 1;
+    }
 
-    lua_getglobal(L, "request");  /* [request]->TOS */
-    lua_pushstring(L, _HEADERS_NAME); /* [request]["headers"]->TOS */
-    t = lua_rawget(L, -2); /* [request][headers]->TOS */
-    if (t == LUA_TNIL)
+    if (strcmp(key, "headers") == 0)
     {
-        /* [request][nil]->TOS */
-        lua_pop(L, 1); /* [request]->TOS */
-        lua_newtable(L); /* [request][newtable]->TOS */
-        lua_pushstring(L, _HEADERS_NAME); /* [request][newtable]["headers"]->TOS */
-        lua_pushvalue(L, -2); /* [request][newtable]["headers"][newtable]->TOS */
-        lua_rawset(L, -4); /* [request][newtable]->TOS */
+        lua_newtable(L);                     /* [headers]->TOS */
+        lua_getglobal(L, "RequestHeaders");  /* [headers][RequestHeaders]->TOS */
+        lua_setmetatable(L, -2);             /* [headers]->TOS */
+        return 1;
     }
-    /* [request][headers]->TOS */
+    if (strcmp(key, "qtable") == 0)
+    {
+        char *scratch;
+        int len;
 
-    lua_getglobal(L, LSTATE_GLOBAL_VAR_FIELD_NAME); /* [request][headers][fieldName]->TOS */
-    lua_getglobal(L, LSTATE_GLOBAL_VAR_FIELD_VALUE); /* [request][headers][fieldName][fieldValue]->TOS */
-    lua_rawset(L, -3); /* [request][headers]->TOS */
-    lua_pop(L, 2); /* ->TOS */
+        lua_newtable(L); /* [qtable]->TOS */
+        len = headerStringLen(index, HEADER_STRING_QUERY);
+        if (len > 1)
+        {
+            /* Names and values are decoded after query. */
+            scratch = headerScratch(index, len);
+            if (!scratch)
+                luaL_error(L, "no memory for query");
+            /* NOTE Skip "?". */
+            lclient_SplitPairs(L, headerString(index, HEADER_STRING_QUERY) + 1,
+                    len - 1, '&', scratch);
+        }
+        return 1;
+    }
+    if (strcmp(key, "cookies") == 0)
+    {
+        struct header_t *field;
 
-#if (0 && (defined DEBUG_THIS))
-    debugPrint(DLEVEL_NOISE, "%s stack \"%d\".",
-            __FUNCTION__, lua_gettop(L));
-#endif
-}
-/*
- * Set temporary value in client's lua state.
- *
- */
-static void lclient_SetGlobalVal(lua_State *L, char *name, char *value, int *vlen)
-{
-    if (vlen)
-        lua_pushlstring(L, value, *vlen);  /* [value]->TOS */
-    else
-        lua_pushstring(L, value);  /* [value]->TOS */
-    lua_setglobal(L, name); /* ->TOS */
-#if (0 && (defined DEBUG_THIS))
-    /* Stack MUST be empty (gettop return 0). */
-    debugPrint(DLEVEL_NOISE, "%s stack \"%d\" [sock %d].",
-            __FUNCTION__, lua_gettop(L), client->sock);
-#endif
+        lua_newtable(L); /* [cookies]->TOS */
+        if (index->known[HEADER_COOKIE])
+        {
+            field = &index->fields[index->known[HEADER_COOKIE] - 1];
+            lclient_SplitPairs(L, headerValue(index, field), field->valueLen, ';', NULL);
+        }
+        return 1;
+    }
+    if (strcmp(key, "contentLength") == 0)
+    {
+        if (client->request.contentLength < 0)
+            return 0;
+        lua_pushinteger(L, (lua_Integer)client->request.contentLength);
+        return 1;
+    }
+    if (strcmp(key, "keepAlive") == 0)
+    {
+        if (!client->request.keepAlive)
+            return 0;
+        lua_pushstring(L, "true");
+        return 1;
+    }
+    return 0;
 }
 /*
+ * Split "name=value" pairs and set them in table on top of stack. Pairs
+ * with empty name are dropped. For cookies (separator ";") leading
+ * whitespace of name is skipped and quotes around value are removed.
  *
+ * ARGS
+ *     s          String to split.
+ *     len        Length of string.
+ *     sep        Separator of pairs.
+ *     scratch    If not NULL, names and values are decoded (see httpDecode())
+ *                to this buffer of "len" bytes.
  */
-void lclientSetGlobalVal(lua_State *L, char *name, char *value)
+static void lclient_SplitPairs(lua_State *L, const char *s, int len, char sep, char *scratch)
 {
-    lclient_SetGlobalVal(L, name, value, NULL);
+    const char *end, *name, *value;
+    int nlen, vlen;
+
+    end = s + len;
+    while (s < end)
+    {
+        if (sep == ';')
+        {
+            while (s < end && (*s == ' ' || *s == '\t'))
+                s++;
+        }
+        name = s;
+        while (s < end && *s != '=' && *s != sep)
+            s++;
+        nlen  = s - name;
+        value = s;
+        vlen  = 0;
+        if (s < end && *s == '=')
+        {
+            value = ++s;
+            /* NOTE Query value ends on next "=" too. */
+            while (s < end && *s != sep && (sep == ';' || *s != '='))
+                s++;
+            vlen = s - value;
+            if (sep == ';' && vlen >= 2 && value[0] == '"' && value[vlen - 1] == '"')
+            {
+                value++;
+                vlen -= 2;
+            }
+        }
+        if (s < end && *s == sep)
+            s++;
+        if (nlen && scratch)
+        {
+            nlen = httpDecode(scratch, name, nlen);
+            lua_pushlstring(L, scratch, nlen); /* [table][name]->TOS */
+            vlen = httpDecode(scratch, value, vlen);
+            lua_pushlstring(L, scratch, vlen); /* [table][name][value]->TOS */
+            lua_rawset(L, -3);                 /* [table]->TOS */
+        } else if (nlen) {
+            lua_pushlstring(L, name, nlen);   /* [table][name]->TOS */
+            lua_pushlstring(L, value, vlen);  /* [table][name][value]->TOS */
+            lua_rawset(L, -3);                /* [table]->TOS */
+        }
+    }
 }
 /*
+ * __index of request.headers. Field is taken from header index of request
+ * and cached in table, so lua strings are created only for fields which
+ * handler reads.
  *
+ * RETURN
+ *     Value of field, nil if request has no such field.
  */
-void lclientSetGlobalValL(lua_State *L, char *name, char *value, int vlen)
+static int lclient_requestHeader(lua_State *L)
 {
-    lclient_SetGlobalVal(L, name, value, &vlen);
+    struct client_t *client;
+    struct header_t *field;
+    const char *name;
+    size_t len;
+#define _HEADER_TABLE_ARG    1
+#define _HEADER_NAME_ARG     2
+
+    if (lua_type(L, _HEADER_NAME_ARG) != LUA_TSTRING)
+        return 0;
+    name = lua_tolstring(L, _HEADER_NAME_ARG, &len);
+
+    lua_getglobal(L, "client");
+    client = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (!client || !client->request.headers)
+        return 0;
+
+    field = headerFind(client->request.headers, name, len);
+    if (!field)
+        return 0;
+    lua_pushvalue(L, _HEADER_NAME_ARG); /* [name]->TOS */
+    lua_pushlstring(L, headerValue(client->request.headers, field),
+            field->valueLen);           /* [name][value]->TOS */
+    lua_pushvalue(L, -1);               /* [name][value][value]->TOS */
+    lua_insert(L, -3);                  /* [value][name][value]->TOS */
+    lua_rawset(L, _HEADER_TABLE_ARG);   /* [value]->TOS */
+    return 1;
 }
 /*
- * Compare two global values using different compare strategies.
+ * __pairs of request.headers. All fields are copied to table (names in
+ * lower case), then table is traversed as usual.
  *
  * RETURN
- *     1 if values are matches, 0 if values does not matches or one of
- *     value is nil.
+ *     next, table, nil
  */
-int lclientCompareGlobalVals(lua_State *L,
-        char *name1, char *name2, enum lclient_compare_type_t type)
+static int lclient_requestHeaders(lua_State *L)
 {
-    int r, ret;
+    struct client_t *client;
+    struct headerIndex_t *index;
+    struct header_t *field;
+    int i;
+#define _HEADERS_TABLE_ARG    1
 
-    ret = 0;
+    luaL_checktype(L, _HEADERS_TABLE_ARG, LUA_TTABLE);
 
-    r = lua_getglobal(L, name1); /* [val1]->TOS */
-    if (r == LUA_TNIL)
-    {
-        lua_pop(L, 1); /* ->TOS */
-        return 0;
-    }
-    r = lua_getglobal(L, name2); /* [val1][val2]->TOS */
-    if (r == LUA_TNIL)
-    {
-        lua_pop(L, 2); /* ->TOS */
-        return 0;
-    }
+    lua_getglobal(L, "client");
+    client = lua_touserdata(L, -1);
+    lua_pop(L, 1);
 
-    if (type == LSTATE_COMPARE_LUA_EQUAL)
+    index = client ? client->request.headers : NULL;
+    for (i = 0; index && i < index->nfields; i++)
     {
-        if (lua_compare(L, -1, -2, LUA_OPEQ))
-            ret = 1;
-    } else if (type == LSTATE_COMPARE_CASE || LSTATE_COMPARE_NOCASE) {
-        const char *val1;
-        const char *val2;
-
-        val1 = lua_tostring(L, -2);
-        val2 = lua_tostring(L, -1);
-        if (val1 && val2)
-        {
-            if (type == LSTATE_COMPARE_CASE)
-            {
-                if (strcmp(val1, val2) == 0)
-                    ret = 1;
-            } else if (type == LSTATE_COMPARE_NOCASE) {
-                if (strcasecmp(val1, val2) == 0)
-                    ret = 1;
-            }
-        }
+        field = &index->fields[i];
+        lua_pushlstring(L, headerName(index, field), field->nameLen);   /* [name]->TOS */
+        lua_pushlstring(L, headerValue(index, field), field->valueLen); /* [name][value]->TOS */
+        lua_rawset(L, _HEADERS_TABLE_ARG);                               /* ->TOS */
     }
-    lua_pop(L, 2); /* ->TOS */
-#if (0 && (defined DEBUG_THIS))
-    /* Stack MUST be empty (gettop return 0). */
-    debugPrint(DLEVEL_NOISE, "%s stack \"%d\" [sock %d].",
-            __FUNCTION__, lua_gettop(L), client->sock);
-#endif
-    return ret;
+
+    lua_getglobal(L, "next");              /* [next]->TOS */
+    lua_pushvalue(L, _HEADERS_TABLE_ARG);  /* [next][table]->TOS */
+    lua_pushnil(L);                        /* [next][table][nil]->TOS */
+    return 3;
 }
 //
 //#if 0
@@ -790,6 +1461,43 @@ int lclientCompareGlobalVals(lua_State *L,
 //}
 //#endif
 
+/*
+ * server.stats()
+ *
+ * RETURN
+ *     Table with load counters:
+ *         clients    Open connections.
+ *         workers    Number of workers.
+ *         busy       Workers running handler.
+ *         queued     Requests waiting for worker.
+ *         maxQueue   Limit of queued requests, 0 if not limited.
+ *         shed       Requests answered with 503 since start.
+ *         stackUsed  Deepest stack of workers, 0 if not measured (no "-S").
+ */
+static int lclient_ServerStats(lua_State *L)
+{
+    struct workerStats_t stats;
+
+    workerStats(&stats);
+
+    lua_createtable(L, 0, 7);                          /* [table]->TOS */
+    lua_pushinteger(L, clientpoolCount());             /* [table][value]->TOS */
+    lua_setfield(L, -2, "clients");                    /* [table]->TOS */
+    lua_pushinteger(L, stats.workers);                 /* [table][value]->TOS */
+    lua_setfield(L, -2, "workers");                    /* [table]->TOS */
+    lua_pushinteger(L, stats.busy);                    /* [table][value]->TOS */
+    lua_setfield(L, -2, "busy");                       /* [table]->TOS */
+    lua_pushinteger(L, stats.queued);                  /* [table][value]->TOS */
+    lua_setfield(L, -2, "queued");                     /* [table]->TOS */
+    lua_pushinteger(L, server.maxQueue);               /* [table][value]->TOS */
+    lua_setfield(L, -2, "maxQueue");                   /* [table]->TOS */
+    lua_pushinteger(L, (lua_Integer)stats.shed);       /* [table][value]->TOS */
+    lua_setfield(L, -2, "shed");                       /* [table]->TOS */
+    lua_pushinteger(L, (lua_Integer)stats.stackUsed);  /* [table][value]->TOS */
+    lua_setfield(L, -2, "stackUsed");                  /* [table]->TOS */
+
+    return 1;
+}
 /*
  *
  * ARGS
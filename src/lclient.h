@@ -33,30 +33,10 @@
 /* */
 #include "client.h"
 
-int lclientInit0(struct client_t *client);
+lua_State *lclientNewState();
 int lclientInit1(struct client_t *client);
-void lclientDestroy(struct client_t *client);
+void lclientCloseState(lua_State *L);
 int lclientProcessRequest(struct client_t *client, int httpError);
-void lclientSetRequestField(lua_State *L, char *field, char *value);
-void lclientSetRequestFieldL(lua_State *L, char *field, char *value, int vlen);
-void lclientAppendRequestField(lua_State *L, char *field, char *value);
-void lclientAppendRequestFieldL(lua_State *L, char *field, char *value, int vlen);
-void lclientSetRequestFieldNum(lua_State *L, char *field, int64_t num);
-void lclientSetGlobalVal(lua_State *L, char *name, char *value);
-void lclientSetGlobalValL(lua_State *L, char *name, char *value, int vlen);
-enum lclient_compare_type_t {
-    LSTATE_COMPARE_CASE,      /* Case-sensitive. */
-    LSTATE_COMPARE_NOCASE,    /* Ignoring case. */
-    LSTATE_COMPARE_LUA_EQUAL, /* Using lua_compare. */
-};
-int lclientCompareGlobalVals(lua_State *L,
-        char *name1, char *name2, enum lclient_compare_type_t type);
-void lclientHeadersAdd(lua_State *L);
-
-#define LSTATE_GLOBAL_VAR_FIELD_NAME      "fieldName"
-#define LSTATE_GLOBAL_VAR_FIELD_NAME_CMP  "fieldNameCmp"
-#define LSTATE_GLOBAL_VAR_FIELD_VALUE     "fieldValue"
-#define LSTATE_GLOBAL_VAR_FIELD_VALUE_CMP "fieldValueCmp"
 
 #endif
 
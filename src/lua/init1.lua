@@ -3,6 +3,7 @@
 --
 request = {}
 setmetatable(request, Request)
+-- Fields are made from request head on first access (lclient.c).
 
 response = {}
 response.headers = {}
@@ -3,16 +3,9 @@
 --
 function process()
     --
-    -- Convert request headers names to lower case.
+    -- NOTE Names of request headers are in lower case, field is looked up
+    -- ignoring case of name (lclient.c).
     --
-    if true then
-        local headers = {}
-        for k, v in pairs(request.headers) do
-            headers[tostring(k):lower()] = v
-        end
-        request.headers = headers
-    end
-    
     if httpError ~= HTTP_200_OK then
         return util.errorResponse(httpError)
     end
@@ -29,10 +22,7 @@ function process()
     --
     repeat
         local SESCOOKIE = "LSESSIONID"
-        local id
-        if request.headers["cookie"] then
-            id = string.match(request.headers["cookie"], SESCOOKIE .. "=([^;]+)")
-        end
+        local id = request.cookies[SESCOOKIE]
         if id then
             if not server.hasSession(id) then
                 util.debugPrint(DLEVEL_NOISE, "Server has not session:", id)
@@ -113,27 +113,20 @@ function util.outputFile(path, contentType, external)
     end
     response.headers["content-type"] = contentType;
 
-    local data
+    --
+    -- Content of file is sent by server, it is not read to lua.
+    --
+    local ok, msg
     if path:match(MFS_PREFIX) then
-        local CHUNK_SIZE = 256
-        local fd = mromfs.open(path:sub(#MFS_PREFIX + 1))
-
-        data = {}
-        while true do
-            local chunk = mromfs.read(fd, CHUNK_SIZE)
-            if not chunk or #chunk == 0 then
-                break
-            end
-            table.insert(data, chunk)
-        end
-        data = table.concat(data)
+        ok, msg = response:sendMromfs(path:sub(#MFS_PREFIX + 1), contentType)
     else
-        local fd = io.open(path, "rb")
-        data = fd:read("a")
-        fd:close()
+        ok, msg = response:sendFile(path, contentType)
     end
-
-    response:send(HTTP_200_OK, data)
+    if not ok then
+        util.debugPrint(DLEVEL_ERROR, "Failed to send file: ", msg)
+        return util.errorResponse(HTTP_404_NOT_FOUND)
+    end
+    return ok
 end
 ----
 --
@@ -156,22 +149,10 @@ end
 --
 function util.getInput()
     local input = {}
-    if request.contentLength then
-        local n = request.contentLength
-        while n > 0 do
-            local chunkSize = 256
-
-            if chunkSize > n then
-                chunkSize = n
-            end
-
-            local chunk = request.getContent(chunkSize)
-            if #chunk == 0 then
-                break
-            end
-            n = n - #chunk
-            table.insert(input, chunk);
-        end
+    local chunk = request:read(16384)
+    while chunk do
+        table.insert(input, chunk);
+        chunk = request:read(16384)
     end
     return table.concat(input);
 end
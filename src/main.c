@@ -28,9 +28,13 @@
 #include <stdlib.h>
 #include <string.h>
 /* */
+#include "clientpool.h"
+#include "common.h"
 #include "debug.h"
 #include "server.h"
+#include "thread.h"
 #include "version.h"
+#include "worker.h"
 
 /*
  *
@@ -53,7 +57,41 @@ static void main_printHelp()
     debugPrint(DLEVEL_SYS, "Options:");
     debugPrint(DLEVEL_SYS, "    -h          Print this help.");
     debugPrint(DLEVEL_SYS, "    -p<Port>    Bind to port. (Default is %d)", DEFAULT_PORT);
+    debugPrint(DLEVEL_SYS, "    -u=<Path>   Listen on Unix socket. TCP port is used only if \"-p\"");
+    debugPrint(DLEVEL_SYS, "                option is given too.");
     debugPrint(DLEVEL_SYS, "    -r=<Dir>    Use external resource directory.");
+    debugPrint(DLEVEL_SYS, "    -w<N>       Number of worker threads. (Default is %d)", WORKER_DEFAULT_COUNT);
+    debugPrint(DLEVEL_SYS, "    -a<N>       Open N SO_REUSEPORT listeners, each with own accept thread.");
+    debugPrint(DLEVEL_SYS, "    -Pw=<List>  Pin workers to CPUs from list (e.g. \"0-3,8\"), worker N takes");
+    debugPrint(DLEVEL_SYS, "                CPU N modulo length of list. Lua heap of worker is local to its CPU.");
+    debugPrint(DLEVEL_SYS, "    -Pa=<List>  Pin acceptors to CPUs from list, listener of acceptor gets");
+    debugPrint(DLEVEL_SYS, "                connections received on its CPU (SO_INCOMING_CPU).");
+    debugPrint(DLEVEL_SYS, "    -q<List>    Length of listen queue. (Default is %d) With \"-a\" option list", SERVER_LISTEN_QUEUE_LENGTH);
+    debugPrint(DLEVEL_SYS, "                (e.g. \"512,128\") is accepted, listener N takes entry N modulo");
+    debugPrint(DLEVEL_SYS, "                length of list.");
+    debugPrint(DLEVEL_SYS, "    -D<S>       TCP_DEFER_ACCEPT of \"-a\" listeners, acceptor is woken only when");
+    debugPrint(DLEVEL_SYS, "                request data arrives or after S seconds, 0 to disable. (Default is %d)", SERVER_DEFER_ACCEPT);
+    debugPrint(DLEVEL_SYS, "    -c<N>       Limit of simultaneous connections. (Default is %d)", CLIENTPOOL_DEFAULT_MAX);
+    debugPrint(DLEVEL_SYS, "    -Q<N>       Requests waiting for worker before 503 is returned,");
+    debugPrint(DLEVEL_SYS, "                0 if not limited. (Default is %d)", SERVER_MAX_QUEUE);
+    debugPrint(DLEVEL_SYS, "    -S<KB>      Stack size of worker and acceptor threads. (Default is system one)");
+    debugPrint(DLEVEL_SYS, "                Deepest stack of workers is printed on stop. 256 covers lua");
+    debugPrint(DLEVEL_SYS, "                scripts which reach limit of nested C calls.");
+    debugPrint(DLEVEL_SYS, "    -G<KB>      Guard size below thread stack. (Default is system one)");
+    debugPrint(DLEVEL_SYS, "    -U          Use io_uring for socket I/O of workers, if kernel supports it.");
+    debugPrint(DLEVEL_SYS, "    -o<N>       Bytes of output queued per connection before handler waits.");
+    debugPrint(DLEVEL_SYS, "                (Default is %d)", SERVER_OUTPUT_LIMIT);
+    debugPrint(DLEVEL_SYS, "    -b<N>       Bytes of request body, longer body is answered with 413,");
+    debugPrint(DLEVEL_SYS, "                0 if not limited. (Default is %d)", SERVER_MAX_BODY);
+    debugPrint(DLEVEL_SYS, "    -th<S>      Timeout of request head receive. (Default is %d)", SERVER_HEADER_TIMEOUT);
+    debugPrint(DLEVEL_SYS, "    -tb<S>      Timeout of request body receive. (Default is %d)", SERVER_BODY_TIMEOUT);
+    debugPrint(DLEVEL_SYS, "    -tw<S>      Timeout of response write. (Default is %d)", SERVER_WRITE_TIMEOUT);
+    debugPrint(DLEVEL_SYS, "    -tk<S>      Timeout of idle keep-alive connection. (Default is %d)", SERVER_IDLE_TIMEOUT);
+    debugPrint(DLEVEL_SYS, "    -td<S>      Time given to connections on graceful stop. (Default is %d)", SERVER_DRAIN_TIMEOUT);
+    debugPrint(DLEVEL_SYS, "                    Timeouts are in seconds, 0 to wait forever.");
+    debugPrint(DLEVEL_SYS, "    -k<N>       Requests per connection, 0 if not limited. (Default is %d)", SERVER_MAX_REQUESTS);
+    debugPrint(DLEVEL_SYS, "    -s=<Path>   Unix socket used on restart. (Default is \"@luno.<Port>\")");
+    debugPrint(DLEVEL_SYS, "    -i          Take listening sockets from running server.");
 #if 0
     debugPrint(DLEVEL_SYS, "    -C          Disable caching.");
 #endif
@@ -64,6 +102,12 @@ static void main_printHelp()
     debugPrint(DLEVEL_SYS, "                    3    INFO   ");
     debugPrint(DLEVEL_SYS, "                    4    NOISE  ");
     debugPrint(DLEVEL_SYS, "");
+    debugPrint(DLEVEL_SYS, "Signals:");
+    debugPrint(DLEVEL_SYS, "    SIGINT, SIGTERM    Stop.");
+    debugPrint(DLEVEL_SYS, "    SIGQUIT            Stop accepting, stop when connections finish.");
+    debugPrint(DLEVEL_SYS, "    SIGUSR2            Start new server with listening sockets of this one, then");
+    debugPrint(DLEVEL_SYS, "                       stop as on SIGQUIT.");
+    debugPrint(DLEVEL_SYS, "");
 
     exit(1);
 }
@@ -73,10 +117,13 @@ static void main_printHelp()
 int main(int argc, char **argv)
 {
     char **arg;
+    int portGiven;
 
     serverInit();
     main_printHead();
+    server.argv = argv;
 
+    portGiven = 0;
     arg = argv;
     /* Skip program name. */
     arg++;
@@ -104,11 +151,168 @@ int main(int argc, char **argv)
                 debugPrint(DLEVEL_ERROR, "Invalid value of \"-p\" option.");
                 return 1;
             }
+            portGiven = 1;
 #if 0
         } else if (strcmp("-C", *arg) == 0) {
             debugPrint(DLEVEL_INFO, "Caching is disabled");
             server.caching = 0;
 #endif
+        } else if (strlen(*arg) >= 3 && strncmp("-w", *arg, 2) == 0) {
+            char *c;
+            c = *arg + 2;
+            server.nworkers = atoi((const char*)c);
+            if (server.nworkers <= 0)
+            {
+                debugPrint(DLEVEL_ERROR, "Invalid value of \"-w\" option.");
+                return 1;
+            }
+        } else if (strlen(*arg) >= 3 && strncmp("-a", *arg, 2) == 0) {
+            char *c;
+            c = *arg + 2;
+            server.nacceptors = atoi((const char*)c);
+            if (server.nacceptors <= 0 || server.nacceptors > SERVER_MAX_ACCEPTORS)
+            {
+                debugPrint(DLEVEL_ERROR, "Invalid value of \"-a\" option.");
+                return 1;
+            }
+        } else if (strlen(*arg) >= 3 && strncmp("-q", *arg, 2) == 0) {
+            char *c;
+            c = *arg + 2;
+            server.nbacklogs = 0;
+            while (*c)
+            {
+                if (server.nbacklogs == SERVER_MAX_ACCEPTORS)
+                    break;
+                server.backlog[server.nbacklogs] = strtol(c, &c, 10);
+                if (server.backlog[server.nbacklogs] <= 0)
+                    break;
+                server.nbacklogs++;
+                if (*c == ',')
+                    c++;
+                else if (*c)
+                    break;
+            }
+            if (*c || server.nbacklogs == 0)
+            {
+                debugPrint(DLEVEL_ERROR, "Invalid value of \"-q\" option.");
+                return 1;
+            }
+        } else if (strlen(*arg) >= 3 && strncmp("-D", *arg, 2) == 0) {
+            char *c;
+            c = *arg + 2;
+            server.deferAccept = atoi((const char*)c);
+            if (server.deferAccept < 0)
+            {
+                debugPrint(DLEVEL_ERROR, "Invalid value of \"-D\" option.");
+                return 1;
+            }
+        } else if (strlen(*arg) >= 3 && strncmp("-c", *arg, 2) == 0) {
+            char *c;
+            c = *arg + 2;
+            server.maxClients = atoi((const char*)c);
+            if (server.maxClients <= 0)
+            {
+                debugPrint(DLEVEL_ERROR, "Invalid value of \"-c\" option.");
+                return 1;
+            }
+        } else if (strlen(*arg) >= 3 && strncmp("-Q", *arg, 2) == 0) {
+            char *c;
+            c = *arg + 2;
+            server.maxQueue = atoi((const char*)c);
+            if (server.maxQueue < 0)
+            {
+                debugPrint(DLEVEL_ERROR, "Invalid value of \"-Q\" option.");
+                return 1;
+            }
+        } else if (strlen(*arg) >= 3 && strncmp("-o", *arg, 2) == 0) {
+            char *c;
+            c = *arg + 2;
+            server.outputLimit = atoi((const char*)c);
+            if (server.outputLimit <= 0)
+            {
+                debugPrint(DLEVEL_ERROR, "Invalid value of \"-o\" option.");
+                return 1;
+            }
+        } else if (strlen(*arg) >= 3 && strncmp("-b", *arg, 2) == 0) {
+            char *c;
+            c = *arg + 2;
+            server.maxBody = atoll((const char*)c);
+            if (server.maxBody < 0)
+            {
+                debugPrint(DLEVEL_ERROR, "Invalid value of \"-b\" option.");
+                return 1;
+            }
+        } else if (strlen(*arg) >= 4 && strncmp("-t", *arg, 2) == 0) {
+            char *c;
+            int *timeout;
+            c = *arg + 3;
+            switch ((*arg)[2])
+            {
+                case 'h': timeout = &server.headerTimeout; break;
+                case 'b': timeout = &server.bodyTimeout;   break;
+                case 'w': timeout = &server.writeTimeout;  break;
+                case 'k': timeout = &server.idleTimeout;   break;
+                case 'd': timeout = &server.drainTimeout;  break;
+                default:  timeout = NULL;                  break;
+            }
+            if (!timeout || *c < '0' || *c > '9')
+            {
+                debugPrint(DLEVEL_ERROR, "Invalid \"-t\" option.");
+                return 1;
+            }
+            *timeout = atoi((const char*)c);
+        } else if (strlen(*arg) >= 3 && strncmp("-k", *arg, 2) == 0) {
+            char *c;
+            c = *arg + 2;
+            server.maxRequests = atoi((const char*)c);
+            if (server.maxRequests < 0)
+            {
+                debugPrint(DLEVEL_ERROR, "Invalid value of \"-k\" option.");
+                return 1;
+            }
+        } else if (strlen(*arg) >= 4 && strncmp("-u=", *arg, 3) == 0) {
+            server.unixPath = *arg + 3;
+        } else if (strlen(*arg) >= 4 && strncmp("-s=", *arg, 3) == 0) {
+            server.handoffPath = *arg + 3;
+        } else if (strcmp("-i", *arg) == 0) {
+            server.inherit = 1;
+        } else if (strlen(*arg) >= 5 && strncmp("-P", *arg, 2) == 0 && (*arg)[3] == '=') {
+            int *cpus, *ncpus, i;
+            switch ((*arg)[2])
+            {
+                case 'w': cpus = server.workerCpus;   ncpus = &server.nworkerCpus;   break;
+                case 'a': cpus = server.acceptorCpus; ncpus = &server.nacceptorCpus; break;
+                default:
+                    debugPrint(DLEVEL_ERROR, "Unknown option \"%s\".", *arg);
+                    return 1;
+            }
+            *ncpus = commonParseCpuList(*arg + 4, cpus, SERVER_MAX_CPUS);
+            for (i = 0; i < *ncpus; i++)
+            {
+                if (cpus[i] >= threadCpuCount())
+                    *ncpus = -1;
+            }
+            if (*ncpus <= 0)
+            {
+                debugPrint(DLEVEL_ERROR, "Invalid CPU list in \"%s\" option.", *arg);
+                return 1;
+            }
+        } else if (strlen(*arg) >= 3 && (strncmp("-S", *arg, 2) == 0 || strncmp("-G", *arg, 2) == 0)) {
+            char *c;
+            int kb;
+            c  = *arg + 2;
+            kb = atoi((const char*)c);
+            if (kb <= 0)
+            {
+                debugPrint(DLEVEL_ERROR, "Invalid value of \"%.2s\" option.", *arg);
+                return 1;
+            }
+            if ((*arg)[1] == 'S')
+                server.threadStack = (size_t)kb * 1024;
+            else
+                server.threadGuard = (size_t)kb * 1024;
+        } else if (strcmp("-U", *arg) == 0) {
+            server.uring = 1;
         } else if (strlen(*arg) >= 3 && strncmp("-r=", *arg, 3) == 0) {
             server.resourceDir = *arg + 3;
             debugPrint(DLEVEL_INFO, "Using resources from: \"%s\"", server.resourceDir);
@@ -118,6 +322,9 @@ int main(int argc, char **argv)
         }
         arg++;
     }
+    /* Only Unix socket is used if port is not given explicitly. */
+    if (server.unixPath && !portGiven)
+        server.portNumber = 0;
 
     return serverRun();
 }
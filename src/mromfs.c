@@ -131,4 +131,12 @@ int mromfsRead(struct mromfs_fd_t *fd, uint8_t *buf, uint32_t len)
 
     return r;
 }
+/*
+ * RETURN
+ *     Pointer to content of opened file inside image.
+ */
+const char *mromfsData(struct mromfs_fd_t *fd)
+{
+    return fd->fs->image + fd->start;
+}
 
@@ -21,6 +21,7 @@ struct mromfs_fd_t {
 int mromfsInit(struct mromfs_t *fs, const char *image, uint32_t size);
 int mromfsOpen(struct mromfs_t *fs, struct mromfs_fd_t *fd, const char *name);
 int mromfsRead(struct mromfs_fd_t *fd, uint8_t *buf, uint32_t len);
+const char *mromfsData(struct mromfs_fd_t *fd);
 
 #define MROMFS_ERROR_INVALID         (-1)
 #define MROMFS_ERROR_HEAD_INVALID    (-2)
@@ -0,0 +1,514 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+/* */
+#include "reactor.h"
+/* */
+#include "client.h"
+#include "clientpool.h"
+#include "debug.h"
+#include "server.h"
+#include "thread.h"
+#include "timer.h"
+#include "worker.h"
+
+#define REACTOR_MAX_EVENTS    64
+
+struct reactorListener_t {
+    int sock;
+    void (*accept)(int sock);
+};
+
+static struct {
+    int epfd;
+    int wakefd; /* Signaled by workers when connection is returned. */
+    struct reactorListener_t listeners[REACTOR_MAX_LISTENERS];
+    int nlisteners;
+
+    struct threadMutex_t mutex;
+    struct client_t *resumeHead;
+    struct client_t *resumeTail;
+
+    struct timerWheel_t wheel; /* Timeouts of connections owned by reactor. */
+
+    int draining;
+    uint64_t deadline;         /* Tick when draining ends, 0 if never. */
+} reactor = {
+    .epfd   = -1,
+    .wakefd = -1,
+};
+
+static void reactor_Queue(struct client_t *client);
+static int reactor_Arm(struct client_t *client, int op);
+static void reactor_ClientEvent(struct client_t *client);
+static void reactor_Wake();
+static void reactor_Dispatch(struct client_t *client);
+static void reactor_Continue(struct client_t *client);
+static void reactor_Close(struct client_t *client);
+static void reactor_SetTimeout(struct client_t *client, int timeout);
+static void reactor_Timeout(void *arg);
+static void reactor_DrainClient(struct client_t *client);
+
+/*
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+int reactorInit()
+{
+    struct epoll_event ev;
+
+    reactor.epfd       = -1;
+    reactor.wakefd     = -1;
+    reactor.nlisteners = 0;
+    reactor.resumeHead = NULL;
+    reactor.resumeTail = NULL;
+    reactor.draining   = 0;
+    reactor.deadline   = 0;
+    threadMutexFill(&reactor.mutex);
+    timerWheelInit(&reactor.wheel);
+
+    if (threadMutexInit(&reactor.mutex) < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "Mutex init failed");
+        goto error;
+    }
+    reactor.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor.epfd < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "epoll_create1 failed, %s", strerror(errno));
+        goto error;
+    }
+    reactor.wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor.wakefd < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "eventfd failed, %s", strerror(errno));
+        goto error;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.ptr = &reactor.wakefd;
+    if (epoll_ctl(reactor.epfd, EPOLL_CTL_ADD, reactor.wakefd, &ev) < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "epoll_ctl failed, %s", strerror(errno));
+        goto error;
+    }
+
+    return 0;
+error:
+    reactorDestroy();
+    return -1;
+}
+/*
+ *
+ */
+void reactorDestroy()
+{
+    if (reactor.wakefd >= 0)
+        close(reactor.wakefd);
+    if (reactor.epfd >= 0)
+        close(reactor.epfd);
+    reactor.wakefd = -1;
+    reactor.epfd   = -1;
+    threadMutexDestroy(&reactor.mutex);
+    threadMutexFill(&reactor.mutex);
+}
+/*
+ * Watch listening socket. Accept function is called from reactor loop when
+ * socket is readable.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+int reactorAddListener(int sock, void (*accept)(int sock))
+{
+    struct reactorListener_t *listener;
+    struct epoll_event ev;
+
+    if (reactor.nlisteners >= REACTOR_MAX_LISTENERS)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "Too many listeners");
+        return -1;
+    }
+    listener = &reactor.listeners[reactor.nlisteners];
+    listener->sock   = sock;
+    listener->accept = accept;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.ptr = listener;
+    if (epoll_ctl(reactor.epfd, EPOLL_CTL_ADD, sock, &ev) < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "epoll_ctl failed, %s", strerror(errno));
+        return -1;
+    }
+    reactor.nlisteners++;
+    return 0;
+}
+/*
+ * Stop watching of listening sockets. Sockets are not closed.
+ */
+void reactorRemoveListeners()
+{
+    int i;
+
+    for (i = 0; i < reactor.nlisteners; i++)
+        epoll_ctl(reactor.epfd, EPOLL_CTL_DEL, reactor.listeners[i].sock, NULL);
+    reactor.nlisteners = 0;
+}
+/*
+ * Pass accepted connection to reactor. May be called from any thread.
+ * Connection is watched in edge-triggered one-shot mode, so only one thread
+ * owns it at a time: reactor while request head is received, worker while
+ * request is processed.
+ */
+void reactorAddClient(struct client_t *client)
+{
+    client->watched = 0;
+    client->idle    = 0;
+    timerInit(&client->timer, reactor_Timeout, client);
+    reactor_Queue(client);
+}
+/*
+ * Return keep-alive connection to reactor. Called by worker, client must
+ * not be touched by worker after this call.
+ */
+void reactorResume(struct client_t *client)
+{
+    reactor_Queue(client);
+}
+/*
+ * Reactor loop. Runs until server is stopped.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+int reactorRun()
+{
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    struct reactorListener_t *listener;
+    void *ptr;
+    int n, i;
+
+    while (server.run)
+    {
+        n = epoll_wait(reactor.epfd, events, REACTOR_MAX_EVENTS,
+                (reactor.wheel.count || reactor.draining) ? TIMER_TICK_MS : 1000);
+        if (!server.run)
+            break;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            debugPrint(DLEVEL_ERROR, "epoll_wait failed, %s", strerror(errno));
+            return -1;
+        }
+        for (i = 0; i < n; i++)
+        {
+            ptr = events[i].data.ptr;
+            if (ptr == &reactor.wakefd)
+            {
+                reactor_Wake();
+            } else if (ptr >= (void *)reactor.listeners &&
+                    ptr < (void *)&reactor.listeners[REACTOR_MAX_LISTENERS]) {
+                listener = ptr;
+                (*listener->accept)(listener->sock);
+            } else {
+                reactor_ClientEvent(ptr);
+            }
+        }
+        timerAdvance(&reactor.wheel);
+
+        if (server.drain)
+            serverDrain();
+        if (reactor.draining)
+        {
+            if (clientpoolCount() == 0)
+            {
+                debugPrint(DLEVEL_INFO, "%s", "All connections finished");
+                break;
+            }
+            if (reactor.deadline && timerTicks() >= reactor.deadline)
+            {
+                debugPrint(DLEVEL_WARNING, "Drain timeout, %d connections left",
+                        clientpoolCount());
+                break;
+            }
+        }
+    }
+    return 0;
+}
+/*
+ * Let connections finish, reactor loop ends when all clients are released
+ * or timeout expires. Idle keep-alive connections are closed immediately.
+ * Called from reactor loop, listeners must be removed already.
+ *
+ * ARGS
+ *     timeout    Timeout in seconds, 0 to wait forever.
+ */
+void reactorDrain(int timeout)
+{
+    reactor.draining = 1;
+    if (timeout)
+        reactor.deadline = timerTicks() + (uint64_t)timeout * 1000 / TIMER_TICK_MS;
+    else
+        reactor.deadline = 0;
+    /*
+     * NOTE Nobody leases clients when accept is stopped. Workers still
+     * release clients, but "idle" is set only for clients owned by reactor.
+     */
+    clientpoolForEach(reactor_DrainClient);
+}
+/*
+ * Put client to queue of reactor. Reactor is woken only if queue was
+ * empty, it takes whole queue at once.
+ */
+static void reactor_Queue(struct client_t *client)
+{
+    uint64_t one;
+    int wake;
+
+    client->next = NULL;
+    threadMutexLock(&reactor.mutex);
+    wake = reactor.resumeHead == NULL;
+    if (reactor.resumeTail)
+        reactor.resumeTail->next = client;
+    else
+        reactor.resumeHead = client;
+    reactor.resumeTail = client;
+    threadMutexUnlock(&reactor.mutex);
+
+    if (!wake)
+        return;
+    one = 1;
+    if (write(reactor.wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        debugPrint(DLEVEL_ERROR, "Reactor wakeup failed, %s", strerror(errno));
+}
+/*
+ * Add or rearm one-shot watch of connection. Connection with queued output
+ * is watched for writing, otherwise for reading.
+ *
+ * ARGS
+ *     op    EPOLL_CTL_ADD or EPOLL_CTL_MOD.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+static int reactor_Arm(struct client_t *client, int op)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    if (clientOutputPending(client))
+        ev.events = EPOLLOUT | EPOLLET | EPOLLONESHOT;
+    else
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    ev.data.ptr = client;
+    if (epoll_ctl(reactor.epfd, op, client->sock, &ev) < 0)
+    {
+        DEBUG_CLIENT(DLEVEL_ERROR, "epoll_ctl failed, %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+/*
+ *
+ */
+static void reactor_ClientEvent(struct client_t *client)
+{
+    int pending;
+
+    if (clientOutputPending(client))
+    {
+        /* Socket is writable. */
+        reactor_Continue(client);
+        return;
+    }
+
+    client->idle = 0;
+    pending = client->input.len > client->input.pos;
+    switch (clientRead(client))
+    {
+        case CLIENT_READ_READY:
+            reactor_Dispatch(client);
+            break;
+        case CLIENT_READ_AGAIN:
+            if (reactor_Arm(client, EPOLL_CTL_MOD) < 0)
+            {
+                reactor_Close(client);
+                break;
+            }
+            /*
+             * First bytes of next request on idle connection, whole head
+             * must arrive before header timeout.
+             */
+            if (!pending && client->input.len > client->input.pos)
+                reactor_SetTimeout(client, server.headerTimeout);
+            break;
+        default:
+            reactor_Close(client);
+            break;
+    }
+}
+/*
+ * Take new connections and connections returned by workers. Connection that
+ * already has next request head in input buffer is passed to worker again.
+ */
+static void reactor_Wake()
+{
+    struct client_t *client;
+    struct client_t *next;
+    uint64_t value;
+
+    if (read(reactor.wakefd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        debugPrint(DLEVEL_ERROR, "Reactor wakeup read failed, %s", strerror(errno));
+
+    threadMutexLock(&reactor.mutex);
+    client = reactor.resumeHead;
+    reactor.resumeHead = NULL;
+    reactor.resumeTail = NULL;
+    threadMutexUnlock(&reactor.mutex);
+
+    while (client)
+    {
+        next = client->next;
+        client->next = NULL;
+        if (!client->watched)
+        {
+            if (reactor_Arm(client, EPOLL_CTL_ADD) < 0)
+            {
+                clientStop(client);
+            } else {
+                client->watched = 1;
+                reactor_SetTimeout(client, server.headerTimeout);
+            }
+        } else {
+            reactor_Continue(client);
+        }
+        client = next;
+    }
+}
+/*
+ * Pass connection with complete request head to worker. If run queue is
+ * full, request is answered with 503 and connection is closed.
+ */
+static void reactor_Dispatch(struct client_t *client)
+{
+    timerDel(&reactor.wheel, &client->timer);
+    if (workerPush(client) == 0)
+        return;
+    workerShed(client);
+    reactor_Continue(client);
+}
+/*
+ * Continue with connection returned by worker: finish transfer of output,
+ * then close connection or wait for next request.
+ */
+static void reactor_Continue(struct client_t *client)
+{
+    if (clientOutputPending(client))
+    {
+        switch (clientFlush(client))
+        {
+            case 0:
+                if (reactor_Arm(client, EPOLL_CTL_MOD) < 0)
+                    reactor_Close(client);
+                else
+                    reactor_SetTimeout(client, server.writeTimeout);
+                return;
+            case 1:
+                break;
+            default:
+                reactor_Close(client);
+                return;
+        }
+    }
+
+    if (client->closing)
+    {
+        reactor_Close(client);
+    } else if (clientHeadReady(client)) {
+        reactor_Dispatch(client);
+    } else if (client->input.len > client->input.pos) {
+        if (reactor_Arm(client, EPOLL_CTL_MOD) < 0)
+            reactor_Close(client);
+        else
+            reactor_SetTimeout(client, server.headerTimeout);
+    } else if (reactor.draining || reactor_Arm(client, EPOLL_CTL_MOD) < 0) {
+        reactor_Close(client);
+    } else {
+        client->idle = 1;
+        reactor_SetTimeout(client, server.idleTimeout);
+    }
+}
+/*
+ *
+ */
+static void reactor_Close(struct client_t *client)
+{
+    timerDel(&reactor.wheel, &client->timer);
+    clientStop(client);
+}
+/*
+ * (Re)start timeout of connection.
+ *
+ * ARGS
+ *     timeout    Timeout in seconds, 0 to wait forever.
+ */
+static void reactor_SetTimeout(struct client_t *client, int timeout)
+{
+    if (timeout)
+        timerAdd(&reactor.wheel, &client->timer, (uint64_t)timeout * 1000);
+    else
+        timerDel(&reactor.wheel, &client->timer);
+}
+/*
+ * Connection did not send request in time.
+ */
+static void reactor_Timeout(void *arg)
+{
+    struct client_t *client;
+
+    client = arg;
+    DEBUG_CLIENT(DLEVEL_INFO, "%s", "Timeout, closing connection");
+    clientStop(client);
+}
+/*
+ * Close connection if it waits for next request.
+ */
+static void reactor_DrainClient(struct client_t *client)
+{
+    if (client->idle)
+        reactor_Close(client);
+}
+
@@ -0,0 +1,263 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+/* */
+#include "response.h"
+/* */
+#include "http.h"
+
+/*
+ * Status lines, each is followed by Server header.
+ */
+#define RESPONSE_STATUS(code, text) \
+    {code, "HTTP/1.1 " #code " " text "\r\nServer: Luno\r\n", \
+        sizeof("HTTP/1.1 " #code " " text "\r\nServer: Luno\r\n") - 1}
+static const struct {
+    int code;
+    const char *line;
+    size_t len;
+} response_Status[] = {
+    RESPONSE_STATUS(101, "Switching Protocols"),
+    RESPONSE_STATUS(200, "OK"),
+    RESPONSE_STATUS(204, "No Content"),
+    RESPONSE_STATUS(301, "Moved Permanently"),
+    RESPONSE_STATUS(302, "Found"),
+    RESPONSE_STATUS(303, "See Other"),
+    RESPONSE_STATUS(304, "Not Modified"),
+    RESPONSE_STATUS(307, "Temporary Redirect"),
+    RESPONSE_STATUS(400, "Bad Request"),
+    RESPONSE_STATUS(403, "Forbidden"),
+    RESPONSE_STATUS(404, "Not Found"),
+    RESPONSE_STATUS(405, "Method Not Allowed"),
+    RESPONSE_STATUS(409, "Conflict"),
+    RESPONSE_STATUS(413, "Payload Too Large"),
+    RESPONSE_STATUS(500, "Internal Server Error"),
+    RESPONSE_STATUS(501, "Not Implemented"),
+    RESPONSE_STATUS(503, "Service Unavailable"),
+};
+
+/*
+ * Response to request refused on overload, written without lua.
+ */
+static const char response_Busy[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Server: Luno\r\n"
+    "Retry-After: " RESPONSE_RETRY_AFTER "\r\n"
+    "content-length: 0\r\n"
+    "connection: close\r\n"
+    "\r\n";
+/*
+ * Interim response to request with "Expect: 100-continue".
+ */
+static const char response_Continue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+/*
+ * Last chunk of chunked content, without trailer.
+ */
+static const char response_LastChunk[] = "0\r\n\r\n";
+#define RESPONSE_NSTATUS (sizeof(response_Status) / sizeof(response_Status[0]))
+
+/*
+ * Date header, formatted once per second by each thread.
+ */
+#define RESPONSE_DATE_SIZE    64
+static __thread time_t response_DateTime = -1;
+static __thread size_t response_DateLen;
+static __thread char response_Date[RESPONSE_DATE_SIZE];
+
+static int response_FindStatus(int code);
+static size_t response_GetDate(const char **date);
+
+/*
+ *
+ */
+void responseHeadInit(struct responseHead_t *head)
+{
+    head->buf   = head->local;
+    head->len   = 0;
+    head->size  = sizeof(head->local);
+    head->error = 0;
+}
+/*
+ * Append status line and Server header. Unknown code is replaced with
+ * HTTP_403_FORBIDDEN.
+ *
+ * RETURN
+ *     Code of status line.
+ */
+int responseHeadStatus(struct responseHead_t *head, int code)
+{
+    int i;
+
+    i = response_FindStatus(code);
+    if (i < 0)
+        i = response_FindStatus(HTTP_403_FORBIDDEN);
+
+    responseHeadAppend(head, response_Status[i].line, response_Status[i].len);
+    return response_Status[i].code;
+}
+/*
+ * Append Date header with current time.
+ */
+void responseHeadDate(struct responseHead_t *head)
+{
+    const char *date;
+    size_t len;
+
+    len = response_GetDate(&date);
+    responseHeadAppend(head, date, len);
+}
+/*
+ *
+ */
+void responseHeadAppend(struct responseHead_t *head, const char *s, size_t len)
+{
+    char *buf;
+    size_t size;
+
+    if (head->len + len > head->size)
+    {
+        size = head->size * 2;
+        while (size < head->len + len)
+            size *= 2;
+        if (head->buf == head->local)
+        {
+            buf = malloc(size);
+            if (buf)
+                memcpy(buf, head->buf, head->len);
+        } else {
+            buf = realloc(head->buf, size);
+        }
+        if (!buf)
+        {
+            head->error = 1;
+            return;
+        }
+        head->buf  = buf;
+        head->size = size;
+    }
+    memcpy(head->buf + head->len, s, len);
+    head->len += len;
+}
+/*
+ * Append "name: value" header line.
+ */
+void responseHeadField(struct responseHead_t *head,
+        const char *name, size_t nlen, const char *value, size_t vlen)
+{
+    responseHeadAppend(head, name, nlen);
+    responseHeadAppend(head, ": ", 2);
+    responseHeadAppend(head, value, vlen);
+    responseHeadAppend(head, "\r\n", 2);
+}
+/*
+ *
+ */
+void responseHeadFree(struct responseHead_t *head)
+{
+    if (head->buf != head->local)
+        free(head->buf);
+    responseHeadInit(head);
+}
+/*
+ * RETURN
+ *     Pre-rendered 503 response, its length in "len".
+ */
+const char *responseBusy(size_t *len)
+{
+    *len = sizeof(response_Busy) - 1;
+    return response_Busy;
+}
+/*
+ * RETURN
+ *     Pre-rendered "100 Continue" response, its length in "len".
+ */
+const char *responseContinue(size_t *len)
+{
+    *len = sizeof(response_Continue) - 1;
+    return response_Continue;
+}
+/*
+ * Form size line of chunk with "len" bytes of data.
+ *
+ * ARGS
+ *     buf    Buffer of at least RESPONSE_CHUNK_HEAD_SIZE bytes.
+ *
+ * RETURN
+ *     Length of size line.
+ */
+size_t responseChunkHead(char *buf, size_t len)
+{
+    return snprintf(buf, RESPONSE_CHUNK_HEAD_SIZE, "%zx\r\n", len);
+}
+/*
+ *
+ */
+const char *responseLastChunk(size_t *len)
+{
+    *len = sizeof(response_LastChunk) - 1;
+    return response_LastChunk;
+}
+/*
+ * RETURN
+ *     Index in status table, -1 if code is unknown.
+ */
+static int response_FindStatus(int code)
+{
+    size_t i;
+
+    for (i = 0; i < RESPONSE_NSTATUS; i++)
+    {
+        if (response_Status[i].code == code)
+            return (int)i;
+    }
+    return -1;
+}
+/*
+ * RETURN
+ *     Length of Date header line (with CRLF), line itself in "date".
+ */
+static size_t response_GetDate(const char **date)
+{
+    time_t now;
+    struct tm tm;
+
+    now = time(NULL);
+    if (now != response_DateTime)
+    {
+        gmtime_r(&now, &tm);
+        response_DateLen  = strftime(response_Date, sizeof(response_Date),
+                "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        response_DateTime = now;
+    }
+    *date = response_Date;
+    return response_DateLen;
+}
+
@@ -0,0 +1,63 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef _RESPONSE_H
+#define _RESPONSE_H
+
+#include <stddef.h>
+
+/*
+ * Buffer for status line and headers of response. Starts with local storage,
+ * moves to heap if headers do not fit.
+ */
+#define RESPONSE_HEAD_SIZE    2048
+struct responseHead_t {
+    char *buf;
+    size_t len;
+    size_t size;
+    int error;  /* Set if buffer can not grow. */
+    char local[RESPONSE_HEAD_SIZE];
+};
+
+void responseHeadInit(struct responseHead_t *head);
+int responseHeadStatus(struct responseHead_t *head, int code);
+void responseHeadDate(struct responseHead_t *head);
+void responseHeadAppend(struct responseHead_t *head, const char *s, size_t len);
+void responseHeadField(struct responseHead_t *head,
+        const char *name, size_t nlen, const char *value, size_t vlen);
+void responseHeadFree(struct responseHead_t *head);
+const char *responseBusy(size_t *len);
+const char *responseContinue(size_t *len);
+size_t responseChunkHead(char *buf, size_t len);
+const char *responseLastChunk(size_t *len);
+
+#define RESPONSE_CHUNK_HEAD_SIZE    20 /* Size line of chunk, "%zx\r\n". */
+
+#define RESPONSE_RETRY_AFTER    "1" /* Seconds, in response to overloaded request. */
+
+#endif
+
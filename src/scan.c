@@ -0,0 +1,171 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <string.h>
+#if (defined __SSE2__)
+    #include <immintrin.h>
+#endif
+/* */
+#include "scan.h"
+
+/*
+ * Terminator of request head ends with LF at position "i".
+ */
+#define _TERMINATOR(buf, i) \
+    ((buf)[(i) - 1] == '\r' && (buf)[(i) - 2] == '\n' && (buf)[(i) - 3] == '\r')
+
+static int scan_HeadEndScalar(const char *buf, int i, int len);
+#if (defined __SSE2__)
+static int scan_HeadEndSse2(const char *buf, int i, int len);
+#endif
+#if (defined __SSE2__ && defined __GNUC__ && (defined __x86_64__ || defined __i386__))
+    #define SCAN_AVX2
+static int scan_HeadEndAvx2(const char *buf, int i, int len);
+#endif
+static int scan_HeadEndSelect(const char *buf, int i, int len);
+
+/*
+ * Implementation is selected on first call.
+ */
+static int (*scan_HeadEnd)(const char *, int, int) = scan_HeadEndSelect;
+
+/*
+ * Search for end of request head ("\r\n\r\n"). Line feeds are located by
+ * vector compare of 16 or 32 bytes at once, only they are checked for
+ * terminator.
+ *
+ * ARGS
+ *     buf     Received data.
+ *     from    Position where terminator can start.
+ *     len     Number of bytes in buffer.
+ *
+ * RETURN
+ *     Position after terminator, -1 if it is not found.
+ */
+int scanHeadEnd(const char *buf, int from, int len)
+{
+    if (len - from < 4)
+        return -1;
+    /* Position of last character of terminator. */
+    return (*scan_HeadEnd)(buf, from + 3, len);
+}
+/*
+ * Choose best implementation supported by CPU.
+ *
+ * NOTE Pointer may be set by several threads at once, all of them set same
+ * value.
+ */
+static int scan_HeadEndSelect(const char *buf, int i, int len)
+{
+#if (defined SCAN_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        scan_HeadEnd = scan_HeadEndAvx2;
+    else
+        scan_HeadEnd = scan_HeadEndSse2;
+#elif (defined __SSE2__)
+    scan_HeadEnd = scan_HeadEndSse2;
+#else
+    scan_HeadEnd = scan_HeadEndScalar;
+#endif
+    return (*scan_HeadEnd)(buf, i, len);
+}
+/*
+ *
+ */
+static int scan_HeadEndScalar(const char *buf, int i, int len)
+{
+    const char *p;
+
+    while (i < len)
+    {
+        p = memchr(buf + i, '\n', len - i);
+        if (!p)
+            break;
+        i = p - buf;
+        if (_TERMINATOR(buf, i))
+            return i + 1;
+        i++;
+    }
+    return -1;
+}
+#if (defined __SSE2__)
+/*
+ *
+ */
+static int scan_HeadEndSse2(const char *buf, int i, int len)
+{
+    __m128i lf;
+    unsigned mask;
+    int n;
+
+    lf = _mm_set1_epi8('\n');
+    while (len - i >= 16)
+    {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                    _mm_loadu_si128((const __m128i *)(buf + i)), lf));
+        while (mask)
+        {
+            n = i + __builtin_ctz(mask);
+            if (_TERMINATOR(buf, n))
+                return n + 1;
+            mask &= mask - 1;
+        }
+        i += 16;
+    }
+    return scan_HeadEndScalar(buf, i, len);
+}
+#endif
+#if (defined SCAN_AVX2)
+/*
+ *
+ */
+__attribute__((target("avx2")))
+static int scan_HeadEndAvx2(const char *buf, int i, int len)
+{
+    __m256i lf;
+    unsigned mask;
+    int n;
+
+    lf = _mm256_set1_epi8('\n');
+    while (len - i >= 32)
+    {
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                    _mm256_loadu_si256((const __m256i *)(buf + i)), lf));
+        while (mask)
+        {
+            n = i + __builtin_ctz(mask);
+            if (_TERMINATOR(buf, n))
+                return n + 1;
+            mask &= mask - 1;
+        }
+        i += 32;
+    }
+    return scan_HeadEndSse2(buf, i, len);
+}
+#endif
+
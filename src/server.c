@@ -25,17 +25,17 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *
  */
-
-#ifdef WINDOWS
-    #include <winsock2.h>
-    #include <ws2tcpip.h>
-#else
-    #include <arpa/inet.h>
-    #include <sys/select.h>
-    #include <sys/socket.h>
-    #include <netinet/in.h>
-    #include <netdb.h>
-#endif
+#define _GNU_SOURCE /* accept4() */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -45,28 +45,41 @@
 #include "server.h"
 /* */
 #include "client.h"
+#include "clientpool.h"
 #include "debug.h"
+#include "handoff.h"
 #include "lserver.h"
 #include "mromfs.h"
 #include "mromfsimage.h"
+#include "reactor.h"
+#include "worker.h"
 
-#define SERVER_LISTEN_QUEUE_LENGTH    100
-#define SERVER_MAX_CLIENTS            1024
-
-static int nclients = 0;
+#define SERVER_ACCEPT_BATCH           64 /* Max connections accepted per wakeup. */
 
 struct server_t server;
-static struct client_t clients[SERVER_MAX_CLIENTS];
 
-static int _openServerSock(int port);
-static void _acceptClient();
+/*
+ * Listener with own accept thread, used when "-a" option is given.
+ */
+static struct serverAcceptor_t {
+    int sock;
+    struct thread_t thread;
+    int started;
+} acceptors[SERVER_MAX_ACCEPTORS];
+
+static int _openServerSock(int port, int shard, int backlog);
+static int _openUnixSock(const char *path);
+static int _inheritServerSocks();
+static const char *_handoffPath();
+static int _acceptClient(int sock);
+static void _acceptBatch(int sock);
+static int _startAcceptors();
+static void _stopAcceptors();
+static THREAD_RUN(_acceptorRun, arg);
+static void _reportMemory();
 static int _initSignals();
-#ifdef WINDOWS
-static void _sigAction(int sig);
-#else
 static void _sigAction(int sig, siginfo_t *siginfo, void *context);
-#endif
-static struct client_t *_getClient();
+static void _stopClient(struct client_t *client);
 static void _stopClients();
 
 /*
@@ -76,13 +89,47 @@ void serverInit()
 {
     server.portNumber  = DEFAULT_PORT;
     server.resourceDir = NULL;
+    server.unixPath    = NULL;
     server.sock        = -1;
+    server.usock       = -1;
     server.luaState    = NULL;
     server.run         = 1;
     server.caching     = 1; /* NOTE Not implemented */
+    server.nworkers    = WORKER_DEFAULT_COUNT;
+    server.nacceptors  = 0;
+    server.backlog[0]  = SERVER_LISTEN_QUEUE_LENGTH;
+    server.nbacklogs   = 1;
+    server.deferAccept = SERVER_DEFER_ACCEPT;
+    server.maxClients  = CLIENTPOOL_DEFAULT_MAX;
+    server.maxQueue    = SERVER_MAX_QUEUE;
+    server.uring       = 0;
+    server.nworkerCpus   = 0;
+    server.nacceptorCpus = 0;
+    server.threadStack   = 0;
+    server.threadGuard   = 0;
+
+    server.headerTimeout = SERVER_HEADER_TIMEOUT;
+    server.bodyTimeout   = SERVER_BODY_TIMEOUT;
+    server.writeTimeout  = SERVER_WRITE_TIMEOUT;
+    server.idleTimeout   = SERVER_IDLE_TIMEOUT;
+    server.maxRequests   = SERVER_MAX_REQUESTS;
+    server.drainTimeout  = SERVER_DRAIN_TIMEOUT;
+    server.outputLimit   = SERVER_OUTPUT_LIMIT;
+    server.maxBody       = SERVER_MAX_BODY;
+
+    server.argv        = NULL;
+    server.handoffPath = NULL;
+    server.inherit     = 0;
+    server.drain       = 0;
+    server.draining    = 0;
     threadMutexFill(&server.lmutex);
-    threadMutexFill(&server.cmutex);
-    memset(clients, 0, sizeof(struct client_t) * SERVER_MAX_CLIENTS);
+    memset(acceptors, 0, sizeof(acceptors));
+    {
+        int i;
+
+        for (i = 0; i < SERVER_MAX_ACCEPTORS; i++)
+            acceptors[i].sock = -1;
+    }
 
 }
 /*
@@ -90,25 +137,12 @@ void serverInit()
  */
 int serverRun()
 {
-#ifdef WINDOWS
-    WSADATA wsaData;
-#endif
     int ret;
 
     ret = -1;
 
-#ifdef WINDOWS
-    if (WSAStartup(0x0101, &wsaData) != 0)
-    {
-        debugPrint(DLEVEL_ERROR, "WSAStartup error");
-        goto done;
-    }
-#endif
-    if (threadMutexInit(&server.cmutex) < 0)
-    {
-        debugPrint(DLEVEL_ERROR, "%s", "Mutex init failed");
+    if (clientpoolInit(server.maxClients) < 0)
         goto done;
-    }
 
     if (_initSignals() < 0)
         goto done;
@@ -118,73 +152,75 @@ int serverRun()
         goto done;
     }
 
-    server.sock = _openServerSock(server.portNumber);
-    if (server.sock < 0)
+    if (server.portNumber == 0)
+        server.nacceptors = 0;
+    if (server.inherit && _inheritServerSocks() < 0)
         goto done;
-    if (lserverInit() < 0)
-        goto done;
-
-    while (server.run)
+    if (server.portNumber && server.nacceptors == 0 && server.sock < 0)
     {
-        fd_set rfds;
-        int sel;
-        struct timeval timeout;
-
-        FD_ZERO(&rfds);
-        FD_SET(server.sock, &rfds);
-
-        timeout.tv_sec  = 1;
-        timeout.tv_usec = 0;
-
-        sel = select(server.sock + 1, &rfds, NULL, NULL, &timeout);
-        if (!server.run)
-            break;
-        if (sel < 0)
-        {
-            if (errno == EINTR)
-            {
-                /* NOTREACHED _sigAction must terminate program */
-#if 1
-                debugPrint(DLEVEL_ERROR, "Select EINTR %s", strerror(errno));
-#endif
-                continue;
-            }
-
-            debugPrint(DLEVEL_ERROR, "Select failed %s", strerror(errno));
+        server.sock = _openServerSock(server.portNumber, 0, server.backlog[0]);
+        if (server.sock < 0)
+            goto done;
+    }
+    if (server.unixPath && server.usock < 0)
+    {
+        server.usock = _openUnixSock(server.unixPath);
+        if (server.usock < 0)
             goto done;
-        }
-        if (sel == 0)
-        {
-            /* Timeout. */
-            continue;
-        }
-        if (FD_ISSET(server.sock, &rfds))
-            _acceptClient();
     }
+    if (lserverInit() < 0)
+        goto done;
+    if (reactorInit() < 0)
+        goto done;
+    if (server.sock >= 0 && reactorAddListener(server.sock, _acceptBatch) < 0)
+        goto done;
+    if (server.usock >= 0 && reactorAddListener(server.usock, _acceptBatch) < 0)
+        goto done;
+    if (workerStart(server.nworkers) < 0)
+        goto done;
+    if (_startAcceptors() < 0)
+        goto done;
+    handoffReady();
+    _reportMemory();
+
+    if (reactorRun() < 0)
+        goto done;
 
-    _stopClients();
-#ifdef WINDOWS
-    WSACleanup();
-#endif
     ret = 0;
 done:
+    _stopAcceptors();
+    workerStop();
+    _stopClients();
+    clientpoolDestroy();
+    reactorDestroy();
     if (server.sock >= 0)
         close(server.sock);
+    if (server.usock >= 0)
+    {
+        close(server.usock);
+        unlink(server.unixPath);
+    }
     lserverDestroy();
 
     return ret;
 }
 
 /*
+ * ARGS
+ *     port     Port to listen.
+ *     shard      Non-zero if socket is one of listeners sharing same port
+ *                (SO_REUSEPORT), served by own accept thread.
+ *     backlog    Length of listen queue.
+ *
  * RETURN
  *     socket on success, -1 on error.
  */
-static int _openServerSock(int port)
+static int _openServerSock(int port, int shard, int backlog)
 {
     int sock;
     struct sockaddr_in serverAddr;
 
-    sock = socket(AF_INET, SOCK_STREAM, 0);
+    sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (sock < 0)
     {
         debugPrint(DLEVEL_ERROR, "Failed to open server socket, %s", strerror(errno));
@@ -195,17 +231,37 @@ static int _openServerSock(int port)
     {
         int enable = 1;
         if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR,
-#ifdef WINDOWS
-            (const char*)&enable,
-#else
             &enable,
-#endif
             sizeof(int)) < 0
         ) {
             debugPrint(DLEVEL_ERROR, "setsockopt(SO_REUSEADDR) failed");
         }
     }
 #endif
+    if (shard)
+    {
+        int enable = 1;
+        int timeout = server.deferAccept;
+
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int)) < 0)
+        {
+            debugPrint(DLEVEL_ERROR, "setsockopt(SO_REUSEPORT) failed, %s", strerror(errno));
+            goto error;
+        }
+        /* Wake acceptor only when request data has arrived. */
+        if (timeout && setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &timeout, sizeof(int)) < 0)
+            debugPrint(DLEVEL_WARNING, "setsockopt(TCP_DEFER_ACCEPT) failed");
+    }
+    {
+        int flags;
+
+        flags = fcntl(sock, F_GETFL, 0);
+        if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0)
+        {
+            debugPrint(DLEVEL_ERROR, "Failed to set non-blocking mode, %s", strerror(errno));
+            goto error;
+        }
+    }
 
     memset(&serverAddr, 0, sizeof(serverAddr));
     serverAddr.sin_family = AF_INET;
@@ -220,7 +276,7 @@ static int _openServerSock(int port)
 
     debugPrint(DLEVEL_INFO, "Binding to port %d success", port);
 
-    if (listen(sock, SERVER_LISTEN_QUEUE_LENGTH) < 0)
+    if (listen(sock, backlog) < 0)
     {
         debugPrint(DLEVEL_ERROR, "Failed to listen port %d, %s", port, strerror(errno));
         goto error;
@@ -233,57 +289,223 @@ error:
     return -1;
 }
 /*
+ * Open listener on Unix socket. Stale socket file is removed.
  *
+ * RETURN
+ *     socket on success, -1 on error.
  */
-static void _acceptClient()
+static int _openUnixSock(const char *path)
 {
+    int sock;
+    struct sockaddr_un serverAddr;
+
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(serverAddr.sun_path))
+    {
+        debugPrint(DLEVEL_ERROR, "Unix socket path is too long \"%s\"", path);
+        return -1;
+    }
+    strcpy(serverAddr.sun_path, path);
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "Failed to open Unix socket, %s", strerror(errno));
+        return -1;
+    }
+    unlink(path);
+    if (bind(sock, (struct sockaddr *) &serverAddr, sizeof(serverAddr)) < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "Failed to bind server to \"%s\", %s", path, strerror(errno));
+        goto error;
+    }
+    if (listen(sock, server.backlog[0]) < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "Failed to listen \"%s\", %s", path, strerror(errno));
+        goto error;
+    }
+    debugPrint(DLEVEL_INFO, "Listening on \"%s\"", path);
+
+    return sock;
+error:
+    close(sock);
+    return -1;
+}
+/*
+ * Take listening sockets from running server ("-i" option). Unix socket
+ * is recognized by address family. Single TCP socket is served by reactor,
+ * several sockets by accept threads.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+static int _inheritServerSocks()
+{
+    int fds[SERVER_MAX_ACCEPTORS + 1];
+    struct sockaddr_storage addr;
     socklen_t addrLen;
-    socklen_t clientAddrLen;
-    struct sockaddr_in addr;
-    struct sockaddr_in clientAddr;
-    struct client_t *client;
-    int clientSock;
-    int success;
-    char *clientHostAddr;
+    int n, i, ntcp;
 
-    debugPrint(DLEVEL_NOISE, "Incoming connection...");
+    n = handoffInherit(_handoffPath(), fds, SERVER_MAX_ACCEPTORS + 1);
+    if (n <= 0)
+        return -1;
+    ntcp = 0;
+    for (i = 0; i < n; i++)
+    {
+        addrLen = sizeof(addr);
+        if (getsockname(fds[i], (struct sockaddr *)&addr, &addrLen) == 0 &&
+                addr.ss_family == AF_UNIX && server.usock < 0)
+            server.usock = fds[i];
+        else
+            fds[ntcp++] = fds[i];
+    }
+    if (ntcp == 0)
+        return 0;
+    if (ntcp == 1 && server.nacceptors == 0)
+    {
+        server.sock = fds[0];
+        return 0;
+    }
+    if (ntcp > SERVER_MAX_ACCEPTORS)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "Too many listening sockets inherited");
+        return -1;
+    }
+    server.nacceptors = ntcp;
+    for (i = 0; i < ntcp; i++)
+        acceptors[i].sock = fds[i];
+    return 0;
+}
+/*
+ * RETURN
+ *     Path of Unix socket used on restart.
+ */
+static const char *_handoffPath()
+{
+    static char path[128];
 
-    client = NULL;
-    clientSock = -1;
+    if (server.handoffPath)
+        return server.handoffPath;
+    snprintf(path, sizeof(path), HANDOFF_PATH, server.portNumber);
+    return path;
+}
+/*
+ * Stop accepting and let connections finish. Called by reactor when
+ * requested by signal. On restart listening sockets are passed to new
+ * server first, if it fails server continues to serve.
+ */
+void serverDrain()
+{
+    int fds[SERVER_MAX_ACCEPTORS + 1];
+    int restart;
+    int nfds, i;
 
-    success = 0;
-    do
+    restart = server.drain == SERVER_DRAIN_RESTART;
+    server.drain = 0;
+    if (server.draining)
+        return;
+
+    if (restart)
     {
-        addrLen = sizeof(struct sockaddr_in);
-        clientSock = accept(server.sock, (struct sockaddr*)&addr, &addrLen);
-        if (clientSock < 0)
+        nfds = 0;
+        if (server.sock >= 0)
+            fds[nfds++] = server.sock;
+        if (server.usock >= 0)
+            fds[nfds++] = server.usock;
+        for (i = 0; i < server.nacceptors; i++)
         {
-            debugPrint(DLEVEL_WARNING, "Accept failed %s", strerror(errno));
-            break;
+            if (acceptors[i].sock >= 0)
+                fds[nfds++] = acceptors[i].sock;
         }
-        clientHostAddr = inet_ntoa(addr.sin_addr);
-        if (!clientHostAddr)
+        /*
+         * NOTE Reactor is blocked until new server is started, connections
+         * wait in listen queue meanwhile.
+         */
+        if (handoffRestart(_handoffPath(), server.argv, fds, nfds) < 0)
         {
-            debugPrint(DLEVEL_WARNING, "ERROR on inet_ntoa");
-            break;
+            debugPrint(DLEVEL_ERROR, "%s", "Restart failed, continue to serve");
+            return;
         }
-        clientAddrLen = sizeof(clientAddr);
-        if (getpeername(clientSock, (struct sockaddr*)&clientAddr, &clientAddrLen) < 0)
+    }
+
+    debugPrint(DLEVEL_INFO, "%s", "Draining connections");
+    server.draining = 1;
+    reactorRemoveListeners();
+    _stopAcceptors();
+    if (server.sock >= 0)
+        close(server.sock);
+    server.sock = -1;
+    if (server.usock >= 0)
+    {
+        close(server.usock);
+        /* NOTE On restart socket file is used by new server. */
+        if (!restart)
+            unlink(server.unixPath);
+    }
+    server.usock = -1;
+    reactorDrain(server.drainTimeout);
+}
+/*
+ * Accept one connection.
+ *
+ * RETURN
+ *     0 if connection was taken from listen queue, -1 if queue is empty or
+ *     accept failed.
+ */
+static int _acceptClient(int sock)
+{
+    socklen_t addrLen;
+    struct sockaddr_storage addr;
+    struct client_t *client;
+    int clientSock;
+    char clientHostAddr[CLIENT_ADDR_INFO_ADDR_LENGTH + 1];
+    int clientPort;
+    int serverPort;
+
+    client = NULL;
+
+    addrLen = sizeof(addr);
+    clientSock = accept4(sock, (struct sockaddr*)&addr, &addrLen,
+            SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (clientSock < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            debugPrint(DLEVEL_WARNING, "Accept failed %s", strerror(errno));
+        return -1;
+    }
+
+    do
+    {
+        if (addr.ss_family == AF_UNIX)
         {
-            debugPrint(DLEVEL_WARNING, "ERROR on getpeername: %s", strerror(errno));
-            break;
+            /*
+             * NOTE Peer of Unix socket is usually unnamed. Connection has no
+             * port, "serverPort" of request is 0.
+             */
+            strcpy(clientHostAddr, "unix");
+            clientPort = 0;
+            serverPort = 0;
+        } else {
+            if (!inet_ntop(AF_INET, &((struct sockaddr_in *)&addr)->sin_addr,
+                        clientHostAddr, sizeof(clientHostAddr)))
+            {
+                debugPrint(DLEVEL_WARNING, "ERROR on inet_ntop");
+                break;
+            }
+            clientPort = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+            serverPort = server.portNumber;
         }
-        debugPrint(DLEVEL_INFO, "Accepted connection from %s:%d", clientHostAddr, ntohs(clientAddr.sin_port));
-        client = _getClient();
+        debugPrint(DLEVEL_INFO, "Accepted connection from %s:%d", clientHostAddr, clientPort);
+        client = clientpoolGet();
         if (!client)
         {
             debugPrint(DLEVEL_WARNING, "Client limit reached");
             break;
         }
-        strncpy(client->addrInfo.addr, clientHostAddr, CLIENT_ADDR_INFO_ADDR_LENGTH);
-        client->addrInfo.addr[CLIENT_ADDR_INFO_ADDR_LENGTH] = 0;
-        client->addrInfo.port = ntohs(clientAddr.sin_port);
-        client->serverPort    = server.portNumber;
+        strcpy(client->addrInfo.addr, clientHostAddr);
+        client->addrInfo.port = clientPort;
+        client->serverPort    = serverPort;
         client->sock          = clientSock;
 
         if (clientStart(client) != 0)
@@ -291,103 +513,133 @@ static void _acceptClient()
             debugPrint(DLEVEL_WARNING, "Failed to start client");
             break;
         }
-        success = 1;
+        return 0;
     } while (0);
 
-    if (!success)
+    close(clientSock);
+    if (client)
+        serverDropClient(client);
+    return 0;
+}
+/*
+ * Drain listen queue of socket. Called by reactor when listening socket is
+ * readable and by accept threads.
+ */
+static void _acceptBatch(int sock)
+{
+    int n;
+
+    for (n = 0; n < SERVER_ACCEPT_BATCH; n++)
     {
-        if (clientSock >= 0)
-            close(clientSock);
-        if (client)
-            serverDropClient(client);
+        if (_acceptClient(sock) < 0)
+            break;
     }
 }
 /*
+ * Open SO_REUSEPORT listeners and start accept thread for each of them.
+ * Kernel distributes incoming connections between listeners. If acceptors
+ * are pinned, listener is marked with SO_INCOMING_CPU of its thread, so
+ * kernel prefers listener of CPU which received packets of connection.
  *
+ * RETURN
+ *     0 on success, -1 on error.
  */
-static struct client_t *droppedClient = NULL;
-
-static struct client_t *_getClient()
+static int _startAcceptors()
 {
-    static struct client_t *lastClient = NULL;
-    int n;
+    struct serverAcceptor_t *acceptor;
+    int i, cpu;
 
-    if (lastClient == NULL)
-        lastClient = clients;
-
-    threadMutexLock(&server.cmutex);
-    if (droppedClient)
+    for (i = 0; i < server.nacceptors; i++)
     {
-        struct client_t *client;
-
-        client = droppedClient;
-        client->lease = 1;
-        droppedClient = NULL;
-        nclients++;
-        debugPrint(DLEVEL_NOISE, "NCLIENTS(%d)", nclients);
-        threadMutexUnlock(&server.cmutex);
-        return client;
+        acceptor = &acceptors[i];
+        if (acceptor->sock < 0) /* Not inherited. */
+            acceptor->sock = _openServerSock(server.portNumber, 1,
+                    server.backlog[i % server.nbacklogs]);
+        if (acceptor->sock < 0)
+            return -1;
+        if (server.nacceptorCpus == 0)
+            continue;
+        cpu = server.acceptorCpus[i % server.nacceptorCpus];
+        if (setsockopt(acceptor->sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(int)) < 0)
+            debugPrint(DLEVEL_WARNING, "setsockopt(SO_INCOMING_CPU) failed, %s", strerror(errno));
     }
-    threadMutexUnlock(&server.cmutex);
-
-    n = SERVER_MAX_CLIENTS;
-    while (n--)
+    for (i = 0; i < server.nacceptors; i++)
     {
-        threadMutexLock(&server.cmutex);
-        if (!lastClient->lease)
+        acceptor = &acceptors[i];
+        threadInit(&acceptor->thread);
+        if (server.nacceptorCpus)
+            threadSetCpu(&acceptor->thread, server.acceptorCpus[i % server.nacceptorCpus]);
+        threadSetStack(&acceptor->thread, server.threadStack, server.threadGuard);
+        if (threadCreate(&acceptor->thread, _acceptorRun, NULL, acceptor) < 0)
         {
-            lastClient->lease = 1;
-            nclients++;
-            debugPrint(DLEVEL_NOISE, "NCLIENTS(%d)", nclients);
-            threadMutexUnlock(&server.cmutex);
-            return lastClient;
+            debugPrint(DLEVEL_ERROR, "Failed to start acceptor %d", i);
+            return -1;
         }
-        threadMutexUnlock(&server.cmutex);
+        acceptor->started = 1;
+    }
+    if (server.nacceptors)
+        debugPrint(DLEVEL_INFO, "Started %d acceptors", server.nacceptors);
+    return 0;
+}
+/*
+ *
+ */
+static void _stopAcceptors()
+{
+    struct serverAcceptor_t *acceptor;
+    int i;
 
-        lastClient++;
-        if (lastClient >= &clients[SERVER_MAX_CLIENTS])
-            lastClient = clients;
+    for (i = 0; i < server.nacceptors; i++)
+    {
+        acceptor = &acceptors[i];
+        if (acceptor->started)
+            threadCancel(&acceptor->thread);
+        acceptor->started = 0;
+        if (acceptor->sock >= 0)
+            close(acceptor->sock);
+        acceptor->sock = -1;
     }
+}
+/*
+ * Accept thread. Runs until canceled by _stopAcceptors().
+ */
+static THREAD_RUN(_acceptorRun, arg)
+{
+    struct serverAcceptor_t *acceptor;
+    struct pollfd pfd;
 
-    return NULL;
+    acceptor = arg;
+    pfd.fd     = acceptor->sock;
+    pfd.events = POLLIN;
+    while (1)
+    {
+        pfd.revents = 0;
+        if (poll(&pfd, 1, -1) <= 0)
+            continue;
+        _acceptBatch(acceptor->sock);
+    }
 }
 /*
  * Called by client itself.
  */
 void serverDropClient(struct client_t *client)
 {
-    threadMutexLock(&server.cmutex);
-    client->lease = 0;
-    droppedClient = client;
-    nclients--;
-    debugPrint(DLEVEL_NOISE, "NCLIENTS(%d)", nclients);
-    threadMutexUnlock(&server.cmutex);
+    clientpoolPut(client);
+}
+/*
+ *
+ */
+static void _stopClient(struct client_t *client)
+{
+    clientStop(client);
 }
 /*
  *
  */
 static void _stopClients()
 {
-    int n;
-    struct client_t *client;
     debugPrint(DLEVEL_INFO, "Stopping clients");
-
-    n = SERVER_MAX_CLIENTS;
-    client = clients;
-    while (n--)
-    {
-        int lease;
-
-        lease = 0;
-        threadMutexLock(&server.cmutex);
-        if (client->lease)
-            lease = 1;
-        threadMutexUnlock(&server.cmutex);
-
-        if (lease)
-            clientStop(client);
-        client++;
-    }
+    clientpoolForEach(_stopClient);
     debugPrint(DLEVEL_INFO, "All clients was stopped");
 }
 /*
@@ -395,10 +647,6 @@ static void _stopClients()
  */
 static int _initSignals()
 {
-#ifdef WINDOWS
-    signal(SIGINT, _sigAction);
-    signal(SIGTERM, _sigAction);
-#else
     {
         static struct sigaction act;
 
@@ -415,25 +663,25 @@ static int _initSignals()
             debugPrint(DLEVEL_ERROR, "Sigaction failed, %s.", strerror(errno));
             return -1;
         }
+        /* Graceful stop and restart, handler stays installed. */
+        act.sa_flags = SA_SIGINFO;
+        if (sigaction(SIGQUIT, &act, NULL) == -1 || sigaction(SIGUSR2, &act, NULL) == -1)
+        {
+            debugPrint(DLEVEL_ERROR, "Sigaction failed, %s.", strerror(errno));
+            return -1;
+        }
     }
-#endif
 
     /*
      * XXX Ignore SIGPIPE.
      */
-#ifndef WINDOWS
     signal(SIGPIPE, SIG_IGN);    
-#endif
     return 0;
 }
 /*
  * Signal handler.
  */
-#ifdef WINDOWS
-static void _sigAction(int sig)
-#else
 static void _sigAction(int sig, siginfo_t *siginfo, void *context)
-#endif
 {
     switch (sig)
     {
@@ -443,10 +691,52 @@ static void _sigAction(int sig, siginfo_t *siginfo, void *context)
                     "Caught signal (signal %d)", sig);
             server.run = 0;
             break;
+        case SIGQUIT:
+            debugPrint(DLEVEL_INFO, "Caught signal (signal %d), graceful stop", sig);
+            server.drain = SERVER_DRAIN_STOP;
+            break;
+        case SIGUSR2:
+            debugPrint(DLEVEL_INFO, "Caught signal (signal %d), restart", sig);
+            server.drain = SERVER_DRAIN_RESTART;
+            break;
         default:
             debugPrint(DLEVEL_WARNING,
                     "Unknown signal received (%d)", sig);
             break;
     }
 }
+/*
+ * Print memory footprint after start, to size limits of server.
+ */
+static void _reportMemory()
+{
+    struct workerStats_t stats;
+    unsigned long size, resident;
+    FILE *f;
+
+    resident = 0;
+    f = fopen("/proc/self/statm", "r");
+    if (f)
+    {
+        if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+    workerStats(&stats);
+
+    debugPrint(DLEVEL_INFO, "Memory: RSS %lu KB, lua %zu KB per worker",
+            resident * sysconf(_SC_PAGESIZE) / 1024, stats.luaMemory / 1024);
+    /*
+     * Reported before any connection exists, so per connection figures are
+     * estimated from buffer sizes, not measured. Allocator overhead is not
+     * counted, queued output may exceed limit by one write of handler.
+     */
+    debugPrint(DLEVEL_INFO, "Estimated memory per connection: %zu bytes idle, %zu KB with full buffers",
+            sizeof(struct client_t) + CLIENT_INPUT_SIZE,
+            (sizeof(struct client_t) + CLIENT_INPUT_CHUNKS * CLIENT_INPUT_SIZE +
+                server.outputLimit) / 1024);
+    if (server.threadStack)
+        debugPrint(DLEVEL_INFO, "Thread stack %zu KB, guard %zu KB",
+                server.threadStack / 1024, server.threadGuard / 1024);
+}
 
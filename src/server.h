@@ -34,16 +34,51 @@
 #include "client.h"
 #include "mromfs.h"
 
+#define SERVER_MAX_CPUS         1024
+#define SERVER_MAX_ACCEPTORS    64
+
 struct server_t {
-    int portNumber;
+    int portNumber; /* 0 if TCP is not used. */
     char *resourceDir;
+    char *unixPath; /* Path of Unix socket to listen, NULL if not used. */
 
     int sock;
+    int usock;      /* Unix socket listener, -1 if not used. */
     lua_State *luaState;
-    struct threadMutex_t cmutex;
     struct threadMutex_t lmutex;
     int run;
     int caching;
+    int nworkers;   /* Number of worker threads. */
+    int nacceptors; /* Number of SO_REUSEPORT listeners, 0 if not used. */
+    /* Length of listen queue, listener N takes entry N modulo list length. */
+    int backlog[SERVER_MAX_ACCEPTORS];
+    int nbacklogs;
+    int deferAccept; /* TCP_DEFER_ACCEPT of "-a" listeners in seconds, 0 if not used. */
+    int maxClients; /* Limit of simultaneous connections. */
+    int maxQueue;   /* Requests waiting for worker, 0 if not limited. */
+    int uring;      /* Workers wait on sockets with io_uring. */
+    /* CPUs to pin threads to, thread N takes CPU N modulo list length. */
+    int workerCpus[SERVER_MAX_CPUS];
+    int nworkerCpus;   /* 0 if workers are not pinned. */
+    int acceptorCpus[SERVER_MAX_CPUS];
+    int nacceptorCpus; /* 0 if acceptors are not pinned. */
+    size_t threadStack; /* Stack of workers and acceptors, 0 for default. */
+    size_t threadGuard; /* Guard below stack, 0 for default. */
+    /* Timeouts in seconds, 0 to wait forever. */
+    int headerTimeout; /* Receive of request head. */
+    int bodyTimeout;   /* Inactivity while request is read by worker. */
+    int writeTimeout;  /* Inactivity while response is written. */
+    int idleTimeout;   /* Keep-alive connection without request. */
+    int maxRequests;   /* Requests per connection, 0 if not limited. */
+    int drainTimeout;  /* Time given to connections on graceful stop. */
+    int outputLimit;   /* Output queued per connection before handler waits. */
+    int64_t maxBody;   /* Length of request body, 0 if not limited. */
+
+    char **argv;       /* Arguments of server, used on restart. */
+    char *handoffPath; /* Unix socket used to pass listening sockets. */
+    int inherit;       /* Take listening sockets from running server. */
+    int drain;         /* Request from signal handler, SERVER_DRAIN_... */
+    int draining;      /* Server does not accept and waits for clients. */
 
     struct mromfs_t mromfs;
 };
@@ -53,9 +88,26 @@ extern struct server_t server;
 void serverInit();
 int serverRun();
 void serverDropClient(struct client_t *client);
+void serverDrain();
 
 #define DEFAULT_PORT    8080
 
+#define SERVER_LISTEN_QUEUE_LENGTH    100
+#define SERVER_DEFER_ACCEPT           5
+
+#define SERVER_HEADER_TIMEOUT         10
+#define SERVER_BODY_TIMEOUT           30
+#define SERVER_WRITE_TIMEOUT          30
+#define SERVER_IDLE_TIMEOUT           15
+#define SERVER_MAX_REQUESTS           1000
+#define SERVER_DRAIN_TIMEOUT          30
+#define SERVER_OUTPUT_LIMIT           (256 * 1024)
+#define SERVER_MAX_BODY               (16 * 1024 * 1024)
+#define SERVER_MAX_QUEUE              1024
+
+#define SERVER_DRAIN_STOP             1
+#define SERVER_DRAIN_RESTART          2
+
 
 #endif
 
@@ -25,25 +25,23 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *
  */
-#ifdef WINDOWS
-    #include <windows.h>
-#else
-    #include <pthread.h>
-    #include <sys/select.h>
-    #include <sys/time.h>
-    #include <sys/socket.h>
-#endif
+#define _GNU_SOURCE /* pthread_attr_setaffinity_np() */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <string.h>
 /* */
 #include "thread.h"
 /* */
 #include "debug.h"
 
-#ifdef WINDOWS
-    #define THREAD_RUN_WRAP(name, argName) DWORD WINAPI name(LPVOID argName)
-#else
-    #define THREAD_RUN_WRAP(name, argName) void *name(void *argName)
-
-#endif
+#define THREAD_RUN_WRAP(name, argName) void *name(void *argName)
 
 static THREAD_RUN_WRAP(thread_Run, arg);
 static void thread_Stop(void *arg);
@@ -53,12 +51,11 @@ static void thread_Stop(void *arg);
  */
 void threadInit(struct thread_t *thread)
 {
-#ifdef WINDOWS
-    thread->cancelEvent = NULL;
-    thread->stopEvent   = NULL;
-    thread->wsaSockReadEvent = WSA_INVALID_EVENT;
-    thread->wsaSockWriteEvent = WSA_INVALID_EVENT;
-#endif
+    thread->cpu       = -1;
+    thread->stackSize = 0;
+    thread->guardSize = 0;
+    thread->stackLow  = NULL;
+    thread->stackHigh = NULL;
 }
 /*
  * RETURN
@@ -66,95 +63,125 @@ void threadInit(struct thread_t *thread)
  */
 int threadCreate(struct thread_t *thread, ThreadRun run, ThreadStop stop, void *arg)
 {
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+    int r;
+
     thread->stop = stop;
     thread->run  = run;
     thread->arg  = arg;
-#ifdef WINDOWS
-    thread->cancelEvent = CreateEvent(
-        NULL,  /* LPSECURITY_ATTRIBUTES lpEventAttributes, */
-        FALSE, /* BOOL                  bManualReset, */
-        FALSE, /* BOOL                  bInitialState, */
-        NULL   /* LPCSTR                lpName */
-    );
-    thread->stopEvent = CreateEvent(
-        NULL,  /* LPSECURITY_ATTRIBUTES lpEventAttributes, */
-        FALSE, /* BOOL                  bManualReset, */
-        FALSE, /* BOOL                  bInitialState, */
-        NULL   /* LPCSTR                lpName */
-    );
-    if (thread->cancelEvent == NULL || thread->stopEvent == NULL)
-    {
-        debugPrint(DLEVEL_ERROR, "Events creation failed");
-        goto error;
-    }
-    thread->thread = CreateThread(
-        NULL,        /* LPSECURITY_ATTRIBUTES   lpThreadAttributes, */
-        0,           /* SIZE_T                  dwStackSize, */
-        thread_Run,  /* LPTHREAD_START_ROUTINE  lpStartAddress, */
-        thread,      /* __drv_aliasesMem LPVOID lpParameter, */
-        0,           /* DWORD                   dwCreationFlags, */
-        NULL         /* LPDWORD                 lpThreadId */
-    );
-    if (thread->thread == NULL)
+    if (pthread_attr_init(&attr) != 0)
+        return -1;
+    if (thread->cpu >= 0)
     {
-        debugPrint(DLEVEL_ERROR, "Thread creation failed");
-        goto error;
+        CPU_ZERO(&cpus);
+        CPU_SET(thread->cpu, &cpus);
+        if (pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus) != 0)
+            debugPrint(DLEVEL_WARNING, "Failed to pin thread to CPU %d", thread->cpu);
     }
-    return 0;
-error:
-    if (thread->stopEvent)
-        CloseHandle(thread->stopEvent);
-    if (thread->cancelEvent)
-        CloseHandle(thread->cancelEvent);
-    return -1;
-#else
-    if (pthread_create(&thread->thread, NULL, thread_Run, thread) != 0)
+    if (thread->stackSize && pthread_attr_setstacksize(&attr, thread->stackSize) != 0)
+        debugPrint(DLEVEL_WARNING, "Invalid thread stack size %zu", thread->stackSize);
+    if (thread->guardSize && pthread_attr_setguardsize(&attr, thread->guardSize) != 0)
+        debugPrint(DLEVEL_WARNING, "Invalid thread guard size %zu", thread->guardSize);
+    r = pthread_create(&thread->thread, &attr, thread_Run, thread);
+    pthread_attr_destroy(&attr);
+    if (r != 0)
         return -1;
     else
         return 0;
-#endif
+}
+/*
+ * Pin thread to CPU, should be called before threadCreate().
+ */
+void threadSetCpu(struct thread_t *thread, int cpu)
+{
+    thread->cpu = cpu;
+}
+/*
+ * Set stack of thread, should be called before threadCreate(). Size is
+ * rounded up to page size and to PTHREAD_STACK_MIN.
+ *
+ * ARGS
+ *     size     Stack size in bytes, 0 for system default.
+ *     guard    Size of inaccessible area below stack, 0 for system default.
+ */
+void threadSetStack(struct thread_t *thread, size_t size, size_t guard)
+{
+    size_t page;
+
+    page = sysconf(_SC_PAGESIZE);
+    if (size && size < (size_t)PTHREAD_STACK_MIN)
+        size = (size_t)PTHREAD_STACK_MIN;
+    size  = (size + page - 1) & ~(page - 1);
+    guard = (guard + page - 1) & ~(page - 1);
+    thread->stackSize = size;
+    thread->guardSize = guard;
+}
+/*
+ * Fill unused part of stack of calling thread with pattern, so stack
+ * high-water mark can be measured with threadStackUsed(). Should be called
+ * at start of thread, only when stack size is set (pattern makes whole
+ * stack resident).
+ */
+#define THREAD_STACK_PATTERN    0xa5
+#define THREAD_STACK_MARGIN     1024 /* Not painted below stack pointer. */
+void threadStackPaint(struct thread_t *thread)
+{
+    pthread_attr_t attr;
+    size_t size, guard;
+    void *addr;
+    char *low, *high;
+
+    if (pthread_getattr_np(pthread_self(), &attr) != 0)
+        return;
+    if (pthread_attr_getstack(&attr, &addr, &size) != 0 ||
+            pthread_attr_getguardsize(&attr, &guard) != 0)
+    {
+        pthread_attr_destroy(&attr);
+        return;
+    }
+    pthread_attr_destroy(&attr);
+
+    /* NOTE Guard is reported as part of stack. */
+    low  = (char *)addr + guard;
+    high = (char *)__builtin_frame_address(0) - THREAD_STACK_MARGIN;
+    if (high <= low)
+        return;
+    memset(low, THREAD_STACK_PATTERN, high - low);
+    thread->stackLow  = low;
+    thread->stackHigh = (char *)addr + size;
 }
 /*
  * RETURN
- *     0 on success, -1 on error.
+ *     Maximal stack depth of thread since threadStackPaint(), 0 if stack
+ *     was not painted.
  */
-int threadInitSock(struct thread_t *thread, int sockfd)
+size_t threadStackUsed(struct thread_t *thread)
 {
-#ifdef WINDOWS
-    thread->wsaSockReadEvent = WSACreateEvent();
-    thread->wsaSockWriteEvent = WSACreateEvent();
-    if (thread->wsaSockReadEvent  == WSA_INVALID_EVENT ||
-        thread->wsaSockWriteEvent == WSA_INVALID_EVENT)
+    volatile char *p;
+
+    if (!thread->stackLow)
+        return 0;
+    for (p = thread->stackLow; p < thread->stackHigh; p++)
     {
-        debugPrint(DLEVEL_ERROR, "WSACreateEvent failed");
-        goto error;
+        if ((unsigned char)*p != THREAD_STACK_PATTERN)
+            break;
     }
-    return 0;
-error:
-    if (thread->wsaSockReadEvent != WSA_INVALID_EVENT)
-        WSACloseEvent(thread->wsaSockReadEvent);
-    if (thread->wsaSockWriteEvent != WSA_INVALID_EVENT)
-        WSACloseEvent(thread->wsaSockWriteEvent);
-    return -1;
-#else
-    return 0;
-#endif
+    return thread->stackHigh - (char *)p;
+}
+/*
+ * RETURN
+ *     Number of configured CPUs.
+ */
+int threadCpuCount()
+{
+    return sysconf(_SC_NPROCESSORS_CONF);
 }
 /*
  *
  */
 static THREAD_RUN_WRAP(thread_Run, arg)
 {
-#ifdef WINDOWS
-    struct thread_t *thread;
-
-    thread = arg;
-
-    thread->run(thread->arg);
-    thread_Stop(thread);
-
-    return 0;
-#else
     int r;
     int oldstate, oldtype;
     struct thread_t *thread;
@@ -184,24 +211,7 @@ static THREAD_RUN_WRAP(thread_Run, arg)
         debugPrint(DLEVEL_ERROR, "Thread detach failed, (%d).", r);
 
     return NULL;
-#endif
 }
-#ifdef WINDOWS
-/*
- *
- */
-static void thread_Clean(struct thread_t *thread)
-{
-    if (thread->stopEvent)
-        CloseHandle(thread->stopEvent);
-    if (thread->cancelEvent)
-        CloseHandle(thread->cancelEvent);
-    if (thread->wsaSockReadEvent != WSA_INVALID_EVENT)
-        WSACloseEvent(thread->wsaSockReadEvent);
-    if (thread->wsaSockWriteEvent != WSA_INVALID_EVENT)
-        WSACloseEvent(thread->wsaSockWriteEvent);
-}
-#endif
 /*
  *
  */
@@ -213,44 +223,12 @@ static void thread_Stop(void *arg)
 
     if (thread->stop)
         thread->stop(thread->arg);
-#ifdef WINDOWS
-    if (!SetEvent(thread->stopEvent))
-    {
-        /* NOTREACHED */
-        debugPrint(DLEVEL_ERROR, "SetEvent failed (stop)");
-    }
-    /* Was cancel, clean-up will be done by threadCancel */
-    if (WaitForSingleObject(thread->cancelEvent, 0) == WAIT_OBJECT_0)
-    {
-
-    } else {
-        thread_Clean(thread);
-    }
-#endif
 }
 /*
  * Cancel thread.
  */
 void threadCancel(struct thread_t *thread)
 {
-#ifdef WINDOWS
-    DWORD res;
-
-    if (!SetEvent(thread->cancelEvent))
-    {
-        /* NOTREACHED */
-        debugPrint(DLEVEL_ERROR, "SetEvent failed (cancel)");
-    }
-
-    res = WaitForSingleObject(thread->stopEvent, INFINITE);
-    if (res == WAIT_OBJECT_0)
-    {
-        thread_Clean(thread);
-    } else if (res != WAIT_TIMEOUT) {
-        /* NOTREACHED */
-        debugPrint(DLEVEL_ERROR, "Wait for stopEvent failed, %d", GetLastError());
-    }
-#else
     int r;
 
     r = pthread_cancel(thread->thread);
@@ -264,27 +242,12 @@ void threadCancel(struct thread_t *thread)
         /* NOTREACHED */
         debugPrint(DLEVEL_ERROR, "Thread join failed, (%d).", r);
     }
-#endif
 }
 /*
  *
  */
 void threadSleepMs(struct thread_t *thread, int ms)
 {
-#ifdef WINDOWS
-    DWORD res;
-
-    res = WaitForSingleObject(thread->cancelEvent, ms);
-    if (res == WAIT_OBJECT_0)
-    {
-        thread_Stop(thread);
-        ExitThread(0);
-        /* NOTREACHED */
-    } else if (res != WAIT_TIMEOUT) {
-        /* NOTREACHED */
-        debugPrint(DLEVEL_ERROR, "Wait for cancelEvent failed");
-    }
-#else
     int s;
     struct timeval timeout;
 
@@ -297,93 +260,13 @@ void threadSleepMs(struct thread_t *thread, int ms)
         /* NOTREACHED */
         debugPrint(DLEVEL_ERROR, "select failed, %s", __FUNCTION__);
     }
-#endif
-}
-/*
- *
- */
-ssize_t threadRecv(struct thread_t *thread, int sockfd, void *buf, size_t len, int flags)
-{
-#ifdef WINDOWS
-    WSAEVENT events[2];
-    DWORD res;
-
-    if (WSAEventSelect(sockfd, thread->wsaSockReadEvent, FD_READ | FD_OOB) == SOCKET_ERROR)
-    {
-        debugPrint(DLEVEL_ERROR, "WSAEventSelect failed");
-        return -1;
-    }
-
-    events[0] = thread->cancelEvent;
-    events[1] = thread->wsaSockReadEvent;
-
-    res = WSAWaitForMultipleEvents(
-        2, events, FALSE, WSA_INFINITE, FALSE);
-    if (res == WSA_WAIT_EVENT_0 /* cancel */)
-    {
-        thread_Stop(thread);
-        ExitThread(0);
-        /* NOTREACHED */
-        return -1;
-    } else if (res == (WSA_WAIT_EVENT_0 + 1) /* socket have data */) {
-        WSAResetEvent(thread->wsaSockReadEvent);
-        return recv(sockfd, buf, len, flags);
-    } else {
-        /* NOTREACHED */
-        debugPrint(DLEVEL_ERROR, "WSAWaitForMultipleEvents failed");
-        return (ssize_t)-1;
-    }
-#else
-    return recv(sockfd, buf, len, flags);
-#endif
-}
-/*
- *
- */
-ssize_t threadSend(struct thread_t *thread, int sockfd, const void *buf, size_t len, int flags)
-{
-#ifdef WINDOWS
-    WSAEVENT events[2];
-    DWORD res;
-
-    if (WSAEventSelect(sockfd, thread->wsaSockWriteEvent, FD_WRITE) == SOCKET_ERROR)
-    {
-        debugPrint(DLEVEL_ERROR, "WSAEventSelect failed");
-        return -1;
-    }
-
-    events[0] = thread->cancelEvent;
-    events[1] = thread->wsaSockWriteEvent;
-
-    res = WSAWaitForMultipleEvents(
-        2, events, FALSE, WSA_INFINITE, FALSE);
-    if (res == WSA_WAIT_EVENT_0 /* cancel */)
-    {
-        thread_Stop(thread);
-        ExitThread(0);
-        /* NOTREACHED */
-        return -1;
-    } else if (res == (WSA_WAIT_EVENT_0 + 1) /* socket is writable */) {
-        WSAResetEvent(thread->wsaSockWriteEvent);
-        return send(sockfd, buf, len, flags);
-    } else {
-        /* NOTREACHED */
-        debugPrint(DLEVEL_ERROR, "WSAWaitForMultipleEvents failed");
-        return (ssize_t)-1;
-    }
-#else
-    return send(sockfd, buf, len, flags);
-#endif
 }
 /*
  *
  */
 void threadMutexFill(struct threadMutex_t *mutex)
 {
-#ifdef WINDOWS
-#else
     mutex->pmutex = NULL;
-#endif
 }
 /*
  * RETURN
@@ -391,13 +274,6 @@ void threadMutexFill(struct threadMutex_t *mutex)
  */
 int threadMutexInit(struct threadMutex_t *mutex)
 {
-#ifdef WINDOWS
-    mutex->mutex = CreateMutex(NULL, FALSE, NULL);
-    if (mutex->mutex != NULL)
-        return 0;
-    else
-        return -1;
-#else
     if (pthread_mutex_init(&mutex->mutex, NULL) == 0)
     {
         mutex->pmutex = &mutex->mutex;
@@ -406,22 +282,13 @@ int threadMutexInit(struct threadMutex_t *mutex)
         mutex->pmutex = NULL;
         return -1;
     }
-#endif
 }
 /*
  */
 void threadMutexDestroy(struct threadMutex_t *mutex)
 {
-#ifdef WINDOWS
-    if (mutex->mutex)
-    {
-        if (!CloseHandle(mutex->mutex))
-            debugPrint(DLEVEL_ERROR, "Failed to destroy mutex");
-    }
-#else
     if (mutex->pmutex)
         pthread_mutex_destroy(mutex->pmutex);
-#endif
 
 }
 /*
@@ -430,18 +297,7 @@ void threadMutexDestroy(struct threadMutex_t *mutex)
 void threadMutexLock(struct threadMutex_t *mutex)
 {
     int res;
-#ifdef WINDOWS
-    DWORD wres;
-
-    wres = WaitForSingleObject(mutex->mutex, INFINITE);
-    if (wres != WAIT_OBJECT_0)
-        res = -1;
-    else
-        res = 0;
-
-#else
     res = pthread_mutex_lock(mutex->pmutex);
-#endif
 
     if (res != 0)
         debugPrint(DLEVEL_ERROR, "Failed to lock mutex");
@@ -452,16 +308,65 @@ void threadMutexLock(struct threadMutex_t *mutex)
 void threadMutexUnlock(struct threadMutex_t *mutex)
 {
     int res;
-#ifdef WINDOWS
-    if (!ReleaseMutex(mutex->mutex))
-        res = -1;
-    else
-        res = 0;
-#else
     res = pthread_mutex_unlock(mutex->pmutex);
-#endif
 
     if (res != 0)
         debugPrint(DLEVEL_ERROR, "Failed to lock mutex");
 }
+/*
+ *
+ */
+void threadSemFill(struct threadSem_t *sem)
+{
+    sem->psem = NULL;
+}
+/*
+ * ARGS
+ *     sem      Pointer to semaphore structure.
+ *     value    Initial value of semaphore.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+int threadSemInit(struct threadSem_t *sem, unsigned int value)
+{
+    if (sem_init(&sem->sem, 0, value) == 0)
+    {
+        sem->psem = &sem->sem;
+        return 0;
+    } else {
+        sem->psem = NULL;
+        return -1;
+    }
+}
+/*
+ *
+ */
+void threadSemDestroy(struct threadSem_t *sem)
+{
+    if (sem->psem)
+        sem_destroy(sem->psem);
+}
+/*
+ * Wait for semaphore. Cancelation point.
+ */
+void threadSemWait(struct threadSem_t *sem)
+{
+    int res;
+    while ((res = sem_wait(sem->psem)) != 0 && errno == EINTR)
+        ;
 
+    if (res != 0)
+        debugPrint(DLEVEL_ERROR, "Failed to wait semaphore");
+}
+/*
+ *
+ */
+void threadSemPost(struct threadSem_t *sem)
+{
+    int res;
+    res = sem_post(sem->psem);
+
+    if (res != 0)
+        debugPrint(DLEVEL_ERROR, "Failed to post semaphore");
+}
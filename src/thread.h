@@ -28,58 +28,47 @@
 #ifndef _THREAD_H
 #define _THREAD_H
 
-#ifdef WINDOWS
-    #include <windows.h>
-#else
-    #include <pthread.h>
-#endif
+#include <pthread.h>
+#include <semaphore.h>
 #include <sys/types.h>
 
 struct threadMutex_t {
-#ifdef WINDOWS
-    HANDLE mutex;
-#else
     pthread_mutex_t mutex;
     pthread_mutex_t *pmutex;
-#endif
+};
+
+struct threadSem_t {
+    sem_t sem;
+    sem_t *psem;
 };
 
 typedef void(*ThreadRun)(void *);
 #define THREAD_RUN(name, argName) void name(void *argName)
-#ifdef WINDOWS
-typedef void (*ThreadStop)(LPVOID);
-#define THREAD_STOP(name, argName) void name(LPVOID argName)
-#define THREAD_RETURN(value) return (LPVOID)(value)
-#else
 typedef void (*ThreadStop)(void *);
 #define THREAD_STOP(name, argName) void name(void *argName)
 #define THREAD_RETURN(value) return (void *)(value)
-#endif
 
 struct thread_t {
-#ifdef WINDOWS
-    HANDLE thread;
-    HANDLE cancelEvent;
-    HANDLE stopEvent;
-    LPVOID arg;
-
-    WSAEVENT wsaSockReadEvent;
-    WSAEVENT wsaSockWriteEvent;
-#else
     pthread_t thread;
     void *arg;
-#endif
     ThreadStop stop;
     ThreadRun run;
+    int cpu; /* CPU to run on, -1 if not pinned. */
+    size_t stackSize; /* Stack size, 0 for system default. */
+    size_t guardSize; /* Guard below stack, 0 for system default. */
+    char *stackLow;   /* Painted part of stack, see threadStackPaint(). */
+    char *stackHigh;
 };
 
 void threadInit(struct thread_t *thread);
 int threadCreate(struct thread_t *thread, ThreadRun run, ThreadStop stop, void *arg);
+void threadSetCpu(struct thread_t *thread, int cpu);
+void threadSetStack(struct thread_t *thread, size_t size, size_t guard);
+void threadStackPaint(struct thread_t *thread);
+size_t threadStackUsed(struct thread_t *thread);
+int threadCpuCount();
 void threadCancel(struct thread_t *thread);
 void threadSleepMs(struct thread_t *thread, int ms);
-int threadInitSock(struct thread_t *thread, int sockfd);
-ssize_t threadRecv(struct thread_t *thread, int sockfd, void *buf, size_t len, int flags);
-ssize_t threadSend(struct thread_t *thread, int sockfd, const void *buf, size_t len, int flags);
 
 void threadMutexFill(struct threadMutex_t *mutex);
 int threadMutexInit(struct threadMutex_t *mutex);
@@ -87,5 +76,11 @@ void threadMutexDestroy(struct threadMutex_t *mutex);
 void threadMutexLock(struct threadMutex_t *mutex);
 void threadMutexUnlock(struct threadMutex_t *mutex);
 
+void threadSemFill(struct threadSem_t *sem);
+int threadSemInit(struct threadSem_t *sem, unsigned int value);
+void threadSemDestroy(struct threadSem_t *sem);
+void threadSemWait(struct threadSem_t *sem);
+void threadSemPost(struct threadSem_t *sem);
+
 #endif
 
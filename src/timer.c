@@ -0,0 +1,205 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <time.h>
+/* */
+#include "timer.h"
+
+static void timer_Insert(struct timerWheel_t *wheel, struct timerNode_t *timer);
+static void timer_Splice(struct timerNode_t *slot, struct timerNode_t *list);
+static void timer_Cascade(struct timerWheel_t *wheel, int level);
+
+/*
+ * RETURN
+ *     Current value of monotonic clock in ticks.
+ */
+uint64_t timerTicks()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / TIMER_TICK_MS;
+}
+/*
+ *
+ */
+void timerWheelInit(struct timerWheel_t *wheel)
+{
+    struct timerNode_t *slot;
+    int i, j;
+
+    for (i = 0; i < TIMER_LEVELS; i++)
+    {
+        for (j = 0; j < TIMER_LEVEL_SIZE; j++)
+        {
+            slot = &wheel->slots[i][j];
+            slot->next = slot;
+            slot->prev = slot;
+        }
+    }
+    wheel->now   = timerTicks();
+    wheel->count = 0;
+}
+/*
+ *
+ */
+void timerInit(struct timerNode_t *timer, void (*func)(void *arg), void *arg)
+{
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->func = func;
+    timer->arg  = arg;
+}
+/*
+ * Start timer, or restart it if timer is pending.
+ *
+ * ARGS
+ *     ms    Timeout in milliseconds, rounded up to tick.
+ */
+void timerAdd(struct timerWheel_t *wheel, struct timerNode_t *timer, uint64_t ms)
+{
+    if (timerPending(timer))
+        timerDel(wheel, timer);
+    timer->expire = timerTicks() + (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    timer_Insert(wheel, timer);
+    wheel->count++;
+}
+/*
+ * Stop timer. Stopping of not pending timer is allowed.
+ */
+void timerDel(struct timerWheel_t *wheel, struct timerNode_t *timer)
+{
+    if (!timerPending(timer))
+        return;
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+    wheel->count--;
+}
+/*
+ * Process all ticks up to current time and call functions of expired
+ * timers. Function of timer may add or delete any timer.
+ */
+void timerAdvance(struct timerWheel_t *wheel)
+{
+    struct timerNode_t list;
+    struct timerNode_t *timer;
+    uint64_t ticks;
+    int level;
+
+    ticks = timerTicks();
+    while (wheel->now <= ticks)
+    {
+        /*
+         * When lower level wraps, timers of next slot of upper level are
+         * distributed over lower levels.
+         */
+        if ((wheel->now & TIMER_LEVEL_MASK) == 0)
+        {
+            for (level = 1; level < TIMER_LEVELS; level++)
+            {
+                timer_Cascade(wheel, level);
+                if (((wheel->now >> (level * TIMER_LEVEL_BITS)) & TIMER_LEVEL_MASK) != 0)
+                    break;
+            }
+        }
+
+        timer_Splice(&wheel->slots[0][wheel->now & TIMER_LEVEL_MASK], &list);
+        wheel->now++;
+        while (list.next != &list)
+        {
+            timer = list.next;
+            timerDel(wheel, timer);
+            (*timer->func)(timer->arg);
+        }
+    }
+}
+/*
+ * Put timer in slot according to distance to expiration tick.
+ */
+static void timer_Insert(struct timerWheel_t *wheel, struct timerNode_t *timer)
+{
+    struct timerNode_t *slot;
+    uint64_t delta;
+    int level;
+
+    if (timer->expire < wheel->now)
+        timer->expire = wheel->now;
+    delta = timer->expire - wheel->now;
+    for (level = 0; level < TIMER_LEVELS - 1; level++)
+    {
+        if (delta < ((uint64_t)1 << ((level + 1) * TIMER_LEVEL_BITS)))
+            break;
+    }
+    /* NOTE Timeout beyond range of wheel is shortened to fit. */
+    if (level == TIMER_LEVELS - 1 &&
+            delta >= ((uint64_t)1 << (TIMER_LEVELS * TIMER_LEVEL_BITS)))
+        timer->expire = wheel->now + ((uint64_t)1 << (TIMER_LEVELS * TIMER_LEVEL_BITS)) - 1;
+
+    slot = &wheel->slots[level][(timer->expire >> (level * TIMER_LEVEL_BITS)) & TIMER_LEVEL_MASK];
+    timer->prev      = slot->prev;
+    timer->next      = slot;
+    slot->prev->next = timer;
+    slot->prev       = timer;
+}
+/*
+ * Move all timers of slot to list.
+ */
+static void timer_Splice(struct timerNode_t *slot, struct timerNode_t *list)
+{
+    if (slot->next == slot)
+    {
+        list->next = list;
+        list->prev = list;
+        return;
+    }
+    list->next       = slot->next;
+    list->prev       = slot->prev;
+    list->next->prev = list;
+    list->prev->next = list;
+    slot->next = slot;
+    slot->prev = slot;
+}
+/*
+ *
+ */
+static void timer_Cascade(struct timerWheel_t *wheel, int level)
+{
+    struct timerNode_t list;
+    struct timerNode_t *timer;
+
+    timer_Splice(&wheel->slots[level][(wheel->now >> (level * TIMER_LEVEL_BITS)) & TIMER_LEVEL_MASK], &list);
+    while (list.next != &list)
+    {
+        timer = list.next;
+        list.next         = timer->next;
+        timer->next->prev = &list;
+        timer_Insert(wheel, timer);
+    }
+}
+
@@ -0,0 +1,67 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <stdint.h>
+
+/*
+ * Hierarchical timer wheel. Wheel is not thread safe, it must be used by one
+ * thread only.
+ */
+struct timerNode_t {
+    struct timerNode_t *next; /* NULL if timer is not pending. */
+    struct timerNode_t *prev;
+    uint64_t expire;          /* Tick of expiration. */
+    void (*func)(void *arg);  /* Called when timer expires. */
+    void *arg;
+};
+
+#define TIMER_TICK_MS       100
+#define TIMER_LEVEL_BITS    6
+#define TIMER_LEVEL_SIZE    (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVEL_MASK    (TIMER_LEVEL_SIZE - 1)
+#define TIMER_LEVELS        4
+
+struct timerWheel_t {
+    uint64_t now; /* Next tick to be processed. */
+    int count;    /* Number of pending timers. */
+    struct timerNode_t slots[TIMER_LEVELS][TIMER_LEVEL_SIZE];
+};
+
+uint64_t timerTicks();
+void timerWheelInit(struct timerWheel_t *wheel);
+void timerInit(struct timerNode_t *timer, void (*func)(void *arg), void *arg);
+void timerAdd(struct timerWheel_t *wheel, struct timerNode_t *timer, uint64_t ms);
+void timerDel(struct timerWheel_t *wheel, struct timerNode_t *timer);
+void timerAdvance(struct timerWheel_t *wheel);
+
+#define timerPending(timer)    ((timer)->next != NULL)
+
+#endif
+
@@ -28,43 +28,27 @@
 #ifndef _TOKEN_H
 #define _TOKEN_H
 
-struct token_t {
-    int (*getChars)(char *, int, void *);
-    void *getCharsArg;
+#include <stdint.h>
 
-#define TOKEN_BUF_SIZE    1024
-#if 0
-    char *buf;       /* Trace buffer. */
-    int bufSize;     /* Size of trace buffer. */
-#else
-    char buf[TOKEN_BUF_SIZE]; /* Trace buffer. */
-#endif
-    int nBufChars;     /* Number of characters in trace buffer */
-    int nDroppedChars; /* Number of dropped characters in trace buffer */
-    int nRead;
-
-#define TOKENS_MAX   2
-    struct token_info_t {
-        int lenw; /* Length of whole token in trace buffer. */
-        int lenp; /* Length of payload of token in trace buffer. */
-        char *p;  /* Pointer to payload of token in trace buffer. */
-    } tinfo[TOKENS_MAX];
-    int nTokens; /* Number of remembered tokens */
+/*
+ * Grammar of tokens. Each character belongs to one or more classes, each
+ * class is one bit in "classes" table. Token of given type consists of one
+ * character of "first" classes followed by characters of "next" classes.
+ */
+struct tokenGrammar_t {
+    const uint32_t *classes; /* Classes of every character, 256 entries. */
+    const struct tokenRule_t {
+        uint32_t first; /* Classes allowed for first character. */
+        uint32_t next;  /* Classes allowed for other characters. */
+        int min;        /* Minimum length of token. */
+        int max;        /* Maximum length of token, zero if unlimited. */
+    } *rules;                /* Rules indexed by token type. */
 };
 
-int tokenInit(struct token_t *token,
-        int (*getChars)(char *, int, void *), void *getCharsArg);
-void tokenReset(struct token_t *token);
-char * tokenGet(struct token_t *token, int *tlength, int *eof,
-        int (*analyze)(struct token_info_t *, char*, int),
-        int (*postAnalyze)(struct token_info_t *, int),
-        int type);
-int tokenGetRemainedData(struct token_t *token, char *buf, int len);
-#if 0
-void tokenUnget(struct token_t *token, int n);
-#endif
-void tokenDrop(struct token_t *token);
-void tokenDestroy(struct token_t *token);
+/* Token continues past end of data, more data is needed to match it. */
+#define TOKEN_MORE    (-1)
+
+int tokenMatch(const struct tokenGrammar_t *grammar, int type, const char *buf, int len);
 
 #endif
 
@@ -0,0 +1,467 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+/* */
+#include "uring.h"
+/* */
+#include "debug.h"
+
+#define URING_BUFFER_GROUP    0
+
+static int uring_Probe(struct uring_t *ring);
+static struct io_uring_sqe *uring_Get(struct uring_t *ring, int opcode, int fd);
+static void uring_Link(struct uring_t *ring);
+static void uring_Timeout(struct uring_t *ring, struct __kernel_timespec *ts, int timeout);
+static int uring_Enter(struct uring_t *ring, struct io_uring_cqe *cqes);
+static int uring_Result(struct io_uring_cqe *cqe, struct io_uring_cqe *timeout);
+
+/*
+ * ARGS
+ *     bufferSize    Size of buffers provided to kernel, see uringRecvBuffer().
+ *
+ * RETURN
+ *     0 on success, -1 if io_uring is not available.
+ */
+int uringInit(struct uring_t *ring, size_t bufferSize)
+{
+#ifdef __NR_io_uring_setup
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(ring, 0, sizeof(struct uring_t));
+    ring->bufferSize = bufferSize;
+    ring->sqRing = MAP_FAILED;
+    ring->cqRing = MAP_FAILED;
+    ring->sqes   = MAP_FAILED;
+
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (ring->fd < 0)
+    {
+        debugPrint(DLEVEL_WARNING, "io_uring setup failed, %s", strerror(errno));
+        return -1;
+    }
+    if (uring_Probe(ring) < 0)
+    {
+        debugPrint(DLEVEL_WARNING, "%s", "io_uring of kernel is too old");
+        uringDestroy(ring);
+        return -1;
+    }
+
+    ring->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize   = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes   = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED ||
+            ring->sqes == MAP_FAILED)
+    {
+        debugPrint(DLEVEL_WARNING, "io_uring mmap failed, %s", strerror(errno));
+        uringDestroy(ring);
+        return -1;
+    }
+
+    sq = ring->sqRing;
+    cq = ring->cqRing;
+    ring->sqHead  = (unsigned *)(sq + p.sq_off.head);
+    ring->sqTail  = (unsigned *)(sq + p.sq_off.tail);
+    ring->sqMask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sqArray = (unsigned *)(sq + p.sq_off.array);
+    ring->cqHead  = (unsigned *)(cq + p.cq_off.head);
+    ring->cqTail  = (unsigned *)(cq + p.cq_off.tail);
+    ring->cqMask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes    = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return 0;
+#else
+    ring->fd = -1;
+    debugPrint(DLEVEL_WARNING, "%s", "io_uring is not supported");
+    return -1;
+#endif
+}
+/*
+ * Check that kernel supports every opcode submitted by this file.
+ * IORING_OP_RECV and IORING_OP_PROVIDE_BUFFERS appeared later than
+ * io_uring itself, so features of io_uring_setup() are not enough to tell.
+ *
+ * RETURN
+ *     0 if all opcodes are supported, -1 otherwise.
+ */
+static int uring_Probe(struct uring_t *ring)
+{
+    static const int opcodes[] = {
+        IORING_OP_RECV,
+        IORING_OP_POLL_ADD,
+        IORING_OP_LINK_TIMEOUT,
+        IORING_OP_PROVIDE_BUFFERS,
+        IORING_OP_SENDMSG,
+        IORING_OP_CLOSE,
+    };
+    struct io_uring_probe *probe;
+    size_t i;
+    int res;
+
+    probe = calloc(1, sizeof(struct io_uring_probe) +
+            IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+    if (!probe)
+        return -1;
+
+    res = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE,
+            probe, IORING_OP_LAST);
+    if (res < 0)
+    {
+        /* EINVAL here means kernel without IORING_REGISTER_PROBE (< 5.6). */
+        free(probe);
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(opcodes) / sizeof(opcodes[0]); i++)
+    {
+        if (opcodes[i] > probe->last_op ||
+                !(probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED))
+        {
+            res = -1;
+            break;
+        }
+    }
+
+    free(probe);
+    return res < 0 ? -1 : 0;
+}
+/*
+ *
+ */
+void uringDestroy(struct uring_t *ring)
+{
+    int i;
+
+    if (ring->sqes != MAP_FAILED && ring->sqes)
+        munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != MAP_FAILED && ring->cqRing)
+        munmap(ring->cqRing, ring->cqRingSize);
+    if (ring->sqRing != MAP_FAILED && ring->sqRing)
+        munmap(ring->sqRing, ring->sqRingSize);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    /* NOTE Buffers still provided to kernel are released with ring. */
+    for (i = 0; i < URING_BUFFERS; i++)
+        free(ring->buffers[i]);
+    memset(ring, 0, sizeof(struct uring_t));
+    ring->fd = -1;
+}
+/*
+ * Receive from socket, wait for data if there is none.
+ *
+ * ARGS
+ *     timeout    Timeout in seconds, 0 to wait forever.
+ *
+ * RETURN
+ *     Number of received bytes, -1 on error (errno is ETIMEDOUT on timeout).
+ */
+ssize_t uringRecv(struct uring_t *ring, int fd, void *buf, size_t len, int timeout)
+{
+    struct io_uring_cqe cqes[URING_ENTRIES];
+    struct __kernel_timespec ts;
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_Get(ring, IORING_OP_RECV, fd);
+    sqe->addr = (unsigned long)buf;
+    sqe->len  = len;
+    uring_Timeout(ring, &ts, timeout);
+    if (uring_Enter(ring, cqes) < 0)
+        return -1;
+    return uring_Result(&cqes[0], timeout ? &cqes[1] : NULL);
+}
+/*
+ * Receive from socket to buffer picked by kernel from buffers provided to
+ * ring, see uringRecv(). Buffers taken by previous calls are allocated
+ * again and provided in same submission, before receive.
+ *
+ * ARGS
+ *     buf    Set to received data, buffer of ring->bufferSize bytes
+ *            allocated with malloc(), caller frees it. NULL if nothing is
+ *            received.
+ *
+ * RETURN
+ *     Number of received bytes, -1 on error (errno is ETIMEDOUT on timeout).
+ */
+ssize_t uringRecvBuffer(struct uring_t *ring, int fd, char **buf, int timeout)
+{
+    struct io_uring_cqe cqes[URING_ENTRIES];
+    struct __kernel_timespec ts;
+    struct io_uring_sqe *sqe;
+    int slots[URING_BUFFERS];
+    int i, n, bid;
+    ssize_t res;
+
+    n = 0;
+    for (i = 0; i < URING_BUFFERS; i++)
+    {
+        if (ring->buffers[i])
+            continue;
+        ring->buffers[i] = malloc(ring->bufferSize);
+        if (!ring->buffers[i])
+            continue;
+        sqe = uring_Get(ring, IORING_OP_PROVIDE_BUFFERS, 1);
+        sqe->addr      = (unsigned long)ring->buffers[i];
+        sqe->len       = ring->bufferSize;
+        sqe->off       = i;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        slots[n++] = i;
+    }
+
+    sqe = uring_Get(ring, IORING_OP_RECV, fd);
+    sqe->len       = ring->bufferSize;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    uring_Timeout(ring, &ts, timeout);
+    if (uring_Enter(ring, cqes) < 0)
+        return -1;
+
+    for (i = 0; i < n; i++)
+    {
+        if (cqes[i].res >= 0)
+            continue;
+        debugPrint(DLEVEL_WARNING, "io_uring provide buffer failed, %s", strerror(-cqes[i].res));
+        free(ring->buffers[slots[i]]);
+        ring->buffers[slots[i]] = NULL;
+    }
+
+    res  = uring_Result(&cqes[n], timeout ? &cqes[n + 1] : NULL);
+    *buf = NULL;
+    if (cqes[n].flags & IORING_CQE_F_BUFFER)
+    {
+        bid = cqes[n].flags >> IORING_CQE_BUFFER_SHIFT;
+        *buf = ring->buffers[bid];
+        ring->buffers[bid] = NULL;
+        if (res <= 0)
+        {
+            free(*buf);
+            *buf = NULL;
+        }
+    }
+    return res;
+}
+/*
+ * Wait for events of socket, see uringRecv().
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+int uringPoll(struct uring_t *ring, int fd, short events, int timeout)
+{
+    struct io_uring_cqe cqes[URING_ENTRIES];
+    struct __kernel_timespec ts;
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_Get(ring, IORING_OP_POLL_ADD, fd);
+    sqe->poll_events = (unsigned short)events;
+    uring_Timeout(ring, &ts, timeout);
+    if (uring_Enter(ring, cqes) < 0)
+        return -1;
+    return uring_Result(&cqes[0], timeout ? &cqes[1] : NULL) < 0 ? -1 : 0;
+}
+/*
+ * Send data and close socket. Send is linked with close, so socket is
+ * closed by kernel right after last byte is sent, without return to
+ * caller between them. Send is done with MSG_WAITALL, if it fails or is
+ * short close is cancelled and socket stays open.
+ *
+ * ARGS
+ *     timeout    Timeout of send in seconds, 0 to wait forever.
+ *     closed     Set to 1 if socket is closed, 0 otherwise.
+ *
+ * RETURN
+ *     Number of sent bytes, -1 on error (errno is ETIMEDOUT on timeout).
+ */
+ssize_t uringSendClose(struct uring_t *ring, int fd, struct iovec *iov, int iovcnt,
+        int timeout, int *closed)
+{
+    struct io_uring_cqe cqes[URING_ENTRIES];
+    struct __kernel_timespec ts;
+    struct io_uring_sqe *sqe;
+    struct msghdr msg;
+    int n;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = iovcnt;
+    sqe = uring_Get(ring, IORING_OP_SENDMSG, fd);
+    sqe->addr      = (unsigned long)&msg;
+    sqe->len       = 1;
+    sqe->msg_flags = MSG_WAITALL;
+    uring_Timeout(ring, &ts, timeout);
+    /* NOTE Timeout is linked to send, chain goes on after it. */
+    uring_Link(ring);
+    n = ring->nsubmit;
+    uring_Get(ring, IORING_OP_CLOSE, fd);
+    if (uring_Enter(ring, cqes) < 0)
+    {
+        *closed = 0;
+        return -1;
+    }
+    *closed = cqes[n].res != -ECANCELED;
+    return uring_Result(&cqes[0], timeout ? &cqes[1] : NULL);
+}
+/*
+ * Prepare submission queue entry, it is submitted by uring_Enter(). Index
+ * of entry in submission is set as user data, so completion is found in
+ * same place of array given to uring_Enter().
+ *
+ * RETURN
+ *     Zeroed entry with opcode and fd set.
+ */
+static struct io_uring_sqe *uring_Get(struct uring_t *ring, int opcode, int fd)
+{
+    struct io_uring_sqe *sqe;
+    unsigned index;
+
+    index = (*ring->sqTail + ring->nsubmit) & *ring->sqMask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode    = opcode;
+    sqe->fd        = fd;
+    sqe->user_data = ring->nsubmit;
+    ring->sqArray[index] = index;
+    ring->nsubmit++;
+    return sqe;
+}
+/*
+ * Link last prepared entry with next one, next entry is started only if
+ * last one succeeds.
+ */
+static void uring_Link(struct uring_t *ring)
+{
+    ring->sqes[(*ring->sqTail + ring->nsubmit - 1) & *ring->sqMask].flags |= IOSQE_IO_LINK;
+}
+/*
+ * Link timeout to last prepared entry. Nothing is done if "timeout" is 0.
+ *
+ * ARGS
+ *     ts         Timeout buffer, must live until uring_Enter() returns.
+ *     timeout    Timeout in seconds.
+ */
+static void uring_Timeout(struct uring_t *ring, struct __kernel_timespec *ts, int timeout)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!timeout)
+        return;
+    uring_Link(ring);
+    ts->tv_sec  = timeout;
+    ts->tv_nsec = 0;
+    sqe = uring_Get(ring, IORING_OP_LINK_TIMEOUT, -1);
+    sqe->addr = (unsigned long)ts;
+    sqe->len  = 1;
+}
+/*
+ * Submit prepared entries and wait for completion of all of them.
+ *
+ * ARGS
+ *     cqes    Completions, in order of entries.
+ *
+ * NOTE Completion is waited with poll() on ring, so thread may be cancelled
+ * while waiting.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+static int uring_Enter(struct uring_t *ring, struct io_uring_cqe *cqes)
+{
+    struct io_uring_cqe *cqe;
+    struct pollfd pfd;
+    unsigned head;
+    int nsubmit, ndone, res;
+
+    nsubmit = ring->nsubmit;
+    ring->nsubmit = 0;
+    __atomic_store_n(ring->sqTail, *ring->sqTail + nsubmit, __ATOMIC_RELEASE);
+
+    while ((res = syscall(__NR_io_uring_enter, ring->fd, nsubmit, 0, 0, NULL, 0)) < 0 &&
+            errno == EINTR)
+        ;
+    if (res < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "io_uring enter failed, %s", strerror(errno));
+        return -1;
+    }
+
+    /*
+     * All completions are reaped, so nothing is left in ring for next call
+     * (buffers of entries live on stack of caller).
+     */
+    ndone  = 0;
+    pfd.fd = ring->fd;
+    while (ndone < nsubmit)
+    {
+        head = *ring->cqHead;
+        if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+        {
+            pfd.events  = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+                return -1;
+            continue;
+        }
+        cqe = &ring->cqes[head & *ring->cqMask];
+        if (cqe->user_data < (unsigned)nsubmit)
+            cqes[cqe->user_data] = *cqe;
+        __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+        ndone++;
+    }
+    return 0;
+}
+/*
+ * ARGS
+ *     timeout    Completion of linked timeout, NULL if there is none.
+ *
+ * RETURN
+ *     Result of operation, -1 on error (errno is ETIMEDOUT if operation is
+ *     cancelled by timeout).
+ */
+static int uring_Result(struct io_uring_cqe *cqe, struct io_uring_cqe *timeout)
+{
+    if (cqe->res >= 0)
+        return cqe->res;
+    errno = (cqe->res == -ECANCELED && timeout && timeout->res == -ETIME) ? ETIMEDOUT : -cqe->res;
+    return -1;
+}
@@ -0,0 +1,77 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef _URING_H
+#define _URING_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * io_uring instance of one thread, used for socket operations which would
+ * block otherwise. Operation and its timeout are submitted together, so
+ * waiting for socket costs one system call in most cases instead of
+ * recv(), poll() and recv() again. Last write of connection is submitted
+ * linked with close of socket.
+ */
+#define URING_ENTRIES    8
+#define URING_BUFFERS    2 /* Buffers provided to kernel, see uringRecvBuffer(). */
+struct uring_t {
+    int fd;
+    /* Submission queue. */
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+    /* Completion queue. */
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+    /* Mappings. */
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+    int nsubmit; /* Entries prepared and not submitted yet. */
+    /* Buffers owned by kernel, NULL if slot is taken by receive. */
+    char *buffers[URING_BUFFERS];
+    size_t bufferSize;
+};
+
+int uringInit(struct uring_t *ring, size_t bufferSize);
+void uringDestroy(struct uring_t *ring);
+ssize_t uringRecv(struct uring_t *ring, int fd, void *buf, size_t len, int timeout);
+ssize_t uringRecvBuffer(struct uring_t *ring, int fd, char **buf, int timeout);
+int uringPoll(struct uring_t *ring, int fd, short events, int timeout);
+ssize_t uringSendClose(struct uring_t *ring, int fd, struct iovec *iov, int iovcnt,
+        int timeout, int *closed);
+
+#endif
+
@@ -0,0 +1,343 @@
+/*
+ * Luno - the web server.
+ *
+ * Copyright (c) 2016-2019, Dmitry Kobylin
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <stdlib.h>
+/* */
+#include <lua.h>
+/* */
+#include "worker.h"
+/* */
+#include "client.h"
+#include "debug.h"
+#include "header.h"
+#include "lclient.h"
+#include "reactor.h"
+#include "response.h"
+#include "server.h"
+#include "thread.h"
+#include "uring.h"
+
+struct worker_t {
+    struct thread_t thread;
+    lua_State *luaState;     /* Lua state, prepared before worker starts. */
+    struct uring_t ring;     /* Used if server.uring is set. */
+    struct headerIndex_t headers; /* Header fields of request being served. */
+    size_t luaMemory;        /* Lua heap after state is prepared. */
+    struct client_t *client; /* Client being served, NULL if idle. */
+    int started;
+};
+
+static struct {
+    struct worker_t *workers;
+    int nworkers;
+
+    struct threadMutex_t mutex;
+    struct threadSem_t sem; /* Number of clients in queue. */
+    struct threadSem_t ready; /* Worker has prepared lua state. */
+    struct client_t *head;
+    struct client_t *tail;
+    int queued;          /* Number of clients in queue. */
+    int busy;            /* Workers running handler. */
+    unsigned long shed;  /* Requests refused because queue was full. */
+} pool;
+
+static THREAD_RUN(worker_Run, arg);
+static THREAD_STOP(worker_Stop, arg);
+static struct client_t *worker_Pop();
+
+/*
+ * Start worker threads. Lua state of every worker is initialized before
+ * any connection is served, so requests do not pay for lua bootstrap.
+ * State is created by worker thread itself (after it is pinned to CPU, if
+ * server.workerCpus is given), so lua heap is allocated from memory local
+ * to that CPU. Workers are started one by one, states are not created
+ * concurrently.
+ *
+ * RETURN
+ *     0 on success, -1 on error.
+ */
+int workerStart(int nworkers)
+{
+    struct worker_t *worker;
+    int i;
+
+    pool.head     = NULL;
+    pool.tail     = NULL;
+    pool.nworkers = 0;
+    pool.queued   = 0;
+    pool.busy     = 0;
+    pool.shed     = 0;
+    threadMutexFill(&pool.mutex);
+    threadSemFill(&pool.sem);
+    threadSemFill(&pool.ready);
+
+    if (threadMutexInit(&pool.mutex) < 0 || threadSemInit(&pool.sem, 0) < 0 ||
+            threadSemInit(&pool.ready, 0) < 0)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "Worker queue init failed");
+        return -1;
+    }
+    pool.workers = calloc(nworkers, sizeof(struct worker_t));
+    if (!pool.workers)
+    {
+        debugPrint(DLEVEL_ERROR, "%s", "Failed to allocate workers");
+        return -1;
+    }
+    pool.nworkers = nworkers;
+
+    for (i = 0; i < nworkers; i++)
+    {
+        worker = &pool.workers[i];
+        worker->ring.fd = -1;
+        headerInit(&worker->headers);
+        if (server.uring && uringInit(&worker->ring, CLIENT_INPUT_SIZE) < 0)
+        {
+            debugPrint(DLEVEL_WARNING, "%s", "Using poll() instead of io_uring");
+            server.uring = 0;
+        }
+    }
+    for (i = 0; i < nworkers; i++)
+    {
+        worker = &pool.workers[i];
+        worker->client   = NULL;
+        worker->luaState = NULL;
+        threadInit(&worker->thread);
+        if (server.nworkerCpus)
+            threadSetCpu(&worker->thread, server.workerCpus[i % server.nworkerCpus]);
+        threadSetStack(&worker->thread, server.threadStack, server.threadGuard);
+        if (threadCreate(&worker->thread, worker_Run, worker_Stop, worker) < 0)
+        {
+            debugPrint(DLEVEL_ERROR, "Failed to start worker %d", i);
+            return -1;
+        }
+        threadSemWait(&pool.ready);
+        if (!worker->luaState)
+        {
+            /* NOTE Thread has exited. */
+            debugPrint(DLEVEL_ERROR, "Failed to prepare lua state of worker %d", i);
+            return -1;
+        }
+        worker->started = 1;
+    }
+    debugPrint(DLEVEL_INFO, "Started %d workers", nworkers);
+    if (server.uring)
+        debugPrint(DLEVEL_INFO, "%s", "Workers use io_uring for socket I/O");
+
+    return 0;
+}
+/*
+ * Stop worker threads. Connections being processed are closed.
+ */
+void workerStop()
+{
+    struct workerStats_t stats;
+    struct worker_t *worker;
+    int i;
+
+    debugPrint(DLEVEL_INFO, "Stopping workers");
+    if (server.threadStack && pool.nworkers)
+    {
+        workerStats(&stats);
+        debugPrint(DLEVEL_INFO, "Deepest stack of workers %zu bytes of %zu",
+                stats.stackUsed, server.threadStack);
+    }
+    for (i = 0; i < pool.nworkers; i++)
+    {
+        worker = &pool.workers[i];
+        if (worker->started)
+            threadCancel(&worker->thread);
+        if (worker->luaState)
+            lclientCloseState(worker->luaState);
+        if (worker->ring.fd >= 0)
+            uringDestroy(&worker->ring);
+        headerDestroy(&worker->headers);
+    }
+    free(pool.workers);
+    pool.workers  = NULL;
+    pool.nworkers = 0;
+    pool.head     = NULL;
+    pool.tail     = NULL;
+    threadSemDestroy(&pool.sem);
+    threadSemDestroy(&pool.ready);
+    threadMutexDestroy(&pool.mutex);
+}
+/*
+ * Queue client with complete request head for processing. Queue is limited
+ * by server.maxQueue, so handlers are not started for requests which wait
+ * too long anyway.
+ *
+ * RETURN
+ *     0 on success, -1 if queue is full.
+ */
+int workerPush(struct client_t *client)
+{
+    client->next = NULL;
+    threadMutexLock(&pool.mutex);
+    if (server.maxQueue && pool.queued >= server.maxQueue)
+    {
+        threadMutexUnlock(&pool.mutex);
+        return -1;
+    }
+    pool.queued++;
+    if (pool.tail)
+        pool.tail->next = client;
+    else
+        pool.head = client;
+    pool.tail = client;
+    threadMutexUnlock(&pool.mutex);
+    threadSemPost(&pool.sem);
+    return 0;
+}
+/*
+ * Answer request refused by workerPush() with pre-rendered 503 response.
+ * Connection is closed after response is written.
+ */
+void workerShed(struct client_t *client)
+{
+    size_t len;
+    const char *busy;
+
+    __atomic_add_fetch(&pool.shed, 1, __ATOMIC_RELAXED);
+    DEBUG_CLIENT(DLEVEL_WARNING, "%s", "Run queue is full, request refused");
+
+    /* NOTE On write error connection is closed by reactor. */
+    busy = responseBusy(&len);
+    client->closing = 1;
+    clientSendStatic(client, busy, len);
+}
+/*
+ *
+ */
+void workerStats(struct workerStats_t *stats)
+{
+    size_t used;
+    int i;
+
+    threadMutexLock(&pool.mutex);
+    stats->queued = pool.queued;
+    threadMutexUnlock(&pool.mutex);
+    stats->workers = pool.nworkers;
+    stats->busy    = __atomic_load_n(&pool.busy, __ATOMIC_RELAXED);
+    stats->shed    = __atomic_load_n(&pool.shed, __ATOMIC_RELAXED);
+
+    stats->stackUsed = 0;
+    stats->luaMemory = pool.nworkers ? pool.workers[0].luaMemory : 0;
+    for (i = 0; i < pool.nworkers; i++)
+    {
+        used = threadStackUsed(&pool.workers[i].thread);
+        if (used > stats->stackUsed)
+            stats->stackUsed = used;
+    }
+}
+/*
+ *
+ */
+static struct client_t *worker_Pop()
+{
+    struct client_t *client;
+
+    threadSemWait(&pool.sem);
+
+    threadMutexLock(&pool.mutex);
+    client = pool.head;
+    if (client)
+    {
+        pool.head = client->next;
+        if (!pool.head)
+            pool.tail = NULL;
+        client->next = NULL;
+        pool.queued--;
+    }
+    threadMutexUnlock(&pool.mutex);
+
+    return client;
+}
+/*
+ *
+ */
+static THREAD_RUN(worker_Run, arg)
+{
+    struct worker_t *worker;
+    struct client_t *client;
+    int keepAlive;
+
+    worker = arg;
+    /* Depth of stack is measured only if size is set, see threadStackPaint(). */
+    if (server.threadStack)
+        threadStackPaint(&worker->thread);
+    worker->luaState = lclientNewState();
+    if (worker->luaState)
+        worker->luaMemory = lua_gc(worker->luaState, LUA_GCCOUNT, 0) * 1024 +
+            lua_gc(worker->luaState, LUA_GCCOUNTB, 0);
+    threadSemPost(&pool.ready);
+    if (!worker->luaState)
+        return;
+
+    while (1)
+    {
+        client = worker_Pop();
+        if (!client)
+            continue;
+
+        __atomic_add_fetch(&pool.busy, 1, __ATOMIC_RELAXED);
+        worker->client   = client;
+        client->luaState = worker->luaState;
+        client->ring     = server.uring ? &worker->ring : NULL;
+        client->request.headers = &worker->headers;
+        keepAlive = clientProcess(client);
+        client->luaState = NULL;
+        client->ring     = NULL;
+        client->request.headers = NULL;
+        worker->client   = NULL;
+        __atomic_sub_fetch(&pool.busy, 1, __ATOMIC_RELAXED);
+        /* Reactor finishes transfer of queued output. */
+        if (keepAlive || clientOutputPending(client))
+        {
+            client->closing = !keepAlive;
+            reactorResume(client);
+        } else {
+            clientStop(client);
+        }
+    }
+}
+/*
+ * Called on worker cancelation.
+ */
+static THREAD_STOP(worker_Stop, arg)
+{
+    struct worker_t *worker;
+
+    worker = arg;
+    if (worker->client)
+    {
+        worker->client->luaState = NULL;
+        worker->client->ring     = NULL;
+        clientStop(worker->client);
+        worker->client = NULL;
+    }
+}
+
@@ -1,6 +0,0 @@
-################################################################################
-#
-#
-################################################################################
-export CROSS_COMPILE = i386-mingw32-
-